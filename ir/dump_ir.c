@@ -1,5 +1,8 @@
 #include <stdlib.h>
 
+#include <string.h>
+
+#include <ir/func.h>
 #include <ir/ir.h>
 
 int main(int argc, char* argv[]) {
@@ -8,11 +11,31 @@ int main(int argc, char* argv[]) {
   // Host dump_ir.c.exe should dump to stdout for testing.
   stderr = stdout;
 #else
+  bool dump_funcs = false;
+  if (argc >= 2 && !strcmp(argv[1], "-f")) {
+    dump_funcs = true;
+    argc--;
+    argv++;
+  } else if (argc >= 2 && !strcmp(argv[1], "-v")) {
+    enable_vregs();
+    argc--;
+    argv++;
+  }
   if (argc < 2) {
     fprintf(stderr, "no input file\n");
     exit(1);
   }
-  Module* m = load_eir_from_file(argv[1]);
+  Module* m = load_eir_from_files(argc - 1, (const char**)argv + 1);
+  if (dump_funcs) {
+    dump_call_graph(build_call_graph(m), stdout);
+    int num_taken;
+    int* taken = get_addr_taken_pcs(m, &num_taken);
+    printf("addr taken:");
+    for (int i = 0; i < num_taken; i++)
+      printf(" %d", taken[i]);
+    printf("\n");
+    return 0;
+  }
 #endif
   for (Inst* inst = m->text; inst; inst = inst->next) {
     dump_inst(inst);
@@ -4,8 +4,13 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <ir/func.h>
 #include <ir/ir.h>
 
+#ifndef __eir__
+#include <sys/mman.h>
+#endif
+
 #ifdef __eir__
 #define MEMSZ 0x100000
 #else
@@ -14,9 +19,14 @@
 
 int pc;
 Inst* prog[65536];
-int mem[MEMSZ];
-int regs[6];
+unsigned int* mem;
+unsigned int regs[6];
+// Words are wrapped to this. See -m32.
+unsigned int word_mask = MEMSZ - 1;
+int word_bits = 24;
 bool verbose;
+CallGraph* profile_cg;
+int* profile_counts;
 
 #ifdef __GNUC__
 __attribute__((noreturn))
@@ -27,23 +37,33 @@ static void error(const char* msg) {
 }
 
 static inline void dump_regs(Inst* inst) {
-  bool had_negative = false;
+  bool had_overflow = false;
   static const char* REG_NAMES[] = {
     "A", "B", "C", "D", "BP", "SP"
   };
   fprintf(stderr, "PC=%d ", inst->lineno);
   for (int i = 0; i < 6; i++) {
-    if (regs[i] < 0)
-      had_negative = true;
-    fprintf(stderr, "%s=%d", REG_NAMES[i], regs[i]);
+    if (regs[i] > word_mask)
+      had_overflow = true;
+    fprintf(stderr, "%s=%u", REG_NAMES[i], regs[i]);
     fprintf(stderr, i == 5 ? "\n" : " ");
   }
-  if (had_negative) {
-    error("had negative!");
+  if (had_overflow) {
+    error("had overflow!");
+  }
+}
+
+static void dump_profile() {
+  fprintf(stderr, "=== instructions executed per function ===\n");
+  for (int i = 0; i < profile_cg->num_funcs; i++) {
+    if (profile_counts[i]) {
+      fprintf(stderr, "%d %s\n",
+              profile_counts[i], profile_cg->funcs[i].name);
+    }
   }
 }
 
-static int value(Value* v) {
+static unsigned int value(Value* v) {
   if (v->type == REG) {
     return regs[v->reg];
   } else if (v->type == IMM) {
@@ -53,7 +73,7 @@ static int value(Value* v) {
   }
 }
 
-static int src(Inst* inst) {
+static unsigned int src(Inst* inst) {
   return value(&inst->src);
 }
 
@@ -62,8 +82,8 @@ static int cmp(Inst* inst) {
   if (op >= 16)
     op -= 8;
   assert(inst->dst.type == REG);
-  int d = regs[inst->dst.reg];
-  int s = src(inst);
+  unsigned int d = regs[inst->dst.reg];
+  unsigned int s = src(inst);
   switch (op) {
     case JEQ:
       return d == s;
@@ -84,7 +104,60 @@ static int cmp(Inst* inst) {
   }
 }
 
+static unsigned int arith(Inst* inst) {
+  unsigned int d = regs[inst->dst.reg];
+  unsigned int s = src(inst);
+  switch (inst->op) {
+    case MUL: {
+      if (word_bits == 32)
+        return d * s;
+      // Split the operands so partial products fit in the host int.
+      unsigned int lo = (d % 4096) * (s % 4096);
+      unsigned int mid = d / 4096 * (s % 4096) + d % 4096 * (s / 4096);
+      unsigned int r = lo + mid % 4096 * 4096;
+      return MOD24(r);
+    }
+    case DIV:
+      if (!s)
+        error("division by zero");
+      return d / s;
+    case MOD:
+      if (!s)
+        error("division by zero");
+      return d % s;
+    case AND:
+      return d & s;
+    case OR:
+      return d | s;
+    case XOR:
+      return d ^ s;
+    case SHL:
+      return s < (unsigned int)word_bits ? (d << s) & word_mask : 0;
+    case SHR:
+      return s < (unsigned int)word_bits ? d >> s : 0;
+    default:
+      error("oops");
+  }
+}
+
+// With 32-bit words, the stack starts at the top of 2^32 words. Only
+// the pages touched are backed.
+static unsigned int* alloc_mem() {
+#ifndef __eir__
+  if (word_bits == 32) {
+    void* p = mmap(NULL, (size_t)4 << 32, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED)
+      error("failed to allocate memory");
+    return p;
+  }
+#endif
+  return calloc(MEMSZ, sizeof(int));
+}
+
 int main(int argc, char* argv[]) {
+  enable_arith_ops();
+  enable_mem_ops();
 #if defined(NOFILE) || defined(__eir__)
   Module* m = load_eir(stdin);
 #else
@@ -93,15 +166,33 @@ int main(int argc, char* argv[]) {
     argc--;
     argv++;
   }
+  bool profile = false;
+  if (argc >= 2 && !strcmp(argv[1], "-p")) {
+    profile = true;
+    argc--;
+    argv++;
+  }
+  if (argc >= 2 && !strcmp(argv[1], "-m32")) {
+    word_bits = 32;
+    word_mask = ~0U;
+    set_word_bits(32);
+    argc--;
+    argv++;
+  }
 
   if (argc < 2) {
     fprintf(stderr, "no input file\n");
     return 1;
   }
 
-  Module* m = load_eir_from_file(argv[1]);
+  Module* m = load_eir_from_files(argc - 1, (const char**)argv + 1);
+  if (profile) {
+    profile_cg = build_call_graph(m);
+    profile_counts = calloc(profile_cg->num_funcs, sizeof(int));
+  }
 #endif
 
+  mem = alloc_mem();
   int i;
   i = 0;
   for (Data* d = m->data; d; d = d->next, i++) {
@@ -121,6 +212,8 @@ int main(int argc, char* argv[]) {
         dump_regs(inst);
         dump_inst(inst);
       }
+      if (profile_counts)
+        profile_counts[profile_cg->pc2func[inst->pc]]++;
       int npc = -1;
       switch (inst->op) {
         case MOV:
@@ -131,31 +224,29 @@ int main(int argc, char* argv[]) {
         case ADD:
           assert(inst->dst.type == REG);
           regs[inst->dst.reg] += src(inst);
-          regs[inst->dst.reg] += MEMSZ;
-          regs[inst->dst.reg] %= MEMSZ;
+          regs[inst->dst.reg] &= word_mask;
           break;
 
         case SUB:
           assert(inst->dst.type == REG);
           regs[inst->dst.reg] -= src(inst);
-          regs[inst->dst.reg] += MEMSZ;
-          regs[inst->dst.reg] %= MEMSZ;
+          regs[inst->dst.reg] &= word_mask;
           break;
 
         case LOAD: {
           assert(inst->dst.type == REG);
-          int addr = src(inst);
-          if (addr < 0)
-            error("zero page load");
+          unsigned int addr = src(inst);
+          if (addr > word_mask)
+            error("out of bounds load");
           regs[inst->dst.reg] = mem[addr];
           break;
         }
 
         case STORE: {
           assert(inst->dst.type == REG);
-          int addr = src(inst);
-          if (addr < 0)
-            error("zero page store");
+          unsigned int addr = src(inst);
+          if (addr > word_mask)
+            error("out of bounds store");
           mem[addr] = regs[inst->dst.reg];
           break;
         }
@@ -167,12 +258,12 @@ int main(int argc, char* argv[]) {
         case GETC: {
           int c = getchar();
           regs[inst->dst.reg] = c == EOF ? 0 : c;
-          regs[inst->dst.reg] += MEMSZ;
-          regs[inst->dst.reg] %= MEMSZ;
           break;
         }
 
         case EXIT:
+          if (profile_counts)
+            dump_profile();
           exit(0);
 
         case DUMP:
@@ -187,6 +278,32 @@ int main(int argc, char* argv[]) {
           regs[inst->dst.reg] = cmp(inst);
           break;
 
+        case MUL:
+        case DIV:
+        case MOD:
+        case AND:
+        case OR:
+        case XOR:
+        case SHL:
+        case SHR:
+          assert(inst->dst.type == REG);
+          regs[inst->dst.reg] = arith(inst);
+          break;
+
+        case MEMCPY:
+        case MEMSET: {
+          assert(inst->dst.type == REG);
+          unsigned int d = regs[inst->dst.reg];
+          unsigned int s = src(inst);
+          unsigned int n = value(&inst->jmp);
+          if (n && (d > word_mask - (n - 1) ||
+                    (inst->op == MEMCPY && s > word_mask - (n - 1))))
+            error("out of bounds block operation");
+          for (unsigned int i = 0; i < n; i++)
+            mem[d + i] = inst->op == MEMCPY ? mem[s + i] : s;
+          break;
+        }
+
         case JEQ:
         case JNE:
         case JLT:
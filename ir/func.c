@@ -0,0 +1,157 @@
+#include <ir/func.h>
+
+#include <stdlib.h>
+
+static bool cg_is_jump(Op op) {
+  return op >= JEQ && op <= JMP;
+}
+
+// Marks JMPs whose return site is loaded by a MOV earlier in the same
+// run of instructions, i.e., since the previous jump.
+static void cg_find_calls(Module* module, bool* is_call) {
+  for (Inst* inst = module->text; inst; inst = inst->next) {
+    if (inst->op != MOV || inst->src.type != IMM)
+      continue;
+    Inst* jmp = inst->next;
+    while (jmp && !cg_is_jump(jmp->op))
+      jmp = jmp->next;
+    if (jmp && jmp->op == JMP && jmp->pc + 1 == inst->src.imm)
+      is_call[jmp->pc] = true;
+  }
+}
+
+static int cg_add_entries(Module* module, int num_pcs,
+                          int* entries, const char** names) {
+  int n = 1;
+  entries[0] = 0;
+  names[0] = "_start";
+  for (TextLabel* l = module->labels; l; l = l->next) {
+    if (l->name[0] == '.' || l->pc >= num_pcs)
+      continue;
+    if (entries[n - 1] == l->pc) {
+      if (n == 1)
+        names[0] = l->name;
+      continue;
+    }
+    entries[n] = l->pc;
+    names[n] = l->name;
+    n++;
+  }
+  return n;
+}
+
+CallGraph* build_call_graph(Module* module) {
+  CallGraph* cg = calloc(1, sizeof(CallGraph));
+  int num_labels = 0;
+  for (Inst* inst = module->text; inst; inst = inst->next)
+    cg->num_pcs = inst->pc + 1;
+  for (TextLabel* l = module->labels; l; l = l->next)
+    num_labels++;
+
+  int* entries = calloc(num_labels + 1, sizeof(int));
+  const char** names = calloc(num_labels + 1, sizeof(char*));
+  cg->num_funcs = cg_add_entries(module, cg->num_pcs, entries, names);
+  cg->funcs = calloc(cg->num_funcs, sizeof(Func));
+  cg->pc2func = calloc(cg->num_pcs, sizeof(int));
+  for (int i = 0; i < cg->num_funcs; i++) {
+    Func* func = &cg->funcs[i];
+    func->name = names[i];
+    func->entry = entries[i];
+    func->end = i + 1 < cg->num_funcs ? entries[i + 1] : cg->num_pcs;
+    for (int pc = func->entry; pc < func->end; pc++)
+      cg->pc2func[pc] = i;
+  }
+
+  bool* is_call = calloc(cg->num_pcs, sizeof(bool));
+  cg_find_calls(module, is_call);
+  for (int pc = 0; pc < cg->num_pcs; pc++) {
+    if (is_call[pc])
+      cg->num_calls++;
+  }
+  cg->calls = calloc(cg->num_calls, sizeof(CallSite));
+
+  int num_calls = 0;
+  for (Inst* inst = module->text; inst; inst = inst->next) {
+    Func* func = &cg->funcs[cg->pc2func[inst->pc]];
+    if (!func->text)
+      func->text = inst;
+    if (inst->op != JMP)
+      continue;
+
+    if (!is_call[inst->pc]) {
+      if (inst->jmp.type == REG)
+        func->num_rets++;
+      continue;
+    }
+
+    CallSite* call = &cg->calls[num_calls++];
+    call->pc = inst->pc;
+    call->ret_pc = inst->pc + 1;
+    call->caller = cg->pc2func[inst->pc];
+    call->callee = -1;
+    if (inst->jmp.type == IMM && inst->jmp.imm < cg->num_pcs)
+      call->callee = cg->pc2func[inst->jmp.imm];
+    if (call->callee < 0)
+      func->has_indirect_call = true;
+  }
+
+  for (int i = 0; i < cg->num_calls; i++)
+    cg->funcs[cg->calls[i].caller].num_callees++;
+  for (int i = 0; i < cg->num_funcs; i++) {
+    Func* func = &cg->funcs[i];
+    if (func->num_callees)
+      func->callees = calloc(func->num_callees, sizeof(int));
+    func->num_callees = 0;
+  }
+  for (int i = 0; i < cg->num_calls; i++) {
+    Func* func = &cg->funcs[cg->calls[i].caller];
+    int callee = cg->calls[i].callee;
+    if (callee < 0)
+      continue;
+    bool found = false;
+    for (int j = 0; j < func->num_callees; j++) {
+      if (func->callees[j] == callee)
+        found = true;
+    }
+    if (!found)
+      func->callees[func->num_callees++] = callee;
+  }
+  return cg;
+}
+
+int* get_addr_taken_pcs(Module* module, int* num_pcs) {
+  // Labels after the last instruction have no code to jump to.
+  int last_pc = 0;
+  for (Inst* inst = module->text; inst; inst = inst->next)
+    last_pc = inst->pc;
+
+  int n = 0;
+  for (TextLabel* l = module->labels; l; l = l->next) {
+    if (l->addr_taken)
+      n++;
+  }
+  int* pcs = calloc(n + 1, sizeof(int));
+  n = 0;
+  for (TextLabel* l = module->labels; l; l = l->next) {
+    if (l->addr_taken && l->pc <= last_pc &&
+        (n == 0 || pcs[n - 1] != l->pc))
+      pcs[n++] = l->pc;
+  }
+  *num_pcs = n;
+  return pcs;
+}
+
+void dump_call_graph(CallGraph* cg, FILE* fp) {
+  for (int i = 0; i < cg->num_funcs; i++) {
+    Func* func = &cg->funcs[i];
+    fprintf(fp, "%s: pc=%d-%d rets=%d\n",
+            func->name, func->entry, func->end - 1, func->num_rets);
+    for (int j = 0; j < cg->num_calls; j++) {
+      CallSite* call = &cg->calls[j];
+      if (call->caller != i)
+        continue;
+      fprintf(fp, "  call pc=%d ret=%d -> %s\n", call->pc, call->ret_pc,
+              call->callee < 0 ? "*" : cg->funcs[call->callee].name);
+    }
+  }
+}
@@ -0,0 +1,67 @@
+#ifndef ELVM_FUNC_H_
+#define ELVM_FUNC_H_
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include <ir/ir.h>
+
+// Functions and the call graph recovered from a module.
+//
+// EIR has no call instruction. 8cc calls a function by storing the pc
+// which follows the call (the return site) and jumping to the entry,
+// and returns by jumping to a register. A function is a range of pcs
+// starting at a text label whose name does not begin with '.', and a
+// call is a JMP preceded by a MOV of its return site in the same
+// straight-line run of instructions.
+
+typedef struct {
+  const char* name;
+  // The function covers pcs in [entry, end).
+  int entry;
+  int end;
+  Inst* text;
+  // Indices of the functions called directly, without duplicates.
+  int* callees;
+  int num_callees;
+  bool has_indirect_call;
+  // The number of register jumps which are not calls.
+  int num_rets;
+} Func;
+
+typedef struct {
+  // The pc of the JMP and its return site.
+  int pc;
+  int ret_pc;
+  int caller;
+  // -1 for calls through registers.
+  int callee;
+} CallSite;
+
+typedef struct {
+  Func* funcs;
+  int num_funcs;
+  CallSite* calls;
+  int num_calls;
+  // The index of the function which contains each pc.
+  int* pc2func;
+  int num_pcs;
+} CallGraph;
+
+CallGraph* build_call_graph(Module* module);
+
+// Returns the pcs whose addresses are taken in ascending order. Only
+// these pcs can be the targets of register jumps.
+int* get_addr_taken_pcs(Module* module, int* num_pcs);
+
+void dump_call_graph(CallGraph* cg, FILE* fp);
+
+// Rewrites LOADs and STOREs of non-escaping stack slots into MOVs
+// from and to virtual registers. Returns the number of virtual
+// registers used.
+int promote_stack_slots(Module* module);
+
+// Sets Inst.no_wrap on ADDs and SUBs which never wrap around.
+void analyze_ranges(Module* module);
+
+#endif  // ELVM_FUNC_H_
@@ -7,9 +7,16 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <ir/func.h>
 #include <ir/table.h>
 
 static bool g_split_basic_block_by_mem = false;
+static bool g_enable_arith_ops = false;
+static bool g_enable_mem_ops = false;
+static bool g_enable_vregs = false;
+static bool g_enable_range_analysis = false;
+static int g_word_bits = 24;
+static unsigned int g_word_mask = UINT_MAX;
 
 static char g_current_magic_comment[64];
 
@@ -18,8 +25,23 @@ typedef struct DataPrivate_ {
   struct DataPrivate_* next;
   Value val;
   int lineno;
+  int module;
+  // For a label, true if an earlier module has a definition of it
+  // which is used instead of this one.
+  bool is_dup;
 } DataPrivate;
 
+// A global label defined again by a later module. Unless both
+// definitions are weak, they must turn out to be identical.
+typedef struct LinkDup_ {
+  const char* name;
+  const char* alias;
+  bool is_data;
+  const char* filename;
+  int lineno;
+  struct LinkDup_* next;
+} LinkDup;
+
 typedef struct {
   const char* filename;
   int lineno;
@@ -32,10 +54,25 @@ typedef struct {
   int subsection;
   DataPrivate* data;
   bool prev_boundary;
+  int arith_label;
+  bool has_arith_tmp;
+  TextLabel* labels;
+  TextLabel* last_label;
+  Table* text_labels;
+  // For linking. module_aliases maps the labels which ".local" makes
+  // private to this module to their private names. weak_syms has the
+  // global labels whose first definition is weak.
+  int module;
+  Table* module_syms;
+  Table* module_aliases;
+  Table* module_weaks;
+  Table* data_labels;
+  Table* weak_syms;
+  LinkDup* dups;
 } Parser;
 
 enum {
-  DATA = LAST_OP + 1, TEXT, LONG, STRING, FILENAME, LOC
+  DATA = LAST_OP + 1, TEXT, LONG, STRING, FILENAME, LOC, LOCAL, WEAK
 };
 
 enum {
@@ -124,7 +161,7 @@ static void read_while_ident(Parser* p, char* buf, int len) {
 
 static int read_int(Parser* p, int c) {
   bool is_minus = false;
-  int r = 0;
+  unsigned int r = 0;
   if (c == '-') {
     is_minus = true;
     c = ir_getc(p);
@@ -140,11 +177,21 @@ static int read_int(Parser* p, int c) {
   return is_minus ? -r : r;
 }
 
+static int wrap_word(int v) {
+#ifdef __eir__
+  return v;
+#else
+  return v & g_word_mask;
+#endif
+}
+
 static DataPrivate* add_data(Parser* p) {
   DataPrivate* n = malloc(sizeof(DataPrivate));
   n->next = 0;
   n->v = p->subsection;
   n->lineno = p->lineno;
+  n->module = p->module;
+  n->is_dup = false;
   p->data->next = n;
   p->data = n;
   return n;
@@ -241,6 +288,26 @@ static Op get_op(Parser* p, const char* buf) {
     return LE;
   } else if (!strcmp(buf, "ge")) {
     return GE;
+  } else if (!strcmp(buf, "mul")) {
+    return MUL;
+  } else if (!strcmp(buf, "div")) {
+    return DIV;
+  } else if (!strcmp(buf, "mod")) {
+    return MOD;
+  } else if (!strcmp(buf, "and")) {
+    return AND;
+  } else if (!strcmp(buf, "or")) {
+    return OR;
+  } else if (!strcmp(buf, "xor")) {
+    return XOR;
+  } else if (!strcmp(buf, "shl")) {
+    return SHL;
+  } else if (!strcmp(buf, "shr")) {
+    return SHR;
+  } else if (!strcmp(buf, "memcpy")) {
+    return MEMCPY;
+  } else if (!strcmp(buf, "memset")) {
+    return MEMSET;
   } else if (!strcmp(buf, ".text")) {
     return TEXT;
   } else if (!strcmp(buf, ".data")) {
@@ -253,10 +320,478 @@ static Op get_op(Parser* p, const char* buf) {
     return FILENAME;
   } else if (!strcmp(buf, ".loc")) {
     return LOC;
+  } else if (!strcmp(buf, ".local")) {
+    return LOCAL;
+  } else if (!strcmp(buf, ".weak")) {
+    return WEAK;
   }
   return OP_UNSET;
 }
 
+static void add_text_label(Parser* p, char* name) {
+  if (!p->prev_boundary)
+    p->pc++;
+  intptr_t value = p->pc;
+  p->prev_boundary = true;
+  p->symtab = table_add(p->symtab, name, (void*)value);
+
+  TextLabel* label = calloc(1, sizeof(TextLabel));
+  label->name = name;
+  label->pc = p->pc;
+  if (p->last_label)
+    p->last_label->next = label;
+  else
+    p->labels = label;
+  p->last_label = label;
+  p->text_labels = table_add(p->text_labels, name, label);
+}
+
+static char* private_name(Parser* p, const char* name) {
+  char* s = malloc(strlen(name) + 16);
+  sprintf(s, "%s@%d", name, p->module);
+  return s;
+}
+
+// Labels starting with '.' are local to their module.
+static char* sym_name(Parser* p, const char* name) {
+  if (name[0] != '.' || !p->module)
+    return strdup(name);
+  return private_name(p, name);
+}
+
+#ifdef __GNUC__
+__attribute__((noreturn))
+#endif
+static void sym_error(Parser* p, const char* msg, const char* name) {
+  char buf[128];
+  snprintf(buf, sizeof(buf), "%s: %s", msg, name);
+  ir_error(p, buf);
+}
+
+// Returns the name to define a label by. Labels declared by ".local"
+// are private to their module. A global label may be defined by
+// several modules if all of them declare it ".weak" or if the
+// definitions are identical, which check_link_dups verifies. The
+// first definition is used: later ones get private names and their
+// data is dropped by drop_dups.
+static char* define_sym(Parser* p, char* name, DataPrivate* d) {
+  const void* v;
+  if (name[0] == '.')
+    return name;
+  if (table_get(p->module_aliases, name, &v))
+    return (char*)v;
+  if (table_get(p->module_syms, name, &v))
+    return name;
+
+  bool is_weak = table_get(p->module_weaks, name, &v);
+  bool is_data = table_get(p->data_labels, name, &v);
+  if (is_data || table_get(p->text_labels, name, &v)) {
+    if (is_data != (d != NULL))
+      sym_error(p, "duplicate definition", name);
+    char* alias = private_name(p, name);
+    if (d)
+      d->is_dup = true;
+    if (!is_weak || !table_get(p->weak_syms, name, &v)) {
+      LinkDup* dup = calloc(1, sizeof(LinkDup));
+      dup->name = name;
+      dup->alias = alias;
+      dup->is_data = is_data;
+      dup->filename = p->filename;
+      dup->lineno = p->lineno;
+      dup->next = p->dups;
+      p->dups = dup;
+    }
+    return alias;
+  }
+
+  if (is_weak)
+    p->weak_syms = table_add(p->weak_syms, name, name);
+  p->module_syms = table_add(p->module_syms, name, name);
+  return name;
+}
+
+// Handles ".local name" and ".weak name", which must come before the
+// label in its module.
+static void declare_sym(Parser* p, Op op) {
+  char buf[64];
+  const void* v;
+  skip_ws(p);
+  buf[0] = ir_getc(p);
+  if (buf[0] != '_' && !isalpha(buf[0]))
+    ir_error(p, "label expected");
+  read_while_ident(p, buf + 1, 62);
+  if (table_get(p->module_syms, buf, &v))
+    sym_error(p, "declared after its definition", buf);
+  char* name = strdup(buf);
+  if (op == (Op)LOCAL)
+    p->module_aliases = table_add(p->module_aliases, name,
+                                  private_name(p, name));
+  else
+    p->module_weaks = table_add(p->module_weaks, name, name);
+}
+
+static void add_inst(Parser* p, Op op, Value* args) {
+  p->text->next = calloc(1, sizeof(Inst));
+  p->text = p->text->next;
+  p->text->op = op;
+  p->text->pc = p->pc;
+  p->text->lineno = p->lineno;
+  if (g_current_magic_comment[0]) {
+    p->text->magic_comment = strdup(g_current_magic_comment);
+    g_current_magic_comment[0] = '\0';
+  }
+  p->prev_boundary = false;
+  switch (op) {
+    case LOAD:
+    case STORE:
+      if (g_split_basic_block_by_mem) {
+        p->pc++;
+        p->prev_boundary = true;
+      }
+      FALLTHROUGH;
+    case MOV:
+    case ADD:
+    case SUB:
+    case EQ:
+    case NE:
+    case LT:
+    case GT:
+    case LE:
+    case GE:
+    case MUL:
+    case DIV:
+    case MOD:
+    case AND:
+    case OR:
+    case XOR:
+    case SHL:
+    case SHR:
+      p->text->src = args[1];
+      FALLTHROUGH;
+    case GETC:
+      p->text->dst = args[0];
+      break;
+    case PUTC:
+      p->text->src = args[0];
+    case EXIT:
+    case DUMP:
+      break;
+    case JEQ:
+    case JNE:
+    case JLT:
+    case JGT:
+    case JLE:
+    case JGE:
+      p->text->dst = args[1];
+      p->text->src = args[2];
+      FALLTHROUGH;
+    case JMP:
+      p->text->jmp = args[0];
+      p->pc++;
+      p->prev_boundary = true;
+      break;
+    case MEMCPY:
+    case MEMSET:
+      p->text->dst = args[0];
+      p->text->src = args[1];
+      p->text->jmp = args[2];
+      break;
+    default:
+      ir_error(p, "oops");
+  }
+
+}
+
+static Value reg_value(Reg r) {
+  Value v;
+  v.type = REG;
+  v.reg = r;
+  return v;
+}
+
+static Value imm_value(int imm) {
+  Value v;
+  v.type = IMM;
+  v.imm = imm;
+  return v;
+}
+
+static Value ref_value(char* name) {
+  Value v;
+  v.type = (ValueType)REF;
+  v.tmp = name;
+  return v;
+}
+
+static void add_inst2(Parser* p, Op op, Value a0, Value a1) {
+  Value args[3] = { a0, a1 };
+  add_inst(p, op, args);
+}
+
+static void add_inst3(Parser* p, Op op, Value a0, Value a1, Value a2) {
+  Value args[3] = { a0, a1, a2 };
+  add_inst(p, op, args);
+}
+
+static void add_jcc(Parser* p, Op op, char* label, Reg r, Value v) {
+  Value args[3] = { ref_value(label), reg_value(r), v };
+  add_inst(p, op, args);
+}
+
+static void add_jmp(Parser* p, char* label) {
+  Value args[3] = { ref_value(label) };
+  add_inst(p, JMP, args);
+}
+
+static char* new_arith_label(Parser* p) {
+  char buf[32];
+  sprintf(buf, ".L__elvm_arith_%d", p->arith_label++);
+  return strdup(buf);
+}
+
+static const char* ARITH_TMP_NAMES[] = {
+  "__elvm_arith_a", "__elvm_arith_b", "__elvm_arith_c", "__elvm_arith_d",
+  "__elvm_arith_r"
+};
+
+static Value arith_tmp(Parser* p, int i) {
+  if (!p->has_arith_tmp) {
+    // One word for each of A-D and one for the result.
+    int subsection = p->subsection;
+    p->subsection = 0;
+    for (int j = 0; j < 5; j++) {
+      DataPrivate* d = add_data(p);
+      d->val.type = LABEL;
+      d->val.tmp = (char*)ARITH_TMP_NAMES[j];
+      add_imm_data(p, 0);
+    }
+    p->subsection = subsection;
+    p->has_arith_tmp = true;
+  }
+  return ref_value((char*)ARITH_TMP_NAMES[i]);
+}
+
+// Expands an arithmetic operation into a loop which only uses the
+// basic operations. Three of A-D other than dst are borrowed and
+// restored through memory. Only A is used as the destination of
+// loads, as some backends (e.g., bf) cannot load to other registers.
+static void lower_arith(Parser* p, Op op, Value* args) {
+  Reg dst = args[0].reg;
+  Value src = args[1];
+  if (args[0].type != REG)
+    ir_error(p, "register expected");
+
+  Reg tmps[3];
+  int ntmps = 0;
+  for (Reg r = A; r <= D; r++) {
+    if (r != dst && ntmps < 3)
+      tmps[ntmps++] = r;
+  }
+  Reg x = tmps[0];
+  Reg y = tmps[1];
+  Reg cnt = tmps[2];
+
+  for (int i = 0; i < ntmps; i++)
+    add_inst2(p, STORE, reg_value(tmps[i]), arith_tmp(p, tmps[i]));
+
+  Value top_bit = imm_value((int)(1U << (g_word_bits - 1)));
+  Value word_bits = imm_value(g_word_bits);
+  char* loop = new_arith_label(p);
+  char* done = new_arith_label(p);
+  char* l1;
+  char* l2;
+  switch (op) {
+    case MUL:
+      // dst = dst * x, scanning bits of x from the top.
+      add_inst2(p, MOV, reg_value(x), src);
+      add_inst2(p, MOV, reg_value(y), reg_value(dst));
+      add_inst2(p, MOV, reg_value(dst), imm_value(0));
+      add_inst2(p, MOV, reg_value(cnt), word_bits);
+      add_text_label(p, loop);
+      add_inst2(p, ADD, reg_value(dst), reg_value(dst));
+      l1 = new_arith_label(p);
+      add_jcc(p, JLT, l1, x, top_bit);
+      add_inst2(p, ADD, reg_value(dst), reg_value(y));
+      add_text_label(p, l1);
+      add_inst2(p, ADD, reg_value(x), reg_value(x));
+      add_inst2(p, SUB, reg_value(cnt), imm_value(1));
+      add_jcc(p, JNE, loop, cnt, imm_value(0));
+      add_text_label(p, done);
+      break;
+
+    case DIV:
+    case MOD:
+      // Restoring division. The bits of the dividend are shifted
+      // out of dst and the bits of the quotient are shifted in. y
+      // has the remainder.
+      add_inst2(p, MOV, reg_value(x), src);
+      add_inst2(p, MOV, reg_value(y), imm_value(0));
+      add_inst2(p, MOV, reg_value(cnt), word_bits);
+      add_text_label(p, loop);
+      l1 = new_arith_label(p);
+      l2 = new_arith_label(p);
+      // If the top bit of y is set, 2y+1 >= x and 2y+1 - x fits
+      // in a word even though 2y+1 does not.
+      add_jcc(p, JGE, l2, y, top_bit);
+      add_inst2(p, ADD, reg_value(y), reg_value(y));
+      add_jcc(p, JLT, l1, dst, top_bit);
+      add_inst2(p, ADD, reg_value(y), imm_value(1));
+      add_text_label(p, l1);
+      add_inst2(p, ADD, reg_value(dst), reg_value(dst));
+      l1 = new_arith_label(p);
+      add_jcc(p, JLT, l1, y, reg_value(x));
+      add_inst2(p, SUB, reg_value(y), reg_value(x));
+      add_inst2(p, ADD, reg_value(dst), imm_value(1));
+      add_text_label(p, l1);
+      add_inst2(p, SUB, reg_value(cnt), imm_value(1));
+      add_jcc(p, JNE, loop, cnt, imm_value(0));
+      add_jmp(p, done);
+
+      add_text_label(p, l2);
+      add_inst2(p, ADD, reg_value(y), reg_value(y));
+      l1 = new_arith_label(p);
+      add_jcc(p, JLT, l1, dst, top_bit);
+      add_inst2(p, ADD, reg_value(y), imm_value(1));
+      add_text_label(p, l1);
+      add_inst2(p, ADD, reg_value(dst), reg_value(dst));
+      add_inst2(p, SUB, reg_value(y), reg_value(x));
+      add_inst2(p, ADD, reg_value(dst), imm_value(1));
+      add_inst2(p, SUB, reg_value(cnt), imm_value(1));
+      add_jcc(p, JNE, loop, cnt, imm_value(0));
+      add_text_label(p, done);
+      if (op == MOD)
+        add_inst2(p, MOV, reg_value(dst), reg_value(y));
+      break;
+
+    case AND:
+    case OR:
+    case XOR:
+      // The bits of dst are shifted out and the bits of the result
+      // are shifted in. y counts the set bits at the current position.
+      add_inst2(p, MOV, reg_value(x), src);
+      add_inst2(p, MOV, reg_value(cnt), word_bits);
+      add_text_label(p, loop);
+      add_inst2(p, MOV, reg_value(y), imm_value(0));
+      l1 = new_arith_label(p);
+      add_jcc(p, JLT, l1, dst, top_bit);
+      add_inst2(p, ADD, reg_value(y), imm_value(1));
+      add_text_label(p, l1);
+      l1 = new_arith_label(p);
+      add_jcc(p, JLT, l1, x, top_bit);
+      add_inst2(p, ADD, reg_value(y), imm_value(1));
+      add_text_label(p, l1);
+      add_inst2(p, ADD, reg_value(dst), reg_value(dst));
+      add_inst2(p, ADD, reg_value(x), reg_value(x));
+      l1 = new_arith_label(p);
+      if (op == AND) {
+        add_jcc(p, JNE, l1, y, imm_value(2));
+      } else if (op == OR) {
+        add_jcc(p, JEQ, l1, y, imm_value(0));
+      } else {
+        add_jcc(p, JNE, l1, y, imm_value(1));
+      }
+      add_inst2(p, ADD, reg_value(dst), imm_value(1));
+      add_text_label(p, l1);
+      add_inst2(p, SUB, reg_value(cnt), imm_value(1));
+      add_jcc(p, JNE, loop, cnt, imm_value(0));
+      add_text_label(p, done);
+      break;
+
+    case SHL:
+      add_inst2(p, MOV, reg_value(cnt), src);
+      l1 = new_arith_label(p);
+      add_jcc(p, JLT, l1, cnt, word_bits);
+      add_inst2(p, MOV, reg_value(cnt), word_bits);
+      add_text_label(p, l1);
+      add_text_label(p, loop);
+      add_jcc(p, JEQ, done, cnt, imm_value(0));
+      add_inst2(p, ADD, reg_value(dst), reg_value(dst));
+      add_inst2(p, SUB, reg_value(cnt), imm_value(1));
+      add_jmp(p, loop);
+      add_text_label(p, done);
+      break;
+
+    case SHR:
+      // Shift the top (word size - src) bits of dst into y.
+      add_inst2(p, MOV, reg_value(x), src);
+      add_inst2(p, MOV, reg_value(y), imm_value(0));
+      add_jcc(p, JGE, done, x, word_bits);
+      add_inst2(p, MOV, reg_value(cnt), word_bits);
+      add_inst2(p, SUB, reg_value(cnt), reg_value(x));
+      add_text_label(p, loop);
+      add_jcc(p, JEQ, done, cnt, imm_value(0));
+      add_inst2(p, ADD, reg_value(y), reg_value(y));
+      l1 = new_arith_label(p);
+      add_jcc(p, JLT, l1, dst, top_bit);
+      add_inst2(p, ADD, reg_value(y), imm_value(1));
+      add_text_label(p, l1);
+      add_inst2(p, ADD, reg_value(dst), reg_value(dst));
+      add_inst2(p, SUB, reg_value(cnt), imm_value(1));
+      add_jmp(p, loop);
+      add_text_label(p, done);
+      add_inst2(p, MOV, reg_value(dst), reg_value(y));
+      break;
+
+    default:
+      ir_error(p, "oops");
+  }
+
+  // Restore the borrowed registers, using A as the only load target.
+  add_inst2(p, STORE, reg_value(dst), arith_tmp(p, 4));
+  for (int i = 0; i < ntmps; i++) {
+    if (tmps[i] != A) {
+      add_inst2(p, LOAD, reg_value(A), arith_tmp(p, tmps[i]));
+      add_inst2(p, MOV, reg_value(tmps[i]), reg_value(A));
+    }
+  }
+  add_inst2(p, LOAD, reg_value(A), arith_tmp(p, 4));
+  if (dst != A) {
+    add_inst2(p, MOV, reg_value(dst), reg_value(A));
+    add_inst2(p, LOAD, reg_value(A), arith_tmp(p, A));
+  }
+}
+
+// Expands MEMCPY and MEMSET into a loop. All of A-D are saved first,
+// then B, C, and D are used as the destination, the source (or the
+// value), and the counter. Operands in A-D are read back from the
+// saved copies so the order of the moves does not matter.
+static void lower_mem(Parser* p, Op op, Value* args) {
+  for (Reg r = A; r <= D; r++)
+    add_inst2(p, STORE, reg_value(r), arith_tmp(p, r));
+
+  Reg to[3] = { B, C, D };
+  for (int i = 0; i < 3; i++) {
+    if (args[i].type == REG && args[i].reg <= D) {
+      add_inst2(p, LOAD, reg_value(A), arith_tmp(p, args[i].reg));
+      add_inst2(p, MOV, reg_value(to[i]), reg_value(A));
+    } else {
+      add_inst2(p, MOV, reg_value(to[i]), args[i]);
+    }
+  }
+
+  char* loop = new_arith_label(p);
+  char* done = new_arith_label(p);
+  add_text_label(p, loop);
+  add_jcc(p, JEQ, done, D, imm_value(0));
+  if (op == MEMCPY) {
+    add_inst2(p, LOAD, reg_value(A), reg_value(C));
+    add_inst2(p, STORE, reg_value(A), reg_value(B));
+    add_inst2(p, ADD, reg_value(C), imm_value(1));
+  } else {
+    add_inst2(p, STORE, reg_value(C), reg_value(B));
+  }
+  add_inst2(p, ADD, reg_value(B), imm_value(1));
+  add_inst2(p, SUB, reg_value(D), imm_value(1));
+  add_jmp(p, loop);
+  add_text_label(p, done);
+
+  for (Reg r = B; r <= D; r++) {
+    add_inst2(p, LOAD, reg_value(A), arith_tmp(p, r));
+    add_inst2(p, MOV, reg_value(r), reg_value(A));
+  }
+  add_inst2(p, LOAD, reg_value(A), arith_tmp(p, A));
+}
+
 static void parse_line(Parser* p, int c) {
   char buf[64];
   buf[0] = c;
@@ -320,20 +855,20 @@ static void parse_line(Parser* p, int c) {
   } else if (op == (Op)LOC) {
     skip_until_ret(p);
     return;
+  } else if (op == (Op)LOCAL || op == (Op)WEAK) {
+    declare_sym(p, op);
+    return;
   } else if (op == OP_UNSET) {
     c = ir_getc(p);
     if (c == ':') {
-      intptr_t value = 0;
+      char* name = sym_name(p, buf);
       if (p->in_text) {
-        if (!p->prev_boundary)
-          p->pc++;
-        value = p->pc;
-        p->prev_boundary = true;
-        p->symtab = table_add(p->symtab, strdup(buf), (void*)value);
+        add_text_label(p, define_sym(p, name, NULL));
       } else {
         DataPrivate* d = add_data(p);
         d->val.type = LABEL;
-        d->val.tmp = strdup(buf);
+        d->val.tmp = define_sym(p, name, d);
+        p->data_labels = table_add(p->data_labels, d->val.tmp, d);
       }
       return;
     }
@@ -358,6 +893,10 @@ static void parse_line(Parser* p, int c) {
     argc = 2;
   else if (op == DUMP)
     argc = 0;
+  else if (op >= MUL && op <= SHR)
+    argc = 2;
+  else if (op == MEMCPY || op == MEMSET)
+    argc = 3;
   else if (op == (Op)LONG)
     argc = 1;
   else if (op == (Op)DATA) {
@@ -381,7 +920,7 @@ static void parse_line(Parser* p, int c) {
     c = ir_getc(p);
     if (isdigit(c) || c == '-') {
       a.type = IMM;
-      a.imm = MOD24(read_int(p, c));
+      a.imm = wrap_word(read_int(p, c));
     } else {
       buf[0] = c;
       read_while_ident(p, buf + 1, 62);
@@ -400,7 +939,7 @@ static void parse_line(Parser* p, int c) {
         a.reg = BP;
       } else {
         a.type = (ValueType)REF;
-        a.tmp = strdup(buf);
+        a.tmp = sym_name(p, buf);
       }
     }
     args[i] = a;
@@ -427,88 +966,187 @@ static void parse_line(Parser* p, int c) {
     return;
   }
 
-  p->text->next = calloc(1, sizeof(Inst));
-  p->text = p->text->next;
-  p->text->op = op;
-  p->text->pc = p->pc;
-  p->text->lineno = p->lineno;
-  if (g_current_magic_comment[0]) {
-    p->text->magic_comment = strdup(g_current_magic_comment);
-    g_current_magic_comment[0] = '\0';
-  }
-  p->prev_boundary = false;
-  switch (op) {
-    case LOAD:
-    case STORE:
-      if (g_split_basic_block_by_mem) {
-        p->pc++;
-        p->prev_boundary = true;
-      }
-      FALLTHROUGH;
-    case MOV:
-    case ADD:
-    case SUB:
-    case EQ:
-    case NE:
-    case LT:
-    case GT:
-    case LE:
-    case GE:
-      p->text->src = args[1];
-      FALLTHROUGH;
-    case GETC:
-      p->text->dst = args[0];
-      break;
-    case PUTC:
-      p->text->src = args[0];
-    case EXIT:
-    case DUMP:
-      break;
-    case JEQ:
-    case JNE:
-    case JLT:
-    case JGT:
-    case JLE:
-    case JGE:
-      p->text->dst = args[1];
-      p->text->src = args[2];
-      FALLTHROUGH;
-    case JMP:
-      p->text->jmp = args[0];
-      p->pc++;
-      p->prev_boundary = true;
-      break;
-    default:
-      ir_error(p, "oops");
+  if (op >= MUL && op <= SHR && !g_enable_arith_ops) {
+    lower_arith(p, op, args);
+  } else if (op == MEMCPY || op == MEMSET) {
+    if (args[0].type != REG)
+      ir_error(p, "register expected");
+    if (g_enable_mem_ops)
+      add_inst(p, op, args);
+    else
+      lower_mem(p, op, args);
+  } else {
+    add_inst(p, op, args);
   }
-
 #if 0
   dump_inst(p->text);
 #endif
 }
 
-static void parse_eir(Parser* p) {
-  Inst text_root = {};
-  DataPrivate data_root = {};
-  int c;
+static void rename_value(Parser* p, Value* v) {
+  const void* alias;
+  if (v->type == (ValueType)REF &&
+      table_get(p->module_aliases, (const char*)v->tmp, &alias))
+    v->tmp = (void*)alias;
+}
 
-  p->in_text = 1;
-  p->lineno = 1;
-  p->text = &text_root;
-  p->data = &data_root;
-  p->pc = 0;
-  p->prev_boundary = true;
+// Makes references in the module which starts after |text| and
+// |data| use its private labels.
+static void rename_module_syms(Parser* p, Inst* text, DataPrivate* data) {
+  for (Inst* inst = text->next; inst; inst = inst->next) {
+    rename_value(p, &inst->dst);
+    rename_value(p, &inst->src);
+    rename_value(p, &inst->jmp);
+  }
+  for (DataPrivate* d = data->next; d; d = d->next)
+    rename_value(p, &d->val);
+}
 
-  p->text->next = calloc(1, sizeof(Inst));
-  p->text = p->text->next;
-  p->text->op = JMP;
-  p->text->pc = p->pc++;
-  p->text->lineno = -1;
-  p->text->jmp.type = (ValueType)REF;
-  p->text->jmp.tmp = "main";
-  p->text->next = 0;
-  p->symtab = table_add(p->symtab, "main", (void*)1);
+// Returns the value after |d| which belongs to the data labeled
+// |label|, i.e., in the same module and subsection before the next
+// label.
+static DataPrivate* next_member(DataPrivate* label, DataPrivate* d) {
+  for (d = d->next; d && d->module == label->module; d = d->next) {
+    if (d->v != label->v)
+      continue;
+    if (d->val.type == (ValueType)LABEL)
+      return NULL;
+    return d;
+  }
+  return NULL;
+}
+
+static bool same_data(Parser* p, DataPrivate* a, DataPrivate* b,
+                      bool deep);
 
+static bool is_local_sym(const char* name) {
+  return name[0] == '.';
+}
+
+// Compares references. Global labels must be the same. Local labels
+// are numbered per module, so two local text labels match if they are
+// at the same offset from |a_base| and |b_base|, and two local data
+// labels match if their data do.
+static bool same_ref(Parser* p, const char* a, const char* b,
+                     int a_base, int b_base, bool deep) {
+  if (!strcmp(a, b))
+    return true;
+  if (!is_local_sym(a) || !is_local_sym(b))
+    return false;
+  const void* la;
+  const void* lb;
+  if (table_get(p->text_labels, a, &la) &&
+      table_get(p->text_labels, b, &lb)) {
+    return a_base >= 0 &&
+        ((TextLabel*)la)->pc - a_base == ((TextLabel*)lb)->pc - b_base;
+  }
+  if (deep && table_get(p->data_labels, a, &la) &&
+      table_get(p->data_labels, b, &lb)) {
+    return same_data(p, (DataPrivate*)la, (DataPrivate*)lb, false);
+  }
+  return false;
+}
+
+static bool same_value(Parser* p, Value* a, Value* b,
+                       int a_base, int b_base, bool deep) {
+  if (a->type != b->type)
+    return false;
+  if (a->type == (ValueType)REF)
+    return same_ref(p, (const char*)a->tmp, (const char*)b->tmp,
+                    a_base, b_base, deep);
+  if (a->type == REG)
+    return a->reg == b->reg;
+  return a->imm == b->imm;
+}
+
+static bool same_data(Parser* p, DataPrivate* a, DataPrivate* b,
+                      bool deep) {
+  DataPrivate* x = next_member(a, a);
+  DataPrivate* y = next_member(b, b);
+  while (x && y && same_value(p, &x->val, &y->val, -1, -1, deep)) {
+    x = next_member(a, x);
+    y = next_member(b, y);
+  }
+  return !x && !y;
+}
+
+// Returns the first instruction of the function at |label| and sets
+// |end| to the pc after it. A function ends at the next label which is
+// not local, or at the end of its module.
+static Inst* func_extent(Inst* text, TextLabel* label,
+                         int* module_ends, int* end) {
+  int i = 0;
+  while (label->pc > module_ends[i])
+    i++;
+  *end = module_ends[i] + 1;
+  for (TextLabel* l = label->next; l; l = l->next) {
+    if (l->pc > label->pc && !is_local_sym(l->name)) {
+      if (l->pc < *end)
+        *end = l->pc;
+      break;
+    }
+  }
+  Inst* inst = text;
+  while (inst && inst->pc < label->pc)
+    inst = inst->next;
+  return inst;
+}
+
+static bool same_func(Parser* p, Inst* text, int* module_ends,
+                      TextLabel* a, TextLabel* b) {
+  int a_end, b_end;
+  Inst* x = func_extent(text, a, module_ends, &a_end);
+  Inst* y = func_extent(text, b, module_ends, &b_end);
+  for (; x && x->pc < a_end && y && y->pc < b_end;
+       x = x->next, y = y->next) {
+    if (x->op != y->op || x->pc - a->pc != y->pc - b->pc ||
+        !same_value(p, &x->dst, &y->dst, a->pc, b->pc, true) ||
+        !same_value(p, &x->src, &y->src, a->pc, b->pc, true) ||
+        !same_value(p, &x->jmp, &y->jmp, a->pc, b->pc, true))
+      return false;
+  }
+  return !(x && x->pc < a_end) && !(y && y->pc < b_end);
+}
+
+// Reports repeated definitions which differ from the first one.
+static void check_link_dups(Parser* p, Inst* text, int* module_ends) {
+  for (LinkDup* dup = p->dups; dup; dup = dup->next) {
+    const void* a;
+    const void* b;
+    bool same;
+    if (dup->is_data) {
+      table_get(p->data_labels, dup->name, &a);
+      table_get(p->data_labels, dup->alias, &b);
+      same = same_data(p, (DataPrivate*)a, (DataPrivate*)b, true);
+    } else {
+      table_get(p->text_labels, dup->name, &a);
+      table_get(p->text_labels, dup->alias, &b);
+      same = same_func(p, text, module_ends, (TextLabel*)a, (TextLabel*)b);
+    }
+    if (!same) {
+      p->filename = dup->filename;
+      p->lineno = dup->lineno;
+      p->col = 0;
+      sym_error(p, "duplicate definition", dup->name);
+    }
+  }
+}
+
+// Drops the data of labels whose definition in an earlier module is
+// used instead.
+static void drop_dups(DataPrivate* data_root) {
+  for (DataPrivate* d = data_root->next; d; d = d->next) {
+    if (d->val.type != (ValueType)LABEL || !d->is_dup)
+      continue;
+    // serialize_data skips subsection -1.
+    for (DataPrivate* x = next_member(d, d); x; x = next_member(d, x))
+      x->v = -1;
+    d->v = -1;
+  }
+}
+
+static void parse_module(Parser* p) {
+  int c;
   for (;;) {
     skip_ws(p);
     c = ir_getc(p);
@@ -529,7 +1167,52 @@ static void parse_eir(Parser* p) {
       ir_error(p, "unexpected char");
     }
   }
+}
+
+// Parses and links modules. Global labels are shared by all modules
+// and pcs and data addresses continue from the previous module.
+static void parse_eir(Parser* p, int num_modules,
+                      const char** filenames, FILE** fps) {
+  Inst text_root = {};
+  DataPrivate data_root = {};
+
+  p->text = &text_root;
+  p->data = &data_root;
+  p->pc = 0;
+  p->prev_boundary = true;
+
+  p->text->next = calloc(1, sizeof(Inst));
+  p->text = p->text->next;
+  p->text->op = JMP;
+  p->text->pc = p->pc++;
+  p->text->lineno = -1;
+  p->text->jmp.type = (ValueType)REF;
+  p->text->jmp.tmp = "main";
+  p->text->next = 0;
+  p->symtab = table_add(p->symtab, "main", (void*)1);
+
+  int* module_ends = calloc(num_modules, sizeof(int));
+  for (int i = 0; i < num_modules; i++) {
+    Inst* text = p->text;
+    DataPrivate* data = p->data;
+    p->filename = filenames[i];
+    p->fp = fps[i];
+    p->module = i;
+    p->module_syms = NULL;
+    p->module_aliases = NULL;
+    p->module_weaks = NULL;
+    p->in_text = 1;
+    p->lineno = 1;
+    p->col = 0;
+    p->subsection = 0;
+    parse_module(p);
+    if (p->module_aliases)
+      rename_module_syms(p, text, data);
+    module_ends[i] = p->pc;
+  }
 
+  check_link_dups(p, text_root.next, module_ends);
+  drop_dups(&data_root);
   serialize_data(p, &data_root);
   p->text = text_root.next;
   p->data = data_root.next;
@@ -547,47 +1230,165 @@ static void resolve(Value* v, Table* symtab) {
   v->type = IMM;
 }
 
+// Resolves a reference which is used as a value. A text label used
+// this way may become the target of a register jump.
+static void resolve_value(Value* v, Parser* p) {
+  if (v->type != (ValueType)REF)
+    return;
+  const void* label;
+  if (table_get(p->text_labels, (const char*)v->tmp, &label))
+    ((TextLabel*)label)->addr_taken = true;
+  resolve(v, p->symtab);
+}
+
 static void resolve_syms(Parser* p) {
   for (DataPrivate* data = p->data; data; data = data->next) {
     if (data->val.type == (ValueType)REF) {
-      resolve(&data->val, p->symtab);
+      resolve_value(&data->val, p);
     }
-    data->v = MOD24(data->val.imm);
+    data->v = wrap_word(data->val.imm);
   }
 
   for (Inst* inst = p->text; inst; inst = inst->next) {
-    resolve(&inst->dst, p->symtab);
-    resolve(&inst->src, p->symtab);
-    resolve(&inst->jmp, p->symtab);
+    resolve_value(&inst->dst, p);
+    resolve_value(&inst->src, p);
+    if (inst->op >= JEQ && inst->op <= JMP)
+      resolve(&inst->jmp, p->symtab);
+    else
+      resolve_value(&inst->jmp, p);
   }
 }
 
-Module* load_eir_impl(const char* filename, FILE* fp) {
-  Parser parser = {
-    .filename = filename,
-    .fp = fp
-  };
-  parse_eir(&parser);
+static const char* BUILTIN_ARITH_NAMES[] = {
+  "__builtin_mul", "__builtin_div", "__builtin_mod", "__builtin_and",
+  "__builtin_or", "__builtin_xor", "__builtin_not", "__builtin_shl",
+  "__builtin_shr", NULL
+};
+
+static const Op BUILTIN_ARITH_OPS[] = {
+  MUL, DIV, MOD, AND, OR, XOR, XOR, SHL, SHR
+};
+
+// Replaces the entry block of the function |name| by the code
+// emit_stub adds. The rest of its body becomes dead. Functions are
+// called with the return address at SP and the arguments from SP+1,
+// and return the result in A.
+static void replace_func(Parser* p, const char* name, int id,
+                         void (*emit_stub)(Parser*, int)) {
+  const void* v;
+  if (!table_get(p->symtab, name, &v))
+    return;
+  int pc = (intptr_t)v;
+
+  Inst* text = p->text;
+  Inst* prev = NULL;
+  for (Inst* inst = text; inst; prev = inst, inst = inst->next) {
+    if (inst->pc == pc)
+      break;
+  }
+  if (!prev || !prev->next)
+    return;
+  Inst* next = prev->next;
+  while (next && next->pc == pc)
+    next = next->next;
+
+  Inst stub_root = {};
+  p->text = &stub_root;
+  p->pc = pc;
+  emit_stub(p, id);
+  add_inst2(p, LOAD, reg_value(B), reg_value(SP));
+  add_inst2(p, JMP, reg_value(B), imm_value(0));
+  for (Inst* inst = stub_root.next; inst; inst = inst->next) {
+    inst->pc = pc;
+    inst->lineno = -1;
+  }
+  prev->next = stub_root.next;
+  p->text->next = next;
+  p->text = text;
+}
+
+static void emit_builtin_arith_stub(Parser* p, int i) {
+  add_inst2(p, MOV, reg_value(B), reg_value(SP));
+  add_inst2(p, ADD, reg_value(B), imm_value(1));
+  add_inst2(p, LOAD, reg_value(A), reg_value(B));
+  if (!strcmp(BUILTIN_ARITH_NAMES[i], "__builtin_not")) {
+    add_inst2(p, XOR, reg_value(A), imm_value(g_word_mask));
+  } else {
+    add_inst2(p, ADD, reg_value(B), imm_value(1));
+    add_inst2(p, LOAD, reg_value(B), reg_value(B));
+    add_inst2(p, BUILTIN_ARITH_OPS[i], reg_value(A), reg_value(B));
+  }
+}
+
+// Replaces the software arithmetic in libc/_builtin.h by native
+// operations.
+static void replace_builtin_arith(Parser* p) {
+  for (int i = 0; BUILTIN_ARITH_NAMES[i]; i++)
+    replace_func(p, BUILTIN_ARITH_NAMES[i], i, emit_builtin_arith_stub);
+}
+
+// memcpy(d, s, n) and memset(d, c, n) both return d.
+static void emit_mem_stub(Parser* p, int op) {
+  add_inst2(p, MOV, reg_value(D), reg_value(SP));
+  add_inst2(p, ADD, reg_value(D), imm_value(1));
+  add_inst2(p, LOAD, reg_value(A), reg_value(D));
+  add_inst2(p, ADD, reg_value(D), imm_value(1));
+  add_inst2(p, LOAD, reg_value(B), reg_value(D));
+  add_inst2(p, ADD, reg_value(D), imm_value(1));
+  add_inst2(p, LOAD, reg_value(C), reg_value(D));
+  add_inst3(p, (Op)op, reg_value(A), reg_value(B), reg_value(C));
+}
+
+// Replaces memcpy and memset in libc/string.h by block operations.
+static void replace_libc_mem(Parser* p) {
+  replace_func(p, "memcpy", MEMCPY, emit_mem_stub);
+  replace_func(p, "memset", MEMSET, emit_mem_stub);
+}
+
+static Module* load_eir_impl(int num_modules, const char** filenames,
+                             FILE** fps) {
+  Parser parser = {};
+  parse_eir(&parser, num_modules, filenames, fps);
+  if (g_enable_arith_ops)
+    replace_builtin_arith(&parser);
+  if (g_enable_mem_ops)
+    replace_libc_mem(&parser);
   resolve_syms(&parser);
 
   Module* m = malloc(sizeof(Module));
   m->text = parser.text;
   m->data = (Data*)parser.data;
+  m->labels = parser.labels;
+  m->num_vregs = 0;
+  m->word_bits = g_word_bits;
+  if (g_enable_vregs)
+    m->num_vregs = promote_stack_slots(m);
+  if (g_enable_range_analysis)
+    analyze_ranges(m);
   return m;
 }
 
 Module* load_eir(FILE* fp) {
-  return load_eir_impl("<stdin>", fp);
+  const char* filename = "<stdin>";
+  return load_eir_impl(1, &filename, &fp);
 }
 
 Module* load_eir_from_file(const char* filename) {
-  FILE* fp = fopen(filename, "r");
-  if (!fp) {
-    fprintf(stderr, "no such file: %s\n", filename);
-    exit(1);
+  return load_eir_from_files(1, &filename);
+}
+
+Module* load_eir_from_files(int num_files, const char** filenames) {
+  FILE** fps = calloc(num_files, sizeof(FILE*));
+  for (int i = 0; i < num_files; i++) {
+    fps[i] = fopen(filenames[i], "r");
+    if (!fps[i]) {
+      fprintf(stderr, "no such file: %s\n", filenames[i]);
+      exit(1);
+    }
   }
-  Module* r = load_eir_impl(filename, fp);
-  fclose(fp);
+  Module* r = load_eir_impl(num_files, filenames, fps);
+  for (int i = 0; i < num_files; i++)
+    fclose(fps[i]);
   return r;
 }
 
@@ -595,11 +1396,38 @@ void split_basic_block_by_mem() {
   g_split_basic_block_by_mem = true;
 }
 
+void enable_arith_ops() {
+  g_enable_arith_ops = true;
+}
+
+void enable_mem_ops() {
+  g_enable_mem_ops = true;
+}
+
+void enable_vregs() {
+  g_enable_vregs = true;
+}
+
+void enable_range_analysis() {
+  g_enable_range_analysis = true;
+}
+
+void set_word_bits(int bits) {
+  if (bits != 24 && bits != 32) {
+    fprintf(stderr, "unsupported word size: %d\n", bits);
+    exit(1);
+  }
+  g_word_bits = bits;
+  g_word_mask = bits == 32 ? ~0U : (1U << bits) - 1;
+}
+
 void dump_op(Op op, FILE* fp) {
   static const char* op_strs[] = {
     "mov", "add", "sub", "load", "store", "putc", "getc", "exit",
     "jeq", "jne", "jlt", "jgt", "jle", "jge", "jmp", "xxx",
-    "eq", "ne", "lt", "gt", "le", "ge", "dump"
+    "eq", "ne", "lt", "gt", "le", "ge", "dump", "xxx",
+    "mul", "div", "mod", "and", "or", "xor", "shl", "shr",
+    "memcpy", "memset"
   };
   fprintf(fp, "%s", op_strs[op]);
 }
@@ -608,7 +1436,9 @@ void dump_val(Value* val, FILE* fp) {
   static const char* reg_strs[] = {
     "A", "B", "C", "D", "BP", "SP"
   };
-  if (val->type == REG) {
+  if (val->type == REG && val->reg >= VREG0) {
+    fprintf(fp, "V%d", val->reg - VREG0);
+  } else if (val->type == REG) {
     fprintf(fp, "%s", reg_strs[val->reg]);
   } else if (val->type == IMM) {
     fprintf(fp, "%d", val->imm);
@@ -631,6 +1461,14 @@ void dump_inst_fp(Inst* inst, FILE* fp) {
     case GT:
     case LE:
     case GE:
+    case MUL:
+    case DIV:
+    case MOD:
+    case AND:
+    case OR:
+    case XOR:
+    case SHL:
+    case SHR:
       fprintf(fp, " ");
       dump_val(&inst->dst, fp);
       fprintf(fp, " ");
@@ -664,6 +1502,15 @@ void dump_inst_fp(Inst* inst, FILE* fp) {
       fprintf(fp, " ");
       dump_val(&inst->jmp, fp);
       break;
+    case MEMCPY:
+    case MEMSET:
+      fprintf(fp, " ");
+      dump_val(&inst->dst, fp);
+      fprintf(fp, " ");
+      dump_val(&inst->src, fp);
+      fprintf(fp, " ");
+      dump_val(&inst->jmp, fp);
+      break;
     default:
       fprintf(fp, "oops op=%d\n", inst->op);
       exit(1);
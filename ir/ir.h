@@ -1,6 +1,7 @@
 #ifndef ELVM_IR_H_
 #define ELVM_IR_H_
 
+#include <stdbool.h>
 #include <stdio.h>
 
 #define UINT_MAX 16777215
@@ -12,7 +13,10 @@
 #endif
 
 typedef enum {
-  A, B, C, D, BP, SP
+  A, B, C, D, BP, SP,
+  // Virtual registers follow. Index 6 is left for "pc" in the
+  // reg_names of target/util.c. See enable_vregs().
+  VREG0 = 7
 } Reg;
 
 typedef enum {
@@ -25,6 +29,12 @@ typedef enum {
   JEQ = 8, JNE, JLT, JGT, JLE, JGE, JMP,
   // Optional operations follow.
   EQ = 16, NE, LT, GT, LE, GE, DUMP,
+  // Arithmetic operations. They are lowered to the above operations
+  // unless the target calls enable_arith_ops().
+  MUL = 24, DIV, MOD, AND, OR, XOR, SHL, SHR,
+  // Block memory operations. They are lowered to loops unless the
+  // target calls enable_mem_ops(). Inst.jmp holds the word count.
+  MEMCPY = 32, MEMSET,
   LAST_OP
 } Op;
 
@@ -45,6 +55,9 @@ typedef struct Inst_ {
   int pc;
   int lineno;
   char* magic_comment;
+  // Set on ADD and SUB whose results never wrap around. See
+  // enable_range_analysis().
+  bool no_wrap;
   struct Inst_* next;
 } Inst;
 
@@ -53,17 +66,56 @@ typedef struct Data_ {
   struct Data_* next;
 } Data;
 
+typedef struct TextLabel_ {
+  const char* name;
+  int pc;
+  // True if the label is used as a value rather than a jump target,
+  // e.g., "mov A, label" or ".long label".
+  bool addr_taken;
+  struct TextLabel_* next;
+} TextLabel;
+
 typedef struct {
   Inst* text;
   Data* data;
+  // Labels in .text in the order of their pcs.
+  TextLabel* labels;
+  // The number of virtual registers, from VREG0.
+  int num_vregs;
+  // 24 unless set_word_bits() was called. UINT_MAX and MOD24 are for
+  // 24-bit words only.
+  int word_bits;
 } Module;
 
 Module* load_eir(FILE* fp);
 
 Module* load_eir_from_file(const char* filename);
 
+// Links several modules into one. Labels starting with '.' are local
+// to their module and the others are shared. When modules define the
+// same global label, references from another module see the first
+// definition, and identical copies of data are merged.
+Module* load_eir_from_files(int num_files, const char** filenames);
+
 void split_basic_block_by_mem();
 
+void enable_arith_ops();
+
+void enable_mem_ops();
+
+// Promotes stack slots of functions to virtual registers (see
+// ir/promote.c). They appear only as operands of MOV.
+void enable_vregs();
+
+// Marks ADDs and SUBs which provably fit in a word with
+// Inst.no_wrap (see ir/range.c), so backends can skip masking them.
+void enable_range_analysis();
+
+// Sets the number of bits in a word, 24 or 32. Immediates and data are
+// wrapped to it and the expansions of arithmetic ops work on it. With
+// 32-bit words, immediates of 2^31 or more are negative in Value.imm.
+void set_word_bits(int bits);
+
 void dump_inst(Inst* inst);
 void dump_inst_fp(Inst* inst, FILE* fp);
 
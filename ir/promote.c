@@ -0,0 +1,534 @@
+#include <ir/func.h>
+
+#include <stdlib.h>
+
+// Promotion of stack slots to virtual registers.
+//
+// 8cc accesses a local or an argument by computing its BP-relative
+// address right before the access, e.g., "mov B, BP; add B, -3;
+// load A, B". Such a LOAD or STORE becomes a MOV from or to a virtual
+// register when its function
+//
+// - sets up its frame by "mov BP, SP" in the entry block,
+// - cannot be called again while it is running, and
+// - uses the addresses in its frame only as the address operands of
+//   LOADs and STOREs in the same basic block.
+//
+// Virtual registers are not shared between functions, so calls need
+// not save them. Arguments (BP+2 and above) are copied to their
+// virtual registers right after "mov BP, SP". The saved BP and the
+// return address at BP and BP+1 stay in memory.
+
+#define PS_ALL_REGS 15
+
+static bool ps_is_jump(Op op) {
+  return op >= JEQ && op <= JMP;
+}
+
+// Collects the operands |inst| reads.
+static int ps_read_operands(Inst* inst, Value** vals) {
+  switch (inst->op) {
+  case MOV:
+  case LOAD:
+  case PUTC:
+    vals[0] = &inst->src;
+    return 1;
+  case JMP:
+    vals[0] = &inst->jmp;
+    return 1;
+  case GETC:
+  case EXIT:
+  case DUMP:
+    return 0;
+  case JEQ:
+  case JNE:
+  case JLT:
+  case JGT:
+  case JLE:
+  case JGE:
+  case MEMCPY:
+  case MEMSET:
+    vals[0] = &inst->dst;
+    vals[1] = &inst->src;
+    vals[2] = &inst->jmp;
+    return 3;
+  default:
+    // Binary operations and STORE.
+    vals[0] = &inst->dst;
+    vals[1] = &inst->src;
+    return 2;
+  }
+}
+
+static bool ps_writes_dst(Op op) {
+  switch (op) {
+  case MOV:
+  case ADD:
+  case SUB:
+  case LOAD:
+  case GETC:
+    return true;
+  default:
+    return (op >= EQ && op <= GE) || (op >= MUL && op <= SHR);
+  }
+}
+
+static int ps_reg_bit(Value* v) {
+  return v->type == REG && v->reg <= D ? 1 << v->reg : 0;
+}
+
+static bool ps_is_reg(Value* v, Reg r) {
+  return v->type == REG && v->reg == r;
+}
+
+// Keeps offsets in [-2^23, 2^23) so that locals are negative.
+static int ps_offset(int off) {
+  off &= UINT_MAX;
+  return off & 0x800000 ? off - UINT_MAX - 1 : off;
+}
+
+typedef struct {
+  CallGraph* cg;
+  Func* func;
+  // Per pc in the function.
+  Inst** first;
+  Inst** last;
+  int* live_in;
+  int* live_out;
+  // Per pc in the module.
+  bool* is_call;
+  bool* taken;
+  // The "mov BP, SP" in the entry block.
+  Inst* frame_setup;
+  // LOADs and STOREs of frame slots.
+  Inst** accesses;
+  int* access_offs;
+  int num_accesses;
+} PromoteState;
+
+// The registers live at the end of the |i|-th pc of the function.
+static int ps_live_out(PromoteState* ps, int i) {
+  Func* func = ps->func;
+  int pc = func->entry + i;
+  Inst* last = ps->last[i];
+  int live = 0;
+  bool falls = true;
+  if (last && last->op == EXIT)
+    return 0;
+  if (last && ps_is_jump(last->op)) {
+    // Callees take their arguments from the stack.
+    if (ps->is_call[pc])
+      return 0;
+    Value* jmp = &last->jmp;
+    if (jmp->type == IMM) {
+      if (jmp->imm >= func->entry && jmp->imm < func->end)
+        live |= ps->live_in[jmp->imm - func->entry];
+      else
+        live = PS_ALL_REGS;
+    } else {
+      // A return passes its value in A to the return site.
+      live |= 1 << A;
+      for (int j = 0; j < func->end - func->entry; j++) {
+        if (ps->taken[func->entry + j])
+          live |= ps->live_in[j];
+      }
+    }
+    falls = last->op != JMP;
+  }
+  if (falls) {
+    if (pc + 1 < func->end)
+      live |= ps->live_in[i + 1];
+    else
+      live = PS_ALL_REGS;
+  }
+  return live;
+}
+
+static void ps_compute_liveness(PromoteState* ps) {
+  int n = ps->func->end - ps->func->entry;
+  int* uses = calloc(n, sizeof(int));
+  int* defs = calloc(n, sizeof(int));
+  for (int i = 0; i < n; i++) {
+    Inst* inst = ps->first[i];
+    for (; inst && inst->pc == ps->func->entry + i; inst = inst->next) {
+      Value* vals[3];
+      int num_vals = ps_read_operands(inst, vals);
+      for (int j = 0; j < num_vals; j++)
+        uses[i] |= ps_reg_bit(vals[j]) & ~defs[i];
+      if (ps_writes_dst(inst->op))
+        defs[i] |= ps_reg_bit(&inst->dst);
+    }
+  }
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int i = n - 1; i >= 0; i--) {
+      int out = ps_live_out(ps, i);
+      int in = uses[i] | (out & ~defs[i]);
+      if (out != ps->live_out[i] || in != ps->live_in[i])
+        changed = true;
+      ps->live_out[i] = out;
+      ps->live_in[i] = in;
+    }
+  }
+}
+
+typedef struct {
+  // Registers in A-D which hold BP+off[r].
+  int known;
+  int off[4];
+  // False until "mov BP, SP" in the entry block, and after BP is
+  // restored for the caller.
+  bool bp_ours;
+} FrameAddrs;
+
+static bool ps_frame_addr(FrameAddrs* fa, Value* v, int* off) {
+  if (v->type != REG)
+    return false;
+  if (v->reg == BP && fa->bp_ours) {
+    *off = 0;
+    return true;
+  }
+  if (v->reg <= D && (fa->known >> v->reg & 1)) {
+    *off = fa->off[v->reg];
+    return true;
+  }
+  return false;
+}
+
+static void ps_add_access(PromoteState* ps, Inst* inst, int off) {
+  ps->accesses[ps->num_accesses] = inst;
+  ps->access_offs[ps->num_accesses] = off;
+  ps->num_accesses++;
+}
+
+// Returns false if an address in the frame may escape from |inst|.
+static bool ps_scan_inst(PromoteState* ps, FrameAddrs* fa, Inst* inst,
+                         bool is_entry) {
+  Value* dst = &inst->dst;
+  Value* src = &inst->src;
+  int off;
+  switch (inst->op) {
+  case MOV:
+    if (ps_frame_addr(fa, src, &off)) {
+      if (dst->type == REG && dst->reg <= D) {
+        fa->known |= 1 << dst->reg;
+        fa->off[dst->reg] = off;
+        return true;
+      }
+      // "mov SP, BP" pops the frame.
+      return ps_is_reg(dst, SP) && ps_is_reg(src, BP);
+    }
+    if (ps_is_reg(dst, BP) && ps_is_reg(src, SP) && is_entry &&
+        !ps->frame_setup) {
+      ps->frame_setup = inst;
+      fa->bp_ours = true;
+      return true;
+    }
+    break;
+
+  case ADD:
+  case SUB:
+    if (ps_frame_addr(fa, src, &off))
+      return false;
+    if (dst->type == REG && dst->reg <= D &&
+        ps_frame_addr(fa, dst, &off)) {
+      if (src->type != IMM)
+        return false;
+      off = ps_offset(inst->op == ADD ? off + src->imm : off - src->imm);
+      fa->off[dst->reg] = off;
+      return true;
+    }
+    break;
+
+  case LOAD:
+    if (ps_frame_addr(fa, src, &off))
+      ps_add_access(ps, inst, off);
+    break;
+
+  case STORE:
+    if (ps_frame_addr(fa, dst, &off))
+      return false;
+    if (ps_frame_addr(fa, src, &off))
+      ps_add_access(ps, inst, off);
+    return true;
+
+  default: {
+    Value* vals[3];
+    int num_vals = ps_read_operands(inst, vals);
+    for (int i = 0; i < num_vals; i++) {
+      if (ps_frame_addr(fa, vals[i], &off))
+        return false;
+    }
+  }
+  }
+
+  if (ps_writes_dst(inst->op) && dst->type == REG) {
+    if (dst->reg <= D)
+      fa->known &= ~(1 << dst->reg);
+    else if (dst->reg == BP) {
+      // The caller's BP comes back by "load BP, SP" or, on backends
+      // which load only into A, "load A, SP; mov BP, A". The MOV case
+      // above has already rejected frame addresses as its source.
+      if (fa->bp_ours && !ps_is_reg(src, BP) && inst->op != LOAD &&
+          inst->op != MOV)
+        return false;
+      fa->bp_ours = false;
+    }
+  }
+  return true;
+}
+
+static bool ps_scan_func(PromoteState* ps) {
+  Func* func = ps->func;
+  for (int i = 0; i < func->end - func->entry; i++) {
+    FrameAddrs fa = {};
+    fa.bp_ours = i > 0;
+    Inst* inst = ps->first[i];
+    for (; inst && inst->pc == func->entry + i; inst = inst->next) {
+      if (!ps_scan_inst(ps, &fa, inst, i == 0))
+        return false;
+    }
+    if (i == 0 && !ps->frame_setup)
+      return false;
+    // Only returns may leave BP restored for the caller.
+    Inst* last = ps->last[i];
+    if (!fa.bp_ours &&
+        !(last && last->op == JMP && last->jmp.type == REG))
+      return false;
+    if (fa.known & ps->live_out[i])
+      return false;
+  }
+  return true;
+}
+
+static void ps_find_reentrant(CallGraph* cg, Module* module, bool* taken,
+                              bool* reentrant) {
+  int nf = cg->num_funcs;
+  // Functions whose pcs are used as values may be called by any
+  // indirect call.
+  bool* indirect = calloc(nf, sizeof(bool));
+  for (int pc = 0; pc < cg->num_pcs; pc++) {
+    if (taken[pc])
+      indirect[cg->pc2func[pc]] = true;
+  }
+
+  // Jumps to other functions which are not recognized as calls are
+  // also edges of the call graph.
+  int* num_jumps = calloc(nf, sizeof(int));
+  for (Inst* inst = module->text; inst; inst = inst->next) {
+    if (ps_is_jump(inst->op) && inst->jmp.type == IMM &&
+        inst->jmp.imm < cg->num_pcs &&
+        cg->pc2func[inst->jmp.imm] != cg->pc2func[inst->pc])
+      num_jumps[cg->pc2func[inst->pc]]++;
+  }
+  int** jumps = calloc(nf, sizeof(int*));
+  for (int i = 0; i < nf; i++) {
+    if (num_jumps[i])
+      jumps[i] = calloc(num_jumps[i], sizeof(int));
+    num_jumps[i] = 0;
+  }
+  for (Inst* inst = module->text; inst; inst = inst->next) {
+    if (ps_is_jump(inst->op) && inst->jmp.type == IMM &&
+        inst->jmp.imm < cg->num_pcs &&
+        cg->pc2func[inst->jmp.imm] != cg->pc2func[inst->pc]) {
+      int f = cg->pc2func[inst->pc];
+      jumps[f][num_jumps[f]++] = cg->pc2func[inst->jmp.imm];
+    }
+  }
+
+  int* seen = calloc(nf, sizeof(int));
+  int* queue = calloc(nf, sizeof(int));
+  for (int start = 0; start < nf; start++) {
+    int head = 0;
+    int tail = 0;
+    queue[tail++] = start;
+    while (head < tail && !reentrant[start]) {
+      Func* func = &cg->funcs[queue[head]];
+      int f = queue[head++];
+      int num_edges = func->num_callees + num_jumps[f];
+      if (func->has_indirect_call)
+        num_edges += nf;
+      for (int j = 0; j < num_edges; j++) {
+        int g;
+        if (j < func->num_callees) {
+          g = func->callees[j];
+        } else if (j < func->num_callees + num_jumps[f]) {
+          g = jumps[f][j - func->num_callees];
+        } else {
+          g = j - func->num_callees - num_jumps[f];
+          if (!func->has_indirect_call || !indirect[g])
+            continue;
+        }
+        if (g == start)
+          reentrant[start] = true;
+        if (seen[g] != start + 1) {
+          seen[g] = start + 1;
+          queue[tail++] = g;
+        }
+      }
+    }
+  }
+}
+
+static Inst* ps_new_inst(Op op, Value dst, Value src, int pc) {
+  Inst* inst = calloc(1, sizeof(Inst));
+  inst->op = op;
+  inst->dst = dst;
+  inst->src = src;
+  inst->pc = pc;
+  inst->lineno = -1;
+  return inst;
+}
+
+static Value ps_reg(int r) {
+  Value v = {};
+  v.type = REG;
+  v.reg = (Reg)r;
+  return v;
+}
+
+static Value ps_imm(int i) {
+  Value v = {};
+  v.type = IMM;
+  v.imm = i;
+  return v;
+}
+
+// A register which is dead right after "mov BP, SP", or -1.
+static int ps_find_temp(PromoteState* ps) {
+  int live = ps->live_out[0];
+  Inst* inst = ps->last[0];
+  while (inst != ps->frame_setup) {
+    Value* vals[3];
+    int num_vals = ps_read_operands(inst, vals);
+    if (ps_writes_dst(inst->op))
+      live &= ~ps_reg_bit(&inst->dst);
+    for (int j = 0; j < num_vals; j++)
+      live |= ps_reg_bit(vals[j]);
+    // Instructions are singly linked, so find the previous one.
+    Inst* prev = ps->first[0];
+    while (prev->next != inst)
+      prev = prev->next;
+    inst = prev;
+  }
+  for (int r = A; r <= D; r++) {
+    if (!(live >> r & 1))
+      return r;
+  }
+  return -1;
+}
+
+// Rewrites the accesses to the frame and returns the number of
+// virtual registers used.
+static int ps_promote(PromoteState* ps, int vreg) {
+  int n = ps->num_accesses;
+  int* offs = calloc(n + 1, sizeof(int));
+  int* counts = calloc(n + 1, sizeof(int));
+  int* vregs = calloc(n + 1, sizeof(int));
+  int num_offs = 0;
+  for (int i = 0; i < n; i++) {
+    int j = 0;
+    while (j < num_offs && offs[j] != ps->access_offs[i])
+      j++;
+    if (j == num_offs)
+      offs[num_offs++] = ps->access_offs[i];
+    counts[j]++;
+  }
+
+  int temp = ps_find_temp(ps);
+  int num_vregs = 0;
+  Inst* setup = ps->frame_setup;
+  for (int j = 0; j < num_offs; j++) {
+    int off = offs[j];
+    vregs[j] = -1;
+    // An argument costs a copy at the entry.
+    if (off == 0 || off == 1 || (off > 1 && (temp < 0 || counts[j] < 2)))
+      continue;
+    vregs[j] = VREG0 + vreg + num_vregs++;
+    if (off < 0)
+      continue;
+
+    int pc = setup->pc;
+    Inst* copy[4];
+    copy[0] = ps_new_inst(MOV, ps_reg(temp), ps_reg(BP), pc);
+    copy[1] = ps_new_inst(ADD, ps_reg(temp), ps_imm(off), pc);
+    copy[2] = ps_new_inst(LOAD, ps_reg(temp), ps_reg(temp), pc);
+    copy[3] = ps_new_inst(MOV, ps_reg(vregs[j]), ps_reg(temp), pc);
+    copy[3]->next = setup->next;
+    for (int k = 0; k < 3; k++)
+      copy[k]->next = copy[k + 1];
+    setup->next = copy[0];
+  }
+
+  for (int i = 0; i < n; i++) {
+    int j = 0;
+    while (offs[j] != ps->access_offs[i])
+      j++;
+    if (vregs[j] < 0)
+      continue;
+    Inst* inst = ps->accesses[i];
+    if (inst->op == LOAD) {
+      inst->src = ps_reg(vregs[j]);
+    } else {
+      inst->src = inst->dst;
+      inst->dst = ps_reg(vregs[j]);
+    }
+    inst->op = MOV;
+  }
+  return num_vregs;
+}
+
+int promote_stack_slots(Module* module) {
+  CallGraph* cg = build_call_graph(module);
+  if (!cg->num_pcs)
+    return 0;
+
+  PromoteState ps = {};
+  ps.cg = cg;
+  ps.is_call = calloc(cg->num_pcs, sizeof(bool));
+  for (int i = 0; i < cg->num_calls; i++)
+    ps.is_call[cg->calls[i].pc] = true;
+  // Return sites are only jumped to by returns.
+  ps.taken = calloc(cg->num_pcs, sizeof(bool));
+  int num_taken;
+  int* taken = get_addr_taken_pcs(module, &num_taken);
+  for (int i = 0; i < num_taken; i++)
+    ps.taken[taken[i]] = true;
+  for (int i = 0; i < cg->num_calls; i++)
+    ps.taken[cg->calls[i].ret_pc] = false;
+
+  bool* reentrant = calloc(cg->num_funcs, sizeof(bool));
+  ps_find_reentrant(cg, module, ps.taken, reentrant);
+
+  int num_vregs = 0;
+  for (int f = 0; f < cg->num_funcs; f++) {
+    Func* func = &cg->funcs[f];
+    if (reentrant[f] || !func->text)
+      continue;
+    int n = func->end - func->entry;
+    int num_insts = 0;
+    ps.func = func;
+    ps.first = calloc(n, sizeof(Inst*));
+    ps.last = calloc(n, sizeof(Inst*));
+    for (Inst* inst = func->text; inst && inst->pc < func->end;
+         inst = inst->next) {
+      if (!ps.first[inst->pc - func->entry])
+        ps.first[inst->pc - func->entry] = inst;
+      ps.last[inst->pc - func->entry] = inst;
+      num_insts++;
+    }
+    ps.live_in = calloc(n, sizeof(int));
+    ps.live_out = calloc(n, sizeof(int));
+    ps.frame_setup = NULL;
+    ps.accesses = calloc(num_insts, sizeof(Inst*));
+    ps.access_offs = calloc(num_insts, sizeof(int));
+    ps.num_accesses = 0;
+
+    ps_compute_liveness(&ps);
+    if (ps_scan_func(&ps))
+      num_vregs += ps_promote(&ps, num_vregs);
+  }
+  return num_vregs;
+}
@@ -0,0 +1,385 @@
+#include <ir/func.h>
+
+#include <stdlib.h>
+
+// Value range analysis.
+//
+// Each register is tracked as an interval of words at the entry of
+// each pc. ADD and SUB whose results provably fit in a word get
+// Inst.no_wrap, so backends need not mask them. A conditional jump
+// narrows the range of its first operand on both edges. Nothing is
+// known at pcs which register jumps may go to.
+//
+// Bounds which keep growing after RA_WIDEN_AFTER visits of a pc jump
+// to their limits, and then a few rounds of recomputing every pc from
+// its predecessors recover bounds such as those of loop counters.
+
+#define RA_NUM_REGS 6
+#define RA_WIDEN_AFTER 8
+#define RA_NARROW_ROUNDS 2
+
+// The largest word of the module being analyzed and its bit width.
+static unsigned int ra_word_max;
+static unsigned int ra_word_bits;
+
+typedef struct {
+  unsigned int lo[RA_NUM_REGS];
+  unsigned int hi[RA_NUM_REGS];
+} Ranges;
+
+typedef struct {
+  int num_pcs;
+  Inst** first;
+  bool* taken;
+  Ranges* in;
+  bool* reached;
+  int* visits;
+  int* worklist;
+  bool* queued;
+  int num_work;
+} RangeState;
+
+static void ra_set(Ranges* r, int reg, unsigned int lo, unsigned int hi) {
+  r->lo[reg] = lo;
+  r->hi[reg] = hi;
+}
+
+static void ra_set_top(Ranges* r) {
+  for (int i = 0; i < RA_NUM_REGS; i++)
+    ra_set(r, i, 0, ra_word_max);
+}
+
+static void ra_value(Ranges* r, Value* v, unsigned int* lo, unsigned int* hi) {
+  if (v->type == REG && v->reg < RA_NUM_REGS) {
+    *lo = r->lo[v->reg];
+    *hi = r->hi[v->reg];
+  } else if (v->type == REG) {
+    // Virtual registers.
+    *lo = 0;
+    *hi = ra_word_max;
+  } else {
+    *lo = *hi = v->imm;
+  }
+}
+
+static unsigned int ra_min(unsigned int a, unsigned int b) {
+  return a < b ? a : b;
+}
+
+static unsigned int ra_max(unsigned int a, unsigned int b) {
+  return a > b ? a : b;
+}
+
+// The smallest 2^k-1 which is not less than |v|.
+static unsigned int ra_mask(unsigned int v) {
+  unsigned int m = 0;
+  while (m < v)
+    m = m * 2 + 1;
+  return m;
+}
+
+// Applies |inst| to |r|. Returns true if |inst| is an ADD or SUB which
+// does not wrap around.
+static bool ra_step(Ranges* r, Inst* inst) {
+  if (inst->dst.type != REG || inst->dst.reg >= RA_NUM_REGS)
+    return false;
+  int d = inst->dst.reg;
+  unsigned int dlo = r->lo[d];
+  unsigned int dhi = r->hi[d];
+  unsigned int slo, shi;
+  ra_value(r, &inst->src, &slo, &shi);
+
+  switch (inst->op) {
+  case MOV:
+    ra_set(r, d, slo, shi);
+    break;
+
+  case ADD:
+    if (dhi <= ra_word_max - shi) {
+      ra_set(r, d, dlo + slo, dhi + shi);
+      return true;
+    }
+    ra_set(r, d, 0, ra_word_max);
+    break;
+
+  case SUB:
+    if (dlo >= shi) {
+      ra_set(r, d, dlo - shi, dhi - slo);
+      return true;
+    }
+    ra_set(r, d, 0, ra_word_max);
+    break;
+
+  case LOAD:
+    ra_set(r, d, 0, ra_word_max);
+    break;
+
+  case GETC:
+    ra_set(r, d, 0, 255);
+    break;
+
+  case EQ:
+  case NE:
+  case LT:
+  case GT:
+  case LE:
+  case GE:
+    ra_set(r, d, 0, 1);
+    break;
+
+  case MUL:
+    if (dhi == 0 || shi <= ra_word_max / dhi)
+      ra_set(r, d, dlo * slo, dhi * shi);
+    else
+      ra_set(r, d, 0, ra_word_max);
+    break;
+
+  case DIV:
+    if (slo)
+      ra_set(r, d, dlo / shi, dhi / slo);
+    else
+      ra_set(r, d, 0, ra_word_max);
+    break;
+
+  case MOD:
+    if (slo)
+      ra_set(r, d, 0, ra_min(dhi, shi - 1));
+    else
+      ra_set(r, d, 0, ra_word_max);
+    break;
+
+  case AND:
+    ra_set(r, d, 0, ra_min(dhi, shi));
+    break;
+
+  case OR:
+  case XOR:
+    ra_set(r, d, 0, ra_mask(ra_max(dhi, shi)));
+    break;
+
+  case SHR:
+    ra_set(r, d, shi >= ra_word_bits ? 0 : dlo >> shi,
+           slo >= ra_word_bits ? 0 : dhi >> slo);
+    break;
+
+  case SHL:
+    ra_set(r, d, 0, ra_word_max);
+    break;
+
+  default:
+    break;
+  }
+  return false;
+}
+
+// Narrows the range of the first operand of a conditional jump on the
+// edge where the condition is |taken|. Returns false if the edge can
+// never be taken.
+static bool ra_refine(Ranges* r, Inst* inst, bool taken) {
+  if (inst->dst.type != REG || inst->dst.reg >= RA_NUM_REGS)
+    return true;
+  unsigned int slo, shi;
+  ra_value(r, &inst->src, &slo, &shi);
+  Op op = inst->op;
+  if (!taken) {
+    switch (op) {
+    case JEQ: op = JNE; break;
+    case JNE: op = JEQ; break;
+    case JLT: op = JGE; break;
+    case JGT: op = JLE; break;
+    case JLE: op = JGT; break;
+    case JGE: op = JLT; break;
+    default: break;
+    }
+  }
+
+  int d = inst->dst.reg;
+  unsigned int lo = r->lo[d];
+  unsigned int hi = r->hi[d];
+  switch (op) {
+  case JEQ:
+    lo = ra_max(lo, slo);
+    hi = ra_min(hi, shi);
+    break;
+  case JNE:
+    if (slo == shi) {
+      if (lo == slo && hi == slo)
+        return false;
+      if (lo == slo)
+        lo++;
+      else if (hi == slo)
+        hi--;
+    }
+    break;
+  case JLT:
+    if (!shi)
+      return false;
+    hi = ra_min(hi, shi - 1);
+    break;
+  case JLE:
+    hi = ra_min(hi, shi);
+    break;
+  case JGT:
+    if (slo == ra_word_max)
+      return false;
+    lo = ra_max(lo, slo + 1);
+    break;
+  case JGE:
+    lo = ra_max(lo, slo);
+    break;
+  default:
+    break;
+  }
+  if (lo > hi)
+    return false;
+  ra_set(r, d, lo, hi);
+  return true;
+}
+
+// Joins |r| into the entry of |pc|. Returns true if it grew.
+static bool ra_join(RangeState* ra, int pc, Ranges* r, bool widen) {
+  if (pc < 0 || pc >= ra->num_pcs)
+    return false;
+  Ranges* in = &ra->in[pc];
+  if (!ra->reached[pc]) {
+    ra->reached[pc] = true;
+    *in = *r;
+    return true;
+  }
+  widen = widen && ra->visits[pc] >= RA_WIDEN_AFTER;
+  bool changed = false;
+  for (int i = 0; i < RA_NUM_REGS; i++) {
+    if (r->lo[i] < in->lo[i]) {
+      in->lo[i] = widen ? 0 : r->lo[i];
+      changed = true;
+    }
+    if (r->hi[i] > in->hi[i]) {
+      in->hi[i] = widen ? ra_word_max : r->hi[i];
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+static void ra_push(RangeState* ra, int pc, Ranges* r, bool widen) {
+  if (!ra_join(ra, pc, r, widen))
+    return;
+  ra->visits[pc]++;
+  if (widen && !ra->queued[pc]) {
+    ra->queued[pc] = true;
+    ra->worklist[ra->num_work++] = pc;
+  }
+}
+
+// Runs the instructions of |pc| from |in| and passes the result to
+// its successors.
+static void ra_flow(RangeState* ra, int pc, Ranges* in, bool widen) {
+  Ranges r = *in;
+  Inst* inst = ra->first[pc];
+  Inst* last = inst;
+  for (; inst && inst->pc == pc; inst = inst->next) {
+    ra_step(&r, inst);
+    last = inst;
+  }
+  if (!last) {
+    ra_push(ra, pc + 1, &r, widen);
+    return;
+  }
+
+  if (last->op == EXIT)
+    return;
+  if (last->op == JMP) {
+    if (last->jmp.type == IMM)
+      ra_push(ra, last->jmp.imm, &r, widen);
+    return;
+  }
+  if (last->op >= JEQ && last->op <= JGE) {
+    Ranges t = r;
+    if (last->jmp.type == IMM && ra_refine(&t, last, true))
+      ra_push(ra, last->jmp.imm, &t, widen);
+    if (!ra_refine(&r, last, false))
+      return;
+  }
+  ra_push(ra, pc + 1, &r, widen);
+}
+
+// Sets up the states known without any flow: all registers are zero
+// at the beginning and nothing is known at address-taken pcs.
+static void ra_init_entries(RangeState* ra) {
+  for (int pc = 0; pc < ra->num_pcs; pc++) {
+    ra->reached[pc] = false;
+    ra->visits[pc] = 0;
+  }
+  Ranges r;
+  for (int pc = 0; pc < ra->num_pcs; pc++) {
+    if (!ra->taken[pc])
+      continue;
+    ra_set_top(&r);
+    ra_join(ra, pc, &r, false);
+  }
+  for (int i = 0; i < RA_NUM_REGS; i++)
+    ra_set(&r, i, 0, 0);
+  ra_join(ra, 0, &r, false);
+}
+
+void analyze_ranges(Module* module) {
+  ra_word_bits = module->word_bits;
+  ra_word_max = module->word_bits == 32 ? ~0U : (1U << module->word_bits) - 1;
+  RangeState ra = {};
+  for (Inst* inst = module->text; inst; inst = inst->next)
+    ra.num_pcs = inst->pc + 1;
+  if (!ra.num_pcs)
+    return;
+
+  int n = ra.num_pcs;
+  ra.first = calloc(n, sizeof(Inst*));
+  for (Inst* inst = module->text; inst; inst = inst->next) {
+    if (!ra.first[inst->pc])
+      ra.first[inst->pc] = inst;
+  }
+  ra.taken = calloc(n, sizeof(bool));
+  int num_taken;
+  int* taken = get_addr_taken_pcs(module, &num_taken);
+  for (int i = 0; i < num_taken; i++)
+    ra.taken[taken[i]] = true;
+  ra.in = calloc(n, sizeof(Ranges));
+  ra.reached = calloc(n, sizeof(bool));
+  ra.visits = calloc(n, sizeof(int));
+  ra.worklist = calloc(n, sizeof(int));
+  ra.queued = calloc(n, sizeof(bool));
+
+  ra_init_entries(&ra);
+  for (int pc = 0; pc < n; pc++) {
+    if (ra.reached[pc]) {
+      ra.queued[pc] = true;
+      ra.worklist[ra.num_work++] = pc;
+    }
+  }
+  while (ra.num_work) {
+    int pc = ra.worklist[--ra.num_work];
+    ra.queued[pc] = false;
+    ra_flow(&ra, pc, &ra.in[pc], true);
+  }
+
+  // Each round recomputes the entries from the previous ones.
+  for (int round = 0; round < RA_NARROW_ROUNDS; round++) {
+    Ranges* prev = ra.in;
+    bool* prev_reached = ra.reached;
+    ra.in = calloc(n, sizeof(Ranges));
+    ra.reached = calloc(n, sizeof(bool));
+    ra_init_entries(&ra);
+    for (int pc = 0; pc < n; pc++) {
+      if (prev_reached[pc])
+        ra_flow(&ra, pc, &prev[pc], false);
+    }
+  }
+
+  for (int pc = 0; pc < n; pc++) {
+    if (!ra.reached[pc])
+      continue;
+    Ranges r = ra.in[pc];
+    for (Inst* inst = ra.first[pc]; inst && inst->pc == pc;
+         inst = inst->next)
+      inst->no_wrap = ra_step(&r, inst);
+  }
+}
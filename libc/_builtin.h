@@ -35,6 +35,10 @@ void my_div(unsigned int a, unsigned int b, _my_div_t* o) {
   o->rem = a;
 }
 
+// Backends which support MUL, DIV, and so on natively replace the
+// bodies of the __builtin_* functions below with a single op (see
+// replace_builtin_arith in ir/ir.c), so keep their signatures as is.
+
 static int __builtin_mul(int a, int b) {
   int i, e, v;
   if (a < b) {
@@ -19,7 +19,7 @@ static int ARMREG[] = {
   11, // RODATA
   12, // FFFFFF
   13, // ARM_SP
-  14,
+  14, // ARM_LR
   15, // ARM_PC
 };
 
@@ -35,6 +35,7 @@ static int ARMREG[] = {
 #define RODATA ((Reg)11)
 #define FFFFFF ((Reg)12)
 #define ARM_SP ((Reg)13)
+#define ARM_LR ((Reg)14)
 #define ARM_PC ((Reg)15)
 
 void emit_elf_header(uint16_t machine, uint32_t filesz);
@@ -53,6 +54,7 @@ static void emit_svc() {
 typedef enum {
   ARM_AND = 0x00,
   ARM_SUB = 0x40,
+  ARM_SUBS = 0x50,
   ARM_ADD = 0x80,
 } ArmOp;
 
@@ -64,9 +66,24 @@ typedef enum {
   Shl0 = 0,
   Shl24 = 4,
   Shl16 = 8,
+  Shl12 = 10,
   Shl8 = 12
 } ImmRot;
 
+// Returns the rotation of |v| as an ARM immediate and sets |imm8|, or
+// returns -1 if |v| does not fit. Only rotations which do not wrap
+// around are tried, as words have 24 bits.
+static int arm_imm_rot(uint v, int* imm8) {
+  uint scale = 1;
+  for (int shift = 0; shift < 24; shift += 2, scale *= 4) {
+    if (v % scale == 0 && v / scale < 256) {
+      *imm8 = v / scale;
+      return shift ? 16 - shift / 2 : 0;
+    }
+  }
+  return -1;
+}
+
 static void emit_arm_mov_reg(Reg dst, Reg src) {
   emit_4le(0xe1, 0xa0, ARMREG[dst] * 16, ARMREG[src]);
 }
@@ -79,53 +96,143 @@ static void emit_arm_mvn_imm8(Reg dst, int imm8, ImmRot rot) {
   emit_4le(0xe3, 0xe0, ARMREG[dst] * 16 + rot, imm8);
 }
 
+static void emit_arm_op_imm8(ArmOp op, Reg dst, Reg src, int imm8, int rot) {
+  emit_4le(0xe2, op + ARMREG[src], ARMREG[dst] * 16 + rot, imm8);
+}
+
 static void emit_arm_add_imm8(Reg dst, int imm8, ImmRot rot) {
-  emit_4le(0xe2, ARM_ADD + ARMREG[dst], ARMREG[dst] * 16 + rot, imm8);
+  emit_arm_op_imm8(ARM_ADD, dst, dst, imm8, rot);
 }
 
-static void emit_arm_sub_imm8(Reg dst, int imm8, ImmRot rot) {
-  emit_4le(0xe2, ARM_SUB + ARMREG[dst], ARMREG[dst] * 16 + rot, imm8);
+static void emit_arm_cmp_imm8(Reg reg, int imm8, int rot) {
+  emit_4le(0xe3, 0x50 + ARMREG[reg], rot, imm8);
 }
 
-static void emit_arm_mov_imm(Reg dst, int imm) {
-  emit_arm_mov_imm8(dst, imm % 256, Shl0);
-  imm /= 256;
-  if (!imm)
-    return;
-  emit_arm_add_imm8(dst, imm % 256, Shl8);
-  imm /= 256;
-  if (!imm)
-    return;
-  emit_arm_add_imm8(dst, imm % 256, Shl16);
+// mov pc, lr under condition |cond|.
+static void emit_arm_ret(int cond) {
+  emit_4le(cond * 16 + 1, 0xa0, 0xf0, 0x0e);
 }
 
-static void emit_arm_add_imm(Reg dst, int imm) {
-  if (imm > 0xffff00) {
-    emit_arm_sub_imm8(dst, 0x1000000 - imm, Shl0);
-    return;
+static void emit_arm_push(Reg reg) {
+  emit_4le(0xe5, 0x2d, ARMREG[reg] * 16, 0x04);
+}
+
+static void emit_arm_pop(Reg reg) {
+  emit_4le(0xe4, 0x9d, ARMREG[reg] * 16, 0x04);
+}
+
+// A branch (b, bl, or bcc depending on |op|) to |addr|.
+static void emit_arm_branch(int op, int addr) {
+  uint32_t v = addr / 4 - (emit_cnt() + 8) / 4;
+  emit_1(v % 256);
+  v /= 256;
+  emit_1(v % 256);
+  v /= 256;
+  emit_1(v % 256);
+  emit_1(op);
+}
+
+// Constants which do not fit in an instruction are loaded from literal
+// pools placed after unconditional jumps, or in the middle of code
+// with a branch over them before the first load would go out of the
+// 4095 byte range of ldr. The first pass fixes where each load's
+// literal goes, and the second pass emits loads from there.
+#define ARM_POOL_MAX 1024
+#define ARM_POOL_RANGE 4095
+// No instruction emits more bytes than this before the next check.
+#define ARM_MAX_INST_SIZE 32
+
+static int* arm_lit_addrs;
+static int arm_num_lits;
+static int arm_pool_values[ARM_POOL_MAX];
+static int arm_pool_slots[ARM_POOL_MAX];
+static int arm_pool_size;
+static int arm_pool_first_lit;
+static int arm_pool_first_use;
+
+static void arm_reset_pool(void) {
+  arm_num_lits = 0;
+  arm_pool_size = 0;
+  arm_pool_first_lit = 0;
+}
+
+static void emit_arm_ldr_lit(Reg dst, int v) {
+  int slot = 0;
+  while (slot < arm_pool_size && arm_pool_values[slot] != v)
+    slot++;
+  if (slot == arm_pool_size) {
+    if (!arm_pool_size)
+      arm_pool_first_use = emit_cnt();
+    arm_pool_values[arm_pool_size++] = v;
   }
+  arm_pool_slots[arm_num_lits - arm_pool_first_lit] = slot;
+  // ldr dst, [pc, #off]
+  int off = arm_lit_addrs[arm_num_lits++] - emit_cnt() - 8;
+  if (off < 0)
+    off = 0;
+  emit_4le(0xe5, 0x9f, ARMREG[dst] * 16 + off / 256, off % 256);
+}
 
-  emit_arm_add_imm8(dst, imm % 256, Shl0);
-  imm /= 256;
-  if (!imm)
+static void emit_arm_pool(bool branch_over) {
+  if (!arm_pool_size)
     return;
-  emit_arm_add_imm8(dst, imm % 256, Shl8);
-  imm /= 256;
-  if (!imm)
+  if (branch_over) {
+    // b over the pool
+    emit_4le(0xea, 0, (arm_pool_size - 1) / 256, (arm_pool_size - 1) % 256);
+  }
+  int addr = emit_cnt();
+  for (int i = arm_pool_first_lit; i < arm_num_lits; i++)
+    arm_lit_addrs[i] = addr + arm_pool_slots[i - arm_pool_first_lit] * 4;
+  for (int i = 0; i < arm_pool_size; i++)
+    emit_le(arm_pool_values[i]);
+  arm_pool_size = 0;
+  arm_pool_first_lit = arm_num_lits;
+}
+
+// Emits the pool now if it might be out of range after the next
+// instruction.
+static void arm_check_pool(void) {
+  if (!arm_pool_size)
     return;
-  emit_arm_add_imm8(dst, imm, Shl16);
+  if (arm_pool_size + 1 >= ARM_POOL_MAX ||
+      arm_num_lits - arm_pool_first_lit + 1 >= ARM_POOL_MAX ||
+      (emit_cnt() + ARM_MAX_INST_SIZE + 4 + arm_pool_size * 4 >
+       arm_pool_first_use + 8 + ARM_POOL_RANGE))
+    emit_arm_pool(true);
+}
+
+// Loads a constant which cannot go through the literal pool as its
+// value is not known in the first pass.
+static void emit_arm_ldr_inline(Reg dst, int v) {
+  // ldr dst, [pc]; b +4; .word v
+  emit_4le(0xe5, 0x9f, ARMREG[dst] * 16, 0x00);
+  emit_4le(0xea, 0x00, 0x00, 0x00);
+  emit_le(v);
 }
 
-static void emit_arm_sub_imm(Reg dst, int imm) {
-  emit_arm_sub_imm8(dst, imm % 256, Shl0);
-  imm /= 256;
-  if (!imm)
+static void emit_arm_mov_imm(Reg dst, int imm) {
+  int imm8;
+  int rot = arm_imm_rot(imm, &imm8);
+  if (rot >= 0)
+    emit_arm_mov_imm8(dst, imm8, rot);
+  else
+    emit_arm_ldr_lit(dst, imm);
+}
+
+static void emit_arm_op_imm(ArmOp op, Reg dst, int imm) {
+  int imm8;
+  int rot = arm_imm_rot(imm, &imm8);
+  if (rot >= 0) {
+    emit_arm_op_imm8(op, dst, dst, imm8, rot);
     return;
-  emit_arm_sub_imm8(dst, imm % 256, Shl8);
-  imm /= 256;
-  if (!imm)
+  }
+  rot = arm_imm_rot(0x1000000 - imm, &imm8);
+  if (rot >= 0) {
+    emit_arm_op_imm8(op == ARM_ADD ? ARM_SUB : ARM_ADD, dst, dst, imm8, rot);
     return;
-  emit_arm_sub_imm8(dst, imm, Shl16);
+  }
+  emit_arm_ldr_lit(R0, imm);
+  emit_reg2op(op, dst, R0);
 }
 
 typedef enum {
@@ -137,13 +244,28 @@ static void emit_arm_mem(LoadOrStore op, Reg val, Reg base, Reg offset) {
   emit_4le(0xe7, op + ARMREG[base], ARMREG[val] * 16 + 1, ARMREG[offset]);
 }
 
+static void emit_arm_mem_imm(LoadOrStore op, Reg val, Reg base, int off) {
+  emit_4le(0xe5, op + ARMREG[base], ARMREG[val] * 16 + off / 256, off % 256);
+}
+
+// ldrb/strb val, [base, offset]
+static void emit_arm_mem_byte(LoadOrStore op, Reg val, Reg base, Reg offset) {
+  emit_4le(0xe7, op + 0x40 + ARMREG[base], ARMREG[val] * 16, ARMREG[offset]);
+}
+
 static void emit_arm_cmp(Inst* inst) {
   Reg reg;
   if (inst->src.type == REG) {
     reg = inst->src.reg;
   } else {
+    int imm8;
+    int rot = arm_imm_rot(inst->src.imm, &imm8);
+    if (rot >= 0) {
+      emit_arm_cmp_imm8(inst->dst.reg, imm8, rot);
+      return;
+    }
     reg = R0;
-    emit_arm_mov_imm(reg, inst->src.imm);
+    emit_arm_ldr_lit(reg, inst->src.imm);
   }
   emit_4le(0xe1, 0x50 + ARMREG[inst->dst.reg], 0x00, ARMREG[reg]);
 }
@@ -162,19 +284,140 @@ static void emit_arm_jcc(Inst* inst, int op, int* pc2addr) {
   if (inst->jmp.type == REG) {
     emit_arm_mem(MEM_LOAD, ARM_PC, RODATA, inst->jmp.reg);
   } else {
-    uint32_t v = pc2addr[inst->jmp.imm] / 4 - (emit_cnt() + 8) / 4;
-    emit_1(v % 256);
-    v /= 256;
-    emit_1(v % 256);
-    v /= 256;
-    emit_1(v % 256);
-    emit_1(op);
+    emit_arm_branch(op, pc2addr[inst->jmp.imm]);
   }
 }
 
-static void init_state_arm(Data* data, int rodata_addr) {
+// I/O goes through buffers placed after the 2^24 words of memory, at
+// these offsets from ARM_MEM + (1<<26). PUTC, GETC, and EXIT call the
+// routines emitted by emit_runtime_arm. The offsets are ARM
+// immediates.
+#define ARM_IO_BUF_SIZE 4096
+#define ARM_OUT_LEN 0
+#define ARM_IN_POS 4
+#define ARM_IN_LEN 8
+#define ARM_OUT_BUF 0x1000
+#define ARM_IN_BUF 0x2000
+#define ARM_IO_SIZE 0x3000
+
+enum {
+  ARM_RT_FLUSH, ARM_RT_FLUSH_LOOP, ARM_RT_FLUSH_END,
+  ARM_RT_PUTC,
+  ARM_RT_GETC, ARM_RT_GETC_HAVE,
+  ARM_RT_END, ARM_RT_NUM_LABELS
+};
+
+// Addresses of the labels in the routines. As with pc2addr, the
+// first pass records them and the second pass jumps forward to them.
+static int arm_rt_addrs[ARM_RT_NUM_LABELS];
+
+static void arm_rt_label(int label) {
+  arm_rt_addrs[label] = emit_cnt();
+}
+
+static void arm_rt_branch(int op, int label) {
+  emit_arm_branch(op, arm_rt_addrs[label]);
+}
+
+// add dst, ARM_MEM, #(1<<26)
+static void emit_arm_io_base(Reg dst) {
+  emit_arm_op_imm8(ARM_ADD, dst, ARM_MEM, 4, Shl24);
+}
+
+static void emit_runtime_arm(void) {
+  arm_rt_branch(0xea, ARM_RT_END);
+
+  // flush: writes out the output buffer. Clobbers R0-R2.
+  arm_rt_label(ARM_RT_FLUSH);
+  emit_arm_io_base(R1);
+  emit_arm_mem_imm(MEM_LOAD, R2, R1, ARM_OUT_LEN);
+  emit_arm_mov_imm8(R0, 0, Shl0);
+  emit_arm_mem_imm(MEM_STORE, R0, R1, ARM_OUT_LEN);
+  emit_arm_op_imm8(ARM_ADD, R1, R1, ARM_OUT_BUF >> 12, Shl12);
+  emit_arm_push(R7);
+  emit_arm_mov_imm8(R7, 4, Shl0);  // write
+  arm_rt_label(ARM_RT_FLUSH_LOOP);
+  emit_arm_cmp_imm8(R2, 0, Shl0);
+  arm_rt_branch(0xda, ARM_RT_FLUSH_END);  // ble
+  emit_arm_mov_imm8(R0, 1, Shl0);  // stdout
+  emit_svc();
+  emit_arm_cmp_imm8(R0, 0, Shl0);
+  arm_rt_branch(0xda, ARM_RT_FLUSH_END);  // ble
+  emit_reg2op(ARM_ADD, R1, R0);
+  emit_reg2op(ARM_SUB, R2, R0);
+  arm_rt_branch(0xea, ARM_RT_FLUSH_LOOP);
+  arm_rt_label(ARM_RT_FLUSH_END);
+  emit_arm_pop(R7);
+  emit_arm_ret(0xe);
+
+  // putc: appends R0 to the output buffer. Clobbers R0-R3.
+  arm_rt_label(ARM_RT_PUTC);
+  emit_arm_io_base(R1);
+  emit_arm_mem_imm(MEM_LOAD, R2, R1, ARM_OUT_LEN);
+  emit_arm_op_imm8(ARM_ADD, R3, R1, ARM_OUT_BUF >> 12, Shl12);
+  emit_arm_mem_byte(MEM_STORE, R0, R3, R2);
+  emit_arm_add_imm8(R2, 1, Shl0);
+  emit_arm_mem_imm(MEM_STORE, R2, R1, ARM_OUT_LEN);
+  emit_arm_cmp_imm8(R2, ARM_IO_BUF_SIZE >> 12, Shl12);
+  emit_arm_ret(0x1);  // movne pc, lr
+  arm_rt_branch(0xea, ARM_RT_FLUSH);
+
+  // getc: returns the next input byte in R0, or 0 at EOF. Clobbers
+  // R0-R3.
+  arm_rt_label(ARM_RT_GETC);
+  emit_arm_io_base(R1);
+  emit_arm_mem_imm(MEM_LOAD, R2, R1, ARM_IN_POS);
+  emit_arm_mem_imm(MEM_LOAD, R3, R1, ARM_IN_LEN);
+  emit_4le(0xe1, 0x50 + ARMREG[R2], 0x00, ARMREG[R3]);  // cmp R2, R3
+  arm_rt_branch(0xba, ARM_RT_GETC_HAVE);  // blt
+  // Show the output before a read which may block.
+  emit_arm_push(ARM_LR);
+  arm_rt_branch(0xeb, ARM_RT_FLUSH);
+  emit_arm_pop(ARM_LR);
+  emit_arm_push(R7);
+  emit_arm_mov_imm8(R0, 0, Shl0);  // stdin
+  emit_arm_io_base(R1);
+  emit_arm_op_imm8(ARM_ADD, R1, R1, ARM_IN_BUF >> 12, Shl12);
+  emit_arm_mov_imm8(R2, ARM_IO_BUF_SIZE >> 12, Shl12);
+  emit_arm_mov_imm8(R7, 3, Shl0);  // read
+  emit_svc();
+  emit_arm_pop(R7);
+  emit_arm_io_base(R1);
+  emit_arm_mov_imm8(R2, 0, Shl0);
+  emit_arm_mem_imm(MEM_STORE, R2, R1, ARM_IN_POS);
+  emit_arm_mem_imm(MEM_STORE, R2, R1, ARM_IN_LEN);
+  emit_arm_cmp_imm8(R0, 0, Shl0);
+  emit_4le(0xd3, 0xa0, ARMREG[R0] * 16, 0x00);  // movle R0, #0
+  emit_arm_ret(0xd);  // movle pc, lr
+  emit_arm_mem_imm(MEM_STORE, R0, R1, ARM_IN_LEN);
+  arm_rt_label(ARM_RT_GETC_HAVE);
+  emit_arm_op_imm8(ARM_ADD, R3, R1, ARM_IN_BUF >> 12, Shl12);
+  emit_arm_mem_byte(MEM_LOAD, R0, R3, R2);
+  emit_arm_add_imm8(R2, 1, Shl0);
+  emit_arm_mem_imm(MEM_STORE, R2, R1, ARM_IN_POS);
+  emit_arm_ret(0xe);
+
+  arm_rt_label(ARM_RT_END);
+}
+
+// The number of words up to the last nonzero one, rounded up to a
+// multiple of four.
+static int arm_data_size(Data* data) {
+  int size = 0;
+  for (int mp = 0; data; data = data->next, mp++) {
+    if (data->v)
+      size = mp + 1;
+  }
+  return (size + 3) / 4 * 4;
+}
+
+// The initial memory image is appended to the file after the jump
+// table and copied from |data_addr| to the mmap'd memory four words
+// at a time.
+static void init_state_arm(int data_addr, int data_size, int rodata_addr) {
   emit_arm_mov_imm8(R0, 0, Shl0);
   emit_arm_mov_imm8(R1, 4, Shl24);
+  emit_arm_add_imm8(R1, ARM_IO_SIZE >> 12, Shl12);
   emit_arm_mov_imm8(R2, 3, Shl0);  // PROT_READ | PROT_WRITE
   emit_arm_mov_imm8(R3, 0x22, Shl0);  // MAP_PRIVATE | MAP_ANONYMOUS
   emit_arm_mvn_imm8(R4, 0, Shl0);  // 0xffffffff
@@ -184,25 +427,18 @@ static void init_state_arm(Data* data, int rodata_addr) {
 
   emit_arm_mov_reg(ARM_MEM, R0);
 
-  int prev = 0;
-  for (int mp = 0; data; data = data->next, mp++) {
-    if (!data->v)
-      continue;
-    int d = (mp - prev) * 4;
-    if (d >= 4096) {
-      emit_arm_add_imm(R0, d);
-      d = 0;
-    }
-    emit_arm_mov_imm(R1, data->v);
-    emit_4le(0xe5, 0xa0, 0x10 + d / 256, d % 256);
-    prev = mp;
+  if (data_size) {
+    emit_arm_ldr_inline(R1, data_addr);
+    emit_arm_ldr_inline(R2, data_size / 4);
+    // ldmia R1!, {R3-R6}; stmia R0!, {R3-R6}
+    emit_4le(0xe8, 0xb0 + ARMREG[R1], 0x00, 0x78);
+    emit_4le(0xe8, 0xa0 + ARMREG[R0], 0x00, 0x78);
+    emit_arm_op_imm8(ARM_SUBS, R2, R2, 1, Shl0);
+    // bne back to the ldr
+    emit_4le(0x1a, 0xff, 0xff, 0xfb);
   }
 
-  emit_arm_mov_imm8(RODATA, rodata_addr % 256, Shl0);
-  rodata_addr /= 256;
-  emit_arm_add_imm8(RODATA, rodata_addr % 256, Shl8);
-  rodata_addr /= 256;
-  emit_arm_add_imm8(RODATA, rodata_addr % 256, Shl16);
+  emit_arm_ldr_inline(RODATA, rodata_addr);
   emit_arm_mvn_imm8(FFFFFF, 0xff, Shl24);
 
   emit_arm_mov_imm8(A, 0, Shl0);
@@ -211,11 +447,15 @@ static void init_state_arm(Data* data, int rodata_addr) {
   emit_arm_mov_imm8(D, 0, Shl0);
   emit_arm_mov_imm8(BP, 0, Shl0);
   emit_arm_mov_imm8(SP, 0, Shl0);
+
+  emit_runtime_arm();
 }
 
 static void arm_emit_inst(Inst* inst, int* pc2addr) {
   Reg reg;
 
+  arm_check_pool();
+
   switch (inst->op) {
   case MOV:
     if (inst->src.type == REG) {
@@ -226,25 +466,24 @@ static void arm_emit_inst(Inst* inst, int* pc2addr) {
     break;
 
   case ADD:
-    if (inst->src.type == REG) {
-      emit_reg2op(ARM_ADD, inst->dst.reg, inst->src.reg);
-    } else {
-      emit_arm_add_imm(inst->dst.reg, inst->src.imm);
-    }
-    emit_reg2op(ARM_AND, inst->dst.reg, FFFFFF);
-    break;
-
   case SUB:
     if (inst->src.type == REG) {
-      emit_reg2op(ARM_SUB, inst->dst.reg, inst->src.reg);
+      emit_reg2op(inst->op == ADD ? ARM_ADD : ARM_SUB,
+                  inst->dst.reg, inst->src.reg);
     } else {
-      emit_arm_sub_imm(inst->dst.reg, inst->src.imm);
+      emit_arm_op_imm(inst->op == ADD ? ARM_ADD : ARM_SUB,
+                       inst->dst.reg, inst->src.imm);
     }
     emit_reg2op(ARM_AND, inst->dst.reg, FFFFFF);
     break;
 
   case LOAD:
   case STORE:
+    if (inst->src.type == IMM && inst->src.imm < 1024) {
+      emit_arm_mem_imm(inst->op == LOAD ? MEM_LOAD : MEM_STORE,
+                       inst->dst.reg, ARM_MEM, inst->src.imm * 4);
+      break;
+    }
     if (inst->src.type == REG) {
       reg = inst->src.reg;
     } else {
@@ -257,34 +496,24 @@ static void arm_emit_inst(Inst* inst, int* pc2addr) {
 
   case PUTC:
     if (inst->src.type == REG) {
-      reg = inst->src.reg;
+      emit_arm_mov_reg(R0, inst->src.reg);
     } else {
-      reg = R0;
-      emit_arm_mov_imm8(reg, inst->src.imm, Shl0);
+      emit_arm_mov_imm8(R0, inst->src.imm % 256, Shl0);
     }
-    emit_4le(0xe5, 0x2d, ARMREG[reg] * 16, 0x04);  // push reg
-    emit_arm_mov_imm8(R0, 1, Shl0);  // stdout
-    emit_arm_mov_reg(R1, ARM_SP);
-    emit_arm_mov_imm8(R2, 1, Shl0);
-    emit_arm_mov_imm8(R7, 4, Shl0);  // write
-    emit_svc();
-    emit_4le(0xe4, 0x9d, ARMREG[R0] * 16, 0x04);  // pop R0
+    arm_rt_branch(0xeb, ARM_RT_PUTC);
     break;
 
   case GETC:
-    emit_arm_mov_imm8(R0, 0, Shl0);  // stdin
-    emit_4le(0xe5, 0x2d, ARMREG[R0] * 16, 0x04);  // push 0
-    emit_arm_mov_reg(R1, ARM_SP);
-    emit_arm_mov_imm8(R2, 1, Shl0);
-    emit_arm_mov_imm8(R7, 3, Shl0);  // read
-    emit_svc();
-    emit_4le(0xe4, 0x9d, ARMREG[inst->dst.reg] * 16, 0x04);  // pop dst
+    arm_rt_branch(0xeb, ARM_RT_GETC);
+    emit_arm_mov_reg(inst->dst.reg, R0);
     break;
 
   case EXIT:
+    arm_rt_branch(0xeb, ARM_RT_FLUSH);
     emit_arm_mov_imm8(R0, 0, Shl0);
     emit_arm_mov_imm8(R7, 1, Shl0);  // exit
     emit_svc();
+    emit_arm_pool(false);
     break;
 
   case DUMP:
@@ -340,6 +569,7 @@ static void arm_emit_inst(Inst* inst, int* pc2addr) {
 
   case JMP:
     emit_arm_jcc(inst, 0xea, pc2addr);
+    emit_arm_pool(false);
     break;
 
   default:
@@ -347,16 +577,8 @@ static void arm_emit_inst(Inst* inst, int* pc2addr) {
   }
 }
 
-void target_arm(Module* module) {
-  emit_reset();
-  init_state_arm(module->data, 0);
-
-  int pc_cnt = 0;
-  for (Inst* inst = module->text; inst; inst = inst->next) {
-    pc_cnt++;
-  }
-
-  int* pc2addr = calloc(pc_cnt, sizeof(int));
+static void arm_emit_text(Module* module, int* pc2addr) {
+  arm_reset_pool();
   int prev_pc = -1;
   for (Inst* inst = module->text; inst; inst = inst->next) {
     if (prev_pc != inst->pc) {
@@ -365,20 +587,43 @@ void target_arm(Module* module) {
     prev_pc = inst->pc;
     arm_emit_inst(inst, pc2addr);
   }
+  emit_arm_pool(false);
+}
+
+void target_arm(Module* module) {
+  int data_size = arm_data_size(module->data);
+
+  int pc_cnt = 0;
+  for (Inst* inst = module->text; inst; inst = inst->next) {
+    pc_cnt++;
+  }
+
+  int* pc2addr = calloc(pc_cnt, sizeof(int));
+  // At most one literal per instruction.
+  arm_lit_addrs = calloc(pc_cnt + 1, sizeof(int));
+
+  emit_reset();
+  init_state_arm(0, data_size, 0);
+  arm_emit_text(module, pc2addr);
 
   int rodata_addr = ELF_TEXT_START + emit_cnt() + ELF_HEADER_SIZE;
+  int data_addr = rodata_addr + pc_cnt * 4;
 
-  emit_elf_header(40, emit_cnt() + pc_cnt * 4);
+  emit_elf_header(40, emit_cnt() + (pc_cnt + data_size) * 4);
 
   emit_reset();
   emit_start();
-  init_state_arm(module->data, rodata_addr);
-
-  for (Inst* inst = module->text; inst; inst = inst->next) {
-    arm_emit_inst(inst, pc2addr);
-  }
+  init_state_arm(data_addr, data_size, rodata_addr);
+  arm_emit_text(module, pc2addr);
 
   for (int i = 0; i < pc_cnt; i++) {
     emit_le(ELF_TEXT_START + pc2addr[i] + ELF_HEADER_SIZE);
   }
+
+  Data* data = module->data;
+  for (int mp = 0; mp < data_size; mp++) {
+    emit_le(data ? data->v : 0);
+    if (data)
+      data = data->next;
+  }
 }
@@ -1,7 +1,7 @@
 #include <ir/ir.h>
 #include <target/util.h>
 
-static void init_state_asmjs(Data* data) {
+static void init_state_asmjs(void) {
   emit_line("var main = function() {");
   emit_line("var mod = function(stdlib, foreign, heap) {");
   emit_line("\"use asm\";");
@@ -13,13 +13,6 @@ static void init_state_asmjs(Data* data) {
   for (int i = 0; i < 7; i++) {
     emit_line("var %s = 0;", reg_names[i]);
   }
-  emit_line("function init() {");
-  for (int mp = 0; data; data = data->next, mp++) {
-    if (data->v) {
-      emit_line("mem[%d] = %d;", mp, data->v);
-    }
-  }
-  emit_line("}");
 }
 
 static void asmjs_emit_func_prologue(int func_id) {
@@ -145,7 +138,7 @@ static void asmjs_emit_inst(Inst* inst) {
 }
 
 void target_asmjs(Module* module) {
-  init_state_asmjs(module->data);
+  init_state_asmjs();
 
   int num_funcs = emit_chunked_main_loop(module->text,
                                          asmjs_emit_func_prologue,
@@ -155,7 +148,6 @@ void target_asmjs(Module* module) {
 
   emit_line("");
   emit_line("function main() {");
-  emit_line("init();");
   emit_line("while (running) {");
   inc_indent();
   emit_line("switch ((pc | 0) / %d | 0) {", CHUNKED_FUNC_SIZE);
@@ -172,13 +164,14 @@ void target_asmjs(Module* module) {
   emit_line("return main;");
   emit_line("};"); /* var mod = function() */
   emit_line("return function(getchar, putchar) {");
-  emit_line("return mod((0,eval)('this'), {getchar: getchar, putchar: putchar}, new ArrayBuffer(1 << 26))();");
+  emit_line("var heap = new ArrayBuffer(1 << 26);");
+  emit_js_data_init(module->data, "new Int32Array(heap)");
+  emit_line("return mod((0,eval)('this'), {getchar: getchar, putchar: putchar}, heap)();");
   emit_line("};"); /* function(getchar, putchar) */
   emit_line("}();"); /* var main = function() */
 
   // For nodejs
   emit_line("if (typeof require != 'undefined') {");
-  emit_line(" var sys = require('sys');");
   emit_line(" var input = null;");
   emit_line(" var ip = 0;");
   emit_line(" var getchar = function() {");
@@ -186,9 +179,17 @@ void target_asmjs(Module* module) {
   emit_line("   input = require('fs').readFileSync('/dev/stdin');");
   emit_line("  return input[ip++] | 0;");
   emit_line(" };");
+  emit_line(" var output = [];");
+  emit_line(" var flush = function() {");
+  emit_line("  process.stdout.write(Buffer.from(output));");
+  emit_line("  output = [];");
+  emit_line(" };");
   emit_line(" var putchar = function(c) {");
-  emit_line("  sys.print(String.fromCharCode(c & 255));");
+  emit_line("  output.push(c & 255);");
+  emit_line("  if (output.length >= 65536)");
+  emit_line("   flush();");
   emit_line(" };");
   emit_line(" main(getchar, putchar);");
+  emit_line(" flush();");
   emit_line("}");
 }
@@ -1,5 +1,6 @@
 #include <assert.h>
 #include <stdbool.h>
+#include <stdlib.h>
 
 #include <ir/ir.h>
 #include <target/util.h>
@@ -7,6 +8,9 @@
 typedef struct {
   int mp;
   int loop_ptr;
+  int pc_bits;
+  int npcs;
+  Inst** pc2inst;
   int ifzero_cnt;
   int ifzero_off[4];
   int ifzero_omp[4];
@@ -15,7 +19,7 @@ typedef struct {
 static BFGen bf;
 
 static const int BF_RUNNING = 0;
-static const int BF_PC = 2;
+// A register jump leaves its destination here.
 static const int BF_NPC = 8;
 static const int BF_A = 14;
 static const int BF_B = 20;
@@ -23,7 +27,6 @@ static const int BF_C = 26;
 static const int BF_D = 32;
 static const int BF_BP = 38;
 static const int BF_SP = 44;
-static const int BF_OP = 50;
 
 static const int BF_DBG = 58;
 
@@ -32,13 +35,25 @@ static const int BF_WRK = 60;
 static const int BF_LOAD_REQ = 67;
 static const int BF_STORE_REQ = 68;
 
-static const int BF_MEM = 70;
-static const int BF_MEM_V = 1;
-static const int BF_MEM_A = 4;
-static const int BF_MEM_WRK = 7;
-static const int BF_MEM_USE = 13;
-#define BF_MEM_CTL_LEN 16
-static const int BF_MEM_BLK_LEN = (256*3) + BF_MEM_CTL_LEN;
+// The pc is kept in binary, one cell per bit. Each bit has three
+// cells: the current pc, the next pc, and a flag for if/else.
+static const int BF_PC_BITS = 74;
+#define BF_PC_MAX_BITS 24
+
+// Memory words live in 4-cell slots from BF_MEM: a scratch cell and
+// the three bytes of the word. Addresses below 2^23 use the even
+// slots and the others use the odd slots counted down from the top,
+// so that both the data and the stack stay near BF_MEM.
+static const int BF_MEM = 146;
+#define BF_MEM_SLOT 4
+
+// Cells carried while walking to a word, one in the scratch cell of
+// each slot.
+typedef enum {
+  BF_MEM_X, BF_MEM_T, BF_MEM_R, BF_MEM_G,
+  BF_MEM_AL, BF_MEM_AM, BF_MEM_AH,
+  BF_MEM_VH, BF_MEM_VM, BF_MEM_VL
+} BFMemCell;
 
 static void bf_emit(const char* s) {
   fputs(s, stdout);
@@ -111,12 +126,10 @@ static void bf_move_word2(int from, int to, int to2) {
   bf_move2(from+1, to+1, to2+1);
 }
 
-#if 0
 static void bf_copy(int from, int to, int wrk) {
   bf_move2(from, to, wrk);
   bf_move(wrk, from);
 }
-#endif
 
 static void bf_copy_word(int from, int to, int wrk) {
   bf_move_word2(from, to, wrk);
@@ -167,6 +180,37 @@ static int bf_regpos(int r) {
   }
 }
 
+static int bf_pc_bit(int i) {
+  return BF_PC_BITS + i * 3;
+}
+
+static int bf_npc_bit(int i) {
+  return BF_PC_BITS + i * 3 + 1;
+}
+
+static int bf_pc_flag(int i) {
+  return BF_PC_BITS + i * 3 + 2;
+}
+
+// Turns the next pc bits from `from` into `to`. Both are known at
+// compile time, so only the differing bits are touched.
+static void bf_change_npc(int from, int to) {
+  for (int i = 0; i < bf.pc_bits; i++) {
+    int d = (to >> i) % 2 - (from >> i) % 2;
+    if (d)
+      bf_add(bf_npc_bit(i), d);
+  }
+}
+
+static int bf_mem(BFMemCell c) {
+  return c * BF_MEM_SLOT;
+}
+
+static int bf_mem_word(int addr) {
+  int slot = addr < (1 << 23) ? addr * 2 : (UINT_MAX - addr) * 2 + 1;
+  return BF_MEM + slot * BF_MEM_SLOT + 2;
+}
+
 static void bf_dbg(const char* s) {
   for (; *s; s++) {
     bf_clear(BF_DBG);
@@ -205,10 +249,7 @@ static void bf_init_state(Data* data) {
   bf_magic_comment("push:InitData");
   for (int mp = 0; data; data = data->next, mp++) {
     if (data->v) {
-      int hi = mp / 256;
-      int lo = mp % 256;
-      int ptr = BF_MEM + BF_MEM_BLK_LEN * hi + BF_MEM_CTL_LEN + lo * 3;
-      bf_add_word(ptr, data->v);
+      bf_add_word(bf_mem_word(mp), data->v);
     }
   }
   bf_magic_comment("pop:InitData");
@@ -444,6 +485,19 @@ static void bf_emit_cmp(Inst* inst) {
   }
 }
 
+static void bf_emit_mem_addr(Value* v) {
+  if (v->type == REG) {
+    int src = bf_regpos(v->reg);
+    bf_copy(src - 1, BF_MEM + bf_mem(BF_MEM_AH), BF_WRK);
+    bf_copy(src, BF_MEM + bf_mem(BF_MEM_AM), BF_WRK);
+    bf_copy(src + 1, BF_MEM + bf_mem(BF_MEM_AL), BF_WRK);
+  } else {
+    bf_add(BF_MEM + bf_mem(BF_MEM_AH), v->imm / 65536);
+    bf_add(BF_MEM + bf_mem(BF_MEM_AM), v->imm / 256 % 256);
+    bf_add(BF_MEM + bf_mem(BF_MEM_AL), v->imm % 256);
+  }
+}
+
 static void bf_emit_op(Inst* inst) {
   if (inst->magic_comment) {
     bf_magic_comment(inst->magic_comment);
@@ -477,23 +531,17 @@ static void bf_emit_op(Inst* inst) {
     bf_add(BF_LOAD_REQ, 1);
     if (inst->dst.reg != A)
       error("only \"load a, X\" is supported");
-
-    if (inst->src.type == REG) {
-      bf_copy_word(bf_regpos(inst->src.reg), BF_MEM + BF_MEM_A, BF_WRK);
-    } else {
-      bf_add_word(BF_MEM + BF_MEM_A, inst->src.imm);
-    }
+    bf_emit_mem_addr(&inst->src);
     break;
 
-  case STORE:
+  case STORE: {
     bf_add(BF_STORE_REQ, 1);
-    bf_copy_word(bf_regpos(inst->dst.reg), BF_MEM + BF_MEM_V, BF_WRK);
-    if (inst->src.type == REG) {
-      bf_copy_word(bf_regpos(inst->src.reg), BF_MEM + BF_MEM_A, BF_WRK);
-    } else {
-      bf_add_word(BF_MEM + BF_MEM_A, inst->src.imm);
-    }
+    int src = bf_regpos(inst->dst.reg);
+    for (int i = 0; i < 3; i++)
+      bf_copy(src - 1 + i, BF_MEM + bf_mem(BF_MEM_VH + i), BF_WRK);
+    bf_emit_mem_addr(&inst->src);
     break;
+  }
 
   case EQ:
   case NE:
@@ -550,11 +598,11 @@ static void bf_emit_op(Inst* inst) {
     bf_emit_cmp(inst);
     bf_move_ptr(BF_WRK);
     bf_emit("[[-]");
-    bf_clear_word(BF_NPC);
     if (inst->jmp.type == REG) {
+      bf_change_npc(inst->pc + 1, 0);
       bf_copy_word(bf_regpos(inst->jmp.reg), BF_NPC, BF_WRK);
     } else {
-      bf_add_word(BF_NPC, inst->jmp.imm);
+      bf_change_npc(inst->pc + 1, inst->jmp.imm);
     }
     bf_move_ptr(BF_WRK);
     bf_emit("]");
@@ -566,174 +614,300 @@ static void bf_emit_op(Inst* inst) {
   }
 }
 
-void bf_emit_code(Inst* inst) {
-  bf_comment("fetch pc");
-  bf_move_word2(BF_PC, BF_NPC, BF_OP);
-
-  bf_comment("increment pc");
-  bf_move_ptr(BF_NPC+3);
-  bf_emit("-");
-  bf_move_ptr(BF_NPC+1);
-  bf_emit("+");
-  bf_emit("[>]>+");
-  // if 0
-  bf_emit("[-<<+>>>+]");
-  bf_set_ptr(BF_NPC+3);
-
-  for (int pc_h = 0; pc_h < 256; pc_h++) {
-    printf("\n# pc_h=%d\n", pc_h);
-
-    bf_add(BF_OP-2, -1);
-    bf_move_ptr(BF_OP);
-    bf_emit("[<]<+[-<+");
-    bf_set_ptr(BF_OP-2);
-
-    for (int pc_l = 0; pc_l < 256; pc_l++) {
-      int pc = pc_h * 256 + pc_l;
-      if (!inst)
-        break;
-
-      bf_add(BF_OP+3, -1);
-      bf_move_ptr(BF_OP+1);
-      bf_emit("[>]>+[->+");
-      bf_set_ptr(BF_OP+3);
-
-      printf("\n# pc_l=%d\n", pc_l);
-
-      for (; inst && inst->pc == pc; inst = inst->next) {
-        printf("\n# ");
-        dump_inst_fp(inst, stdout);
-
-        if (0) {
-          bf_emit("@");
-          bf_dbg(format("%d pc=%d\n", inst->op, pc));
-        }
-
-        bf_emit_op(inst);
-      }
+// Adds one to the pc bits from `bit` to `end`.
+static void bf_emit_pc_inc(int bit, int end) {
+  if (bit == end)
+    return;
+  bf_add(bf_pc_flag(bit), 1);
+  bf_move_ptr(bf_pc_bit(bit));
+  bf_emit("[-");
+  bf_add(bf_pc_flag(bit), -1);
+  bf_emit_pc_inc(bit + 1, end);
+  bf_move_ptr(bf_pc_bit(bit));
+  bf_emit("]");
+  bf_move_ptr(bf_pc_flag(bit));
+  bf_emit("[-");
+  bf_add(bf_pc_bit(bit), 1);
+  bf_move_ptr(bf_pc_flag(bit));
+  bf_emit("]");
+}
+
+static void bf_emit_block(int pc) {
+  printf("\n# pc=%d\n", pc);
+  bf_change_npc(0, pc + 1);
+
+  for (Inst* inst = bf.pc2inst[pc]; inst && inst->pc == pc;
+       inst = inst->next) {
+    printf("\n# ");
+    dump_inst_fp(inst, stdout);
 
-      bf_move_ptr(BF_OP+3);
-      bf_emit("]");
-      bf_add(BF_OP+1, -1);
+    if (0) {
+      bf_emit("@");
+      bf_dbg(format("%d pc=%d\n", inst->op, pc));
     }
 
-    bf_move_ptr(BF_OP-2);
-    bf_emit("]");
-    bf_add(BF_OP, -1);
+    bf_emit_op(inst);
   }
-
-  bf_clear_word(BF_OP);
 }
 
-static void bf_emit_mem_load(void) {
-  bf_comment("memory (load)");
+// Emits a binary decision tree over the pc bits below `bit` for the
+// blocks in [lo, lo + 2^bit). Each tested bit is cleared, so a block
+// runs with all pc bits zero and the cost of finding it is
+// logarithmic in the size of the program.
+static void bf_emit_dispatch(int bit, int lo) {
+  if (lo >= bf.npcs)
+    return;
+  if (bit == 0) {
+    bf_emit_block(lo);
+    return;
+  }
 
-  bf_move_ptr(BF_LOAD_REQ);
+  bit--;
+  int mid = lo + (1 << bit);
+  if (mid >= bf.npcs) {
+    bf_emit_dispatch(bit, lo);
+    return;
+  }
+
+  bf_add(bf_pc_flag(bit), 1);
+  bf_move_ptr(bf_pc_bit(bit));
   bf_emit("[-");
-  // bf_magic_comment("push:MemLoad");
+  bf_add(bf_pc_flag(bit), -1);
+  bf_emit_dispatch(bit, mid);
+  bf_move_ptr(bf_pc_bit(bit));
+  bf_emit("]");
 
-  bf_move_ptr(BF_MEM);
-  bf_set_ptr(0);
+  bf_move_ptr(bf_pc_flag(bit));
+  bf_emit("[-");
+  bf_emit_dispatch(bit, lo);
+  bf_move_ptr(bf_pc_flag(bit));
+  bf_emit("]");
+}
 
-  bf_loop_begin(BF_MEM_A-1, '-'); {
-    bf_move_word(BF_MEM_A, BF_MEM_A + BF_MEM_BLK_LEN*256);
-    bf_move_ptr(BF_MEM_A + BF_MEM_BLK_LEN*256);
-    bf_set_ptr(BF_MEM_A);
-    bf_add(BF_MEM_USE+1, 1);
-  }; bf_loop_end();
+void bf_emit_code(Inst* inst) {
+  bf.npcs = 0;
+  for (Inst* p = inst; p; p = p->next)
+    bf.npcs = p->pc + 1;
+  bf.pc2inst = calloc(bf.npcs + 1, sizeof(Inst*));
+  for (Inst* p = inst; p; p = p->next) {
+    if (!bf.pc2inst[p->pc])
+      bf.pc2inst[p->pc] = p;
+  }
 
-  bf_loop_begin(BF_MEM_A, '-'); {
-    bf_move_word(BF_MEM_A, BF_MEM_A + BF_MEM_BLK_LEN);
-    bf_move_ptr(BF_MEM_A + BF_MEM_BLK_LEN);
-    bf_set_ptr(BF_MEM_A);
-    bf_add(BF_MEM_USE, 1);
-  }; bf_loop_end();
+  // The last block may fall through to bf.npcs.
+  for (bf.pc_bits = 1; (1 << bf.pc_bits) <= bf.npcs; bf.pc_bits++) {}
+  if (bf.pc_bits > BF_PC_MAX_BITS)
+    error("too many pcs: %d", bf.npcs);
 
-  for (int al = 0; al < 256; al++) {
-    bf_move_ptr(BF_MEM_A + 1);
-    bf_ifzero_begin(1); {
-      bf_copy_word(BF_MEM_CTL_LEN + al * 3, BF_MEM_V, BF_MEM_WRK + 2);
-    }; bf_ifzero_end();
-    bf_add(BF_MEM_A + 1, -1);
-  }
-  bf_clear(BF_MEM_A + 1);
+  bf_comment("dispatch pc");
+  bf_emit_dispatch(bf.pc_bits, 0);
+}
 
-  bf_loop_begin(BF_MEM_USE, '-'); {
-    bf_move_ptr(BF_MEM_V);
-    bf_set_ptr(BF_MEM_V + BF_MEM_BLK_LEN);
-    bf_move_word(BF_MEM_V + BF_MEM_BLK_LEN, BF_MEM_V);
-  }; bf_loop_end();
+static void bf_emit_next_pc(void) {
+  bf_comment("next pc");
+  for (int i = 0; i < bf.pc_bits; i++)
+    bf_move(bf_npc_bit(i), bf_pc_bit(i));
 
-  bf_loop_begin(BF_MEM_USE+1, '-'); {
-    bf_move_ptr(BF_MEM_V);
-    bf_set_ptr(BF_MEM_V + BF_MEM_BLK_LEN * 256);
-    bf_move_word(BF_MEM_V + BF_MEM_BLK_LEN * 256, BF_MEM_V);
-  }; bf_loop_end();
+  // Convert the destination of a register jump to binary, byte by
+  // byte. Nothing runs unless the jump was taken.
+  for (int i = 0; i < 3 && i * 8 < bf.pc_bits; i++) {
+    int end = i * 8 + 8;
+    if (end > bf.pc_bits)
+      end = bf.pc_bits;
+    bf_loop_begin(BF_NPC + 1 - i, '-'); {
+      bf_emit_pc_inc(i * 8, end);
+    }; bf_loop_end();
+  }
+}
 
-  bf_move_ptr(0);
-  bf_set_ptr(BF_MEM);
-  bf_clear_word(BF_A);
-  bf_move_word(BF_MEM + BF_MEM_V, BF_A);
+// Moves the carried cells in `live` by `slots` slots. The frame
+// moves with them.
+static void bf_mem_hop(int slots, int live) {
+  int d = slots * BF_MEM_SLOT;
+  for (int i = 0; i <= BF_MEM_VL; i++) {
+    // Move the farthest cell first, as the ranges may overlap.
+    int c = slots > 0 ? BF_MEM_VL - i : i;
+    if (live & (1 << c))
+      bf_move(bf_mem(c), bf_mem(c) + d);
+  }
+  bf_set_ptr(bf.mp - d);
+}
 
-  bf_move_ptr(BF_LOAD_REQ);
-  // bf_magic_comment("pop:MemLoad");
+// Hops 8192 slots at a time while `src` is nonzero, subtracting `step`
+// from it each time and carrying `n` in T as a repeat count.
+static void bf_mem_hop_while(BFMemCell src, int step, int n,
+                             int dir, int live) {
+  live |= 1 << src;
+  bf_move_ptr(bf_mem(src));
+  bf_emit("[");
+  bf_add(bf_mem(src), -step);
+  bf_add(bf_mem(BF_MEM_T), n);
+  bf_move_ptr(bf_mem(BF_MEM_T));
+  bf_emit("[-");
+  bf_mem_hop(dir * 8192, live | (1 << BF_MEM_T));
+  bf_move_ptr(bf_mem(BF_MEM_T));
+  bf_emit("]");
+  bf_move_ptr(bf_mem(src));
   bf_emit("]");
 }
 
-static void bf_emit_mem_store(void) {
-  bf_comment("memory (store)");
+// Opens a block which runs if bit `k` of `src` is set, and clears the
+// bit. The bits below `k` must be clear: multiplying by 2^(7-k) then
+// leaves 128 or 0, which costs a single loop in bfopt. Returns the
+// cell to close the block on.
+static int bf_mem_bit_begin(BFMemCell src, int k) {
+  if (k == 7) {
+    bf_move_ptr(bf_mem(src));
+    bf_emit("[[-]");
+    return bf_mem(src);
+  }
 
-  bf_move_ptr(BF_STORE_REQ);
+  int t = bf_mem(BF_MEM_T);
+  int r = bf_mem(BF_MEM_R);
+  bf_move_ptr(bf_mem(src));
   bf_emit("[-");
-  // bf_magic_comment("push:MemStore");
+  bf_add(t, 1 << (7 - k));
+  bf_add(r, 1);
+  bf_move_ptr(bf_mem(src));
+  bf_emit("]");
+  bf_move(r, bf_mem(src));
+
+  bf_move_ptr(t);
+  bf_emit("[[-]");
+  bf_add(bf_mem(src), -(1 << k));
+  return t;
+}
+
+static void bf_mem_bit_end(int ptr) {
+  bf_move_ptr(ptr);
+  bf_emit("]");
+}
+
+// Hops over the slots selected by bits 0 to n-1 of `src`, one hop
+// per set bit. The remaining bits are left in `src`.
+static void bf_mem_walk_bits(BFMemCell src, int n, int unit,
+                             int dir, int live) {
+  live |= 1 << src;
+  for (int k = 0; k < n; k++) {
+    int ptr = bf_mem_bit_begin(src, k);
+    bf_mem_hop(dir * (unit << k), k == 7 ? live & ~(1 << src) : live);
+    bf_mem_bit_end(ptr);
+  }
+}
+
+// Walks the slots for the address byte `byte`, whose value is in
+// `src`. The low byte selects among
+// 256 pairs of slots with a hop per set bit, and the middle one does
+// the same for the low nibble. Longer hops would bloat the code, so
+// the high nibble of the middle byte and the high byte count hops
+// of 8192 slots instead.
+static void bf_mem_walk_byte(BFMemCell src, BFMemCell byte,
+                             int dir, int live) {
+  bf_move_ptr(bf_mem(src));
+  bf_emit("[");
+  if (byte == BF_MEM_AL) {
+    bf_mem_walk_bits(src, 8, 2, dir, live);
+  } else if (byte == BF_MEM_AM) {
+    bf_mem_walk_bits(src, 4, 512, dir, live);
+    bf_mem_hop_while(src, 16, 1, dir, live);
+  } else {
+    bf_mem_hop_while(src, 1, 16, dir, live);
+  }
+  bf_move_ptr(bf_mem(src));
+  bf_emit("]");
+}
+
+static void bf_mem_copy(BFMemCell from, BFMemCell to) {
+  bf_copy(bf_mem(from), bf_mem(to), bf_mem(BF_MEM_R));
+}
+
+// Walks from BF_MEM to the slot of the address in AH/AM/AL, accesses
+// the word, and walks back. Each address byte is walked with a copy
+// in X on the way there and consumed on the way back. G remembers
+// whether the address was complemented to count from the top.
+static void bf_emit_mem_access(bool is_store) {
+  int v = (1 << BF_MEM_VH) | (1 << BF_MEM_VM) | (1 << BF_MEM_VL);
+  int live = ((1 << BF_MEM_G) | (1 << BF_MEM_AL) | (1 << BF_MEM_AM) |
+              (1 << BF_MEM_AH));
 
   bf_move_ptr(BF_MEM);
   bf_set_ptr(0);
 
-  bf_loop_begin(BF_MEM_A-1, '-'); {
-    bf_move_word(BF_MEM_V, BF_MEM_V + BF_MEM_BLK_LEN*256);
-    bf_move_word(BF_MEM_A, BF_MEM_A + BF_MEM_BLK_LEN*256);
-    bf_move_ptr(BF_MEM_A + BF_MEM_BLK_LEN*256);
-    bf_set_ptr(BF_MEM_A);
-    bf_add(BF_MEM_USE+1, 1);
-  }; bf_loop_end();
+  bf_mem_copy(BF_MEM_AH, BF_MEM_X);
+  bf_move_ptr(bf_mem(BF_MEM_X));
+  bf_emit("[");
+  for (int k = 0; k < 7; k++)
+    bf_mem_bit_end(bf_mem_bit_begin(BF_MEM_X, k));
+  int ptr = bf_mem_bit_begin(BF_MEM_X, 7); {
+    bf_add(bf_mem(BF_MEM_G), 1);
+    for (int c = BF_MEM_AL; c <= BF_MEM_AH; c++) {
+      bf_move_neg(bf_mem(c), bf_mem(BF_MEM_R));
+      bf_move(bf_mem(BF_MEM_R), bf_mem(c));
+      bf_add(bf_mem(c), -1);
+    }
+    bf_mem_hop(1, live | (is_store ? v : 0));
+  }; bf_mem_bit_end(ptr);
+  bf_move_ptr(bf_mem(BF_MEM_X));
+  bf_emit("]");
 
-  bf_loop_begin(BF_MEM_A, '-'); {
-    bf_move_word(BF_MEM_V, BF_MEM_V + BF_MEM_BLK_LEN);
-    bf_move_word(BF_MEM_A, BF_MEM_A + BF_MEM_BLK_LEN);
-    bf_move_ptr(BF_MEM_A + BF_MEM_BLK_LEN);
-    bf_set_ptr(BF_MEM_A);
-    bf_add(BF_MEM_USE, 1);
-  }; bf_loop_end();
+  for (int c = BF_MEM_AL; c <= BF_MEM_AH; c++) {
+    bf_mem_copy(c, BF_MEM_X);
+    bf_mem_walk_byte(BF_MEM_X, c, 1, live | (is_store ? v : 0));
+  }
 
-  // VH VL 0 AL 1
-  for (int al = 0; al < 256; al++) {
-    bf_move_ptr(BF_MEM_A + 1);
-    bf_ifzero_begin(1); {
-      bf_clear_word(BF_MEM_CTL_LEN + al * 3);
-      bf_move_word(BF_MEM_V, BF_MEM_CTL_LEN + al * 3);
-    }; bf_ifzero_end();
-    bf_add(BF_MEM_A + 1, -1);
+  for (int i = 0; i < 3; i++) {
+    int c = bf_mem(BF_MEM_VH + i);
+    if (is_store) {
+      bf_clear(1 + i);
+      bf_move(c, 1 + i);
+    } else {
+      bf_copy(1 + i, c, bf_mem(BF_MEM_R));
+    }
   }
-  bf_clear(BF_MEM_A + 1);
 
-  bf_move_ptr(BF_MEM_USE);
-  bf_emit("[-");
-  for (int i = 0; i < BF_MEM_BLK_LEN; i++)
-    putchar('<');
-  bf_emit("]");
+  for (int c = BF_MEM_AH; c >= BF_MEM_AL; c--) {
+    bf_mem_walk_byte(c, c, -1, live | (is_store ? 0 : v));
+    live &= ~(1 << c);
+  }
 
-  bf_move_ptr(BF_MEM_USE+1);
+  bf_move_ptr(bf_mem(BF_MEM_G));
   bf_emit("[-");
-  for (int i = 0; i < BF_MEM_BLK_LEN*256; i++)
-    putchar('<');
+  bf_mem_hop(-1, is_store ? 0 : v);
+  bf_move_ptr(bf_mem(BF_MEM_G));
   bf_emit("]");
 
   bf_move_ptr(0);
   bf_set_ptr(BF_MEM);
+}
+
+static void bf_emit_mem_load(void) {
+  bf_comment("memory (load)");
+
+  bf_move_ptr(BF_LOAD_REQ);
+  bf_emit("[-");
+  bf_magic_comment("push:MemLoad");
+
+  bf_emit_mem_access(false);
+  bf_clear_word(BF_A);
+  for (int i = 0; i < 3; i++)
+    bf_move(BF_MEM + bf_mem(BF_MEM_VH + i), BF_A - 1 + i);
+
+  bf_move_ptr(BF_LOAD_REQ);
+  bf_magic_comment("pop:MemLoad");
+  bf_emit("]");
+}
+
+static void bf_emit_mem_store(void) {
+  bf_comment("memory (store)");
+
+  bf_move_ptr(BF_STORE_REQ);
+  bf_emit("[-");
+  bf_magic_comment("push:MemStore");
+
+  bf_emit_mem_access(true);
 
   bf_move_ptr(BF_STORE_REQ);
-  // bf_magic_comment("pop:MemStore");
+  bf_magic_comment("pop:MemStore");
   bf_emit("]");
 }
 
@@ -747,7 +921,7 @@ void target_bf(Module* module) {
   bf_emit_code(module->text);
   bf_emit_mem_load();
   bf_emit_mem_store();
-  bf_move_word(BF_NPC, BF_PC);
+  bf_emit_next_pc();
 
   bf_comment("epilogue");
   bf_move_ptr(BF_RUNNING);
@@ -1,14 +1,67 @@
+#include <ir/func.h>
 #include <ir/ir.h>
 #include <target/util.h>
 
+// With 32-bit words, unsigned int wraps by itself and the memory is
+// reserved with mmap as it spans 2^32 words.
+static int c_word_bits;
+
 static void c_init_state(void) {
   emit_line("#include <stdio.h>");
   emit_line("#include <stdlib.h>");
+  emit_line("#include <string.h>");
+  if (c_word_bits == 32)
+    emit_line("#include <sys/mman.h>");
+
+  if (c_word_bits == 32)
+    emit_line("unsigned int* mem;");
+  else
+    emit_line("unsigned int mem[1<<24];");
+}
 
-  for (int i = 0; i < 7; i++) {
+static void c_emit_regs(void) {
+  for (int i = 0; i < num_reg_names; i++) {
     emit_line("unsigned int %s;", reg_names[i]);
   }
-  emit_line("unsigned int mem[1<<24];");
+}
+
+// The data segment up to its last nonzero word is a table which is
+// copied into mem at startup. One statement per word would make big
+// programs slow to compile.
+static int c_emit_data_table(Data* data) {
+  int size = 0;
+  int mp = 0;
+  for (Data* d = data; d; d = d->next) {
+    mp++;
+    if (d->v)
+      size = mp;
+  }
+  if (!size)
+    return 0;
+
+  emit_line("");
+  emit_line("static const unsigned int data[%d] = {", size);
+  char buf[100];
+  int len = 0;
+  for (mp = 0; mp < size; data = data->next, mp++) {
+    len += sprintf(buf + len, "%u,", (unsigned int)data->v);
+    if (len > 70 || mp == size - 1) {
+      emit_line(" %s", buf);
+      len = 0;
+    }
+  }
+  emit_line("};");
+  return size;
+}
+
+static void c_init_mem(int data_size) {
+  if (c_word_bits == 32) {
+    emit_line("mem = mmap(NULL, (size_t)4 << 32, PROT_READ | PROT_WRITE,");
+    emit_line("           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);");
+    emit_line("if (mem == MAP_FAILED) return 1;");
+  }
+  if (data_size)
+    emit_line("memcpy(mem, data, sizeof(data));");
 }
 
 static void c_emit_func_prologue(int func_id) {
@@ -48,13 +101,15 @@ static void c_emit_inst(Inst* inst) {
     break;
 
   case ADD:
-    emit_line("%s = (%s + %s) & " UINT_MAX_STR ";",
+    emit_line(inst->no_wrap || c_word_bits == 32 ? "%s = %s + %s;" :
+              "%s = (%s + %s) & " UINT_MAX_STR ";",
               reg_names[inst->dst.reg],
               reg_names[inst->dst.reg], src_str(inst));
     break;
 
   case SUB:
-    emit_line("%s = (%s - %s) & " UINT_MAX_STR ";",
+    emit_line(inst->no_wrap || c_word_bits == 32 ? "%s = %s - %s;" :
+              "%s = (%s - %s) & " UINT_MAX_STR ";",
               reg_names[inst->dst.reg],
               reg_names[inst->dst.reg], src_str(inst));
     break;
@@ -93,6 +148,39 @@ static void c_emit_inst(Inst* inst) {
               reg_names[inst->dst.reg], cmp_str(inst, "1"));
     break;
 
+  case MUL:
+  case DIV:
+  case MOD:
+  case AND:
+  case OR:
+  case XOR:
+    emit_line(c_word_bits == 32 ? "%s = %s %s %s;" :
+              "%s = (%s %s %s) & " UINT_MAX_STR ";",
+              reg_names[inst->dst.reg], reg_names[inst->dst.reg],
+              arith_op_str(inst->op), src_str(inst));
+    break;
+
+  case SHL:
+  case SHR:
+    emit_line("%s = %s < %d ? (%s %s %s)%s : 0;",
+              reg_names[inst->dst.reg], src_str(inst), c_word_bits,
+              reg_names[inst->dst.reg], arith_op_str(inst->op),
+              src_str(inst),
+              c_word_bits == 32 ? "" : " & " UINT_MAX_STR);
+    break;
+
+  case MEMCPY:
+    emit_line("memmove(mem + %s, mem + %s, %s * sizeof(*mem));",
+              reg_names[inst->dst.reg], src_str(inst),
+              value_str(&inst->jmp));
+    break;
+
+  case MEMSET:
+    emit_line("for (unsigned int _ = 0; _ < %s; _++) mem[%s + _] = %s;",
+              value_str(&inst->jmp), reg_names[inst->dst.reg],
+              src_str(inst));
+    break;
+
   case JEQ:
   case JNE:
   case JLT:
@@ -110,7 +198,10 @@ static void c_emit_inst(Inst* inst) {
 }
 
 void target_c(Module* module) {
+  c_word_bits = module->word_bits;
+  init_vreg_names(module);
   c_init_state();
+  c_emit_regs();
 
   int num_funcs = emit_chunked_main_loop(module->text,
                                          c_emit_func_prologue,
@@ -118,15 +209,12 @@ void target_c(Module* module) {
                                          c_emit_pc_change,
                                          c_emit_inst);
 
+  int data_size = c_emit_data_table(module->data);
+
+  emit_line("");
   emit_line("int main() {");
   inc_indent();
-
-  Data* data = module->data;
-  for (int mp = 0; data; data = data->next, mp++) {
-    if (data->v) {
-      emit_line("mem[%d] = %d;", mp, data->v);
-    }
-  }
+  c_init_mem(data_size);
 
   emit_line("");
   emit_line("while (1) {");
@@ -145,3 +233,74 @@ void target_c(Module* module) {
   dec_indent();
   emit_line("}");
 }
+
+// Emits one function with a label per pc. Immediate jumps are gotos,
+// register jumps go through a table of the addresses of the labels of
+// address-taken pcs, and registers are locals.
+static void c_goto_emit_inst(Inst* inst) {
+  if (inst->op < JEQ || inst->op > JMP) {
+    c_emit_inst(inst);
+    return;
+  }
+
+  const char* target;
+  if (inst->jmp.type == REG)
+    target = format("*labels[%s]", reg_names[inst->jmp.reg]);
+  else
+    target = format("L%d", inst->jmp.imm);
+  if (inst->op == JMP)
+    emit_line("goto %s;", target);
+  else
+    emit_line("if (%s) goto %s;", cmp_str(inst, "1"), target);
+}
+
+void target_c_goto(Module* module) {
+  c_word_bits = module->word_bits;
+  init_vreg_names(module);
+  c_init_state();
+  int data_size = c_emit_data_table(module->data);
+
+  emit_line("");
+  emit_line("int main() {");
+  inc_indent();
+  for (int i = 0; i < num_reg_names; i++) {
+    // Index 6 is the "pc" of the chunked mode.
+    if (i > SP && i < VREG0)
+      continue;
+    emit_line("unsigned int %s = 0;", reg_names[i]);
+  }
+
+  int num_taken;
+  int* taken = get_addr_taken_pcs(module, &num_taken);
+  if (num_taken) {
+    emit_line("static void* const labels[] = {");
+    for (int i = 0; i < num_taken; i++)
+      emit_line(" [%d] = &&L%d,", taken[i], taken[i]);
+    emit_line("};");
+  } else {
+    emit_line("static void* const labels[1];");
+  }
+
+  c_init_mem(data_size);
+
+  int prev_pc = -1;
+  for (Inst* inst = module->text; inst; inst = inst->next) {
+    if (prev_pc != inst->pc) {
+      emit_line("");
+      dec_indent();
+      emit_line("L%d:", inst->pc);
+      inc_indent();
+      prev_pc = inst->pc;
+    }
+    c_goto_emit_inst(inst);
+  }
+
+  // Labels past the last instruction.
+  emit_line("");
+  dec_indent();
+  emit_line("L%d:", prev_pc + 1);
+  inc_indent();
+  emit_line("return 1;");
+  dec_indent();
+  emit_line("}");
+}
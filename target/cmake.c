@@ -464,6 +464,16 @@ static char const* cmake_op_str(Op op) {
   case LE: return "LE";
   case GE: return "GE";
   case DUMP: return "DUMP";
+  case MUL: return "MUL";
+  case DIV: return "DIV";
+  case MOD: return "MOD";
+  case AND: return "AND";
+  case OR: return "OR";
+  case XOR: return "XOR";
+  case SHL: return "SHL";
+  case SHR: return "SHR";
+  case MEMCPY: return "MEMCPY";
+  case MEMSET: return "MEMSET";
   }
 
   error(format("Unsupported opcode %d", op));
@@ -1,3 +1,4 @@
+#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -10,6 +11,7 @@ void target_asmjs(Module* module);
 void target_bef(Module* module);
 void target_bf(Module* module);
 void target_c(Module* module);
+void target_c_goto(Module* module);
 void target_cl(Module* module);
 void target_cmake(Module* module);
 void target_cpp(Module* module);
@@ -49,8 +51,10 @@ void target_tm(Module* module);
 void target_unl(Module* module);
 void target_vim(Module* module);
 void target_wasm(Module* module);
+void target_wasmbin(Module* module);
 void target_ws(Module* module);
 void target_x86(Module* module);
+void target_x86_64(Module* module);
 
 typedef void (*target_func_t)(Module*);
 
@@ -62,7 +66,20 @@ static target_func_t get_target_func(const char* ext) {
     split_basic_block_by_mem();
     return target_bf;
   }
-  if (!strcmp(ext, "c")) return target_c;
+  if (!strcmp(ext, "c")) {
+    enable_arith_ops();
+    enable_mem_ops();
+    enable_vregs();
+    enable_range_analysis();
+    return target_c;
+  }
+  if (!strcmp(ext, "c_goto")) {
+    enable_arith_ops();
+    enable_mem_ops();
+    enable_vregs();
+    enable_range_analysis();
+    return target_c_goto;
+  }
   if (!strcmp(ext, "cl")) return target_cl;
   if (!strcmp(ext, "cmake")) return target_cmake;
   if (!strcmp(ext, "cpp")) return target_cpp;
@@ -72,24 +89,49 @@ static target_func_t get_target_func(const char* ext) {
   if (!strcmp(ext, "el")) return target_el;
   if (!strcmp(ext, "forth")) return target_forth;
   if (!strcmp(ext, "fs")) return target_fs;
-  if (!strcmp(ext, "go")) return target_go;
+  if (!strcmp(ext, "go")) {
+    enable_arith_ops();
+    enable_vregs();
+    enable_range_analysis();
+    return target_go;
+  }
   if (!strcmp(ext, "hell")) return target_hell;
   if (!strcmp(ext, "hs")) return target_hs;
   if (!strcmp(ext, "i")) return target_i;
   if (!strcmp(ext, "java")) return target_java;
-  if (!strcmp(ext, "js")) return target_js;
+  if (!strcmp(ext, "js")) {
+    enable_arith_ops();
+    enable_mem_ops();
+    enable_range_analysis();
+    return target_js;
+  }
   if (!strcmp(ext, "lua")) return target_lua;
-  if (!strcmp(ext, "ll")) return target_ll;
+  if (!strcmp(ext, "ll")) {
+    enable_arith_ops();
+    enable_mem_ops();
+    enable_vregs();
+    enable_range_analysis();
+    return target_ll;
+  }
   if (!strcmp(ext, "mu")) return target_mu;
   if (!strcmp(ext, "oct")) return target_oct;
   if (!strcmp(ext, "php")) return target_php;
   if (!strcmp(ext, "piet")) return target_piet;
   if (!strcmp(ext, "pietasm")) return target_pietasm;
   if (!strcmp(ext, "pl")) return target_pl;
-  if (!strcmp(ext, "py")) return target_py;
+  if (!strcmp(ext, "py")) {
+    enable_arith_ops();
+    enable_range_analysis();
+    return target_py;
+  }
   if (!strcmp(ext, "ps")) return target_ps;
   if (!strcmp(ext, "rb")) return target_rb;
-  if (!strcmp(ext, "rs")) return target_rs;
+  if (!strcmp(ext, "rs")) {
+    enable_arith_ops();
+    enable_vregs();
+    enable_range_analysis();
+    return target_rs;
+  }
   if (!strcmp(ext, "scala")) return target_scala;
   if (!strcmp(ext, "scm_sr")) return target_scm_sr;
   if (!strcmp(ext, "sed")) return target_sed;
@@ -101,12 +143,46 @@ static target_func_t get_target_func(const char* ext) {
   if (!strcmp(ext, "tm")) return target_tm;
   if (!strcmp(ext, "unl")) return target_unl;
   if (!strcmp(ext, "vim")) return target_vim;
-  if (!strcmp(ext, "wasm")) return target_wasm;
+  if (!strcmp(ext, "wasm")) {
+    enable_arith_ops();
+    enable_mem_ops();
+    enable_vregs();
+    enable_range_analysis();
+    return target_wasm;
+  }
+  if (!strcmp(ext, "wasmbin")) {
+    enable_arith_ops();
+    enable_mem_ops();
+    enable_vregs();
+    enable_range_analysis();
+    return target_wasmbin;
+  }
   if (!strcmp(ext, "ws")) return target_ws;
-  if (!strcmp(ext, "x86")) return target_x86;
+  if (!strcmp(ext, "x86")) {
+    enable_arith_ops();
+    enable_mem_ops();
+    enable_range_analysis();
+    return target_x86;
+  }
+  if (!strcmp(ext, "x86_64")) {
+    enable_arith_ops();
+    enable_mem_ops();
+    enable_range_analysis();
+    return target_x86_64;
+  }
   error("unknown flag: %s", ext);
 }
 
+// Targets run with 24-bit words unless they can hold wider words and
+// address 2^bits words of memory.
+static bool target_supports_word_bits(const char* ext, int bits) {
+  if (bits == 24)
+    return true;
+  if (bits == 32)
+    return !strcmp(ext, "c") || !strcmp(ext, "c_goto");
+  return false;
+}
+
 int main(int argc, char* argv[]) {
 #if defined(NOFILE) || defined(__eir__)
   char buf[32];
@@ -122,24 +198,34 @@ int main(int argc, char* argv[]) {
   Module* module = load_eir(stdin);
 #else
   target_func_t target_func = NULL;
-  const char* filename = NULL;
+  const char* target = NULL;
+  int word_bits = 24;
+  const char** filenames = calloc(argc, sizeof(char*));
+  int num_files = 0;
   for (int i = 1; i < argc; i++) {
     const char* arg = argv[i];
-    if (arg[0] == '-') {
-      target_func = get_target_func(arg + 1);
+    if (arg[0] == '-' && arg[1] == 'm' && isdigit(arg[2])) {
+      word_bits = atoi(arg + 2);
+    } else if (arg[0] == '-') {
+      target = arg + 1;
+      target_func = get_target_func(target);
     } else {
-      filename = arg;
+      filenames[num_files++] = arg;
     }
   }
 
-  if (!filename) {
+  if (!num_files) {
     error("no input file");
   }
   if (!target_func) {
     error("no target");
   }
+  if (!target_supports_word_bits(target, word_bits)) {
+    error("%s does not support %d-bit words", target, word_bits);
+  }
+  set_word_bits(word_bits);
 
-  Module* module = load_eir_from_file(filename);
+  Module* module = load_eir_from_files(num_files, filenames);
 #endif
   target_func(module);
 }
@@ -10,13 +10,15 @@ static void go_emit_inst(Inst* inst) {
     break;
 
   case ADD:
-    emit_line("%s = (%s + %s) & " UINT_MAX_STR,
+    emit_line(inst->no_wrap ? "%s = %s + %s" :
+              "%s = (%s + %s) & " UINT_MAX_STR,
               reg_names[inst->dst.reg],
               reg_names[inst->dst.reg], src_str(inst));
     break;
 
   case SUB:
-    emit_line("%s = (%s - %s) & " UINT_MAX_STR,
+    emit_line(inst->no_wrap ? "%s = %s - %s" :
+              "%s = (%s - %s) & " UINT_MAX_STR,
               reg_names[inst->dst.reg],
               reg_names[inst->dst.reg], src_str(inst));
     break;
@@ -55,6 +57,25 @@ static void go_emit_inst(Inst* inst) {
               cmp_str(inst, "true"), reg_names[inst->dst.reg], reg_names[inst->dst.reg]);
     break;
 
+  case MUL:
+  case DIV:
+  case MOD:
+  case AND:
+  case OR:
+  case XOR:
+    emit_line("%s = (%s %s %s) & " UINT_MAX_STR,
+              reg_names[inst->dst.reg], reg_names[inst->dst.reg],
+              arith_op_str(inst->op), src_str(inst));
+    break;
+
+  case SHL:
+  case SHR:
+    // Go shifts by the width or more result in zero.
+    emit_line("%s = (%s %s uint(%s)) & " UINT_MAX_STR,
+              reg_names[inst->dst.reg], reg_names[inst->dst.reg],
+              arith_op_str(inst->op), src_str(inst));
+    break;
+
   case JEQ:
   case JNE:
   case JLT:
@@ -80,13 +101,14 @@ static void go_init_state(Data* data) {
 }
 
 void target_go(Module* module) {
+  init_vreg_names(module);
   emit_line("package main");
   emit_line("import \"os\"");
 
   emit_line("func main() {");
   inc_indent();
 
-  for (int i = 0; i < 7; i++) {
+  for (int i = 0; i < num_reg_names; i++) {
     emit_line("var %s " GO_INT_TYPE, reg_names[i]);
     emit_line("_ = %s", reg_names[i]);
   }
@@ -1,5 +1,6 @@
 #include <stdarg.h>
 
+#include <ir/func.h>
 #include <ir/ir.h>
 #include <target/util.h>
 
@@ -370,14 +371,30 @@ static void i_emit_inst(Inst* inst, int add_fn, int reg_jmp, int* label) {
   }
 }
 
-static void i_emit_reg_jmp_table(uint pc, uint bit, uint max_pc, int* label) {
-  if (bit > max_pc) {
-    if (pc >= max_pc || pc == 0) {
-      i_emit_line("ERR %d", pc);
+// Dispatches on the bits of :11 from the lowest one. pcs[lo, hi) are
+// the address-taken pcs whose lower bits match |pc|, so a subtree
+// ends as soon as it has at most one candidate.
+static void i_emit_reg_jmp_table(int* pcs, int lo, int hi,
+                                 uint pc, uint bit, int* label) {
+  if (lo == hi) {
+    i_emit_line("ERR %d", pc);
+    return;
+  }
+  if (lo + 1 == hi) {
+    i_emit_line("(%d) NEXT", pcs[lo]);
+    return;
+  }
+
+  // Move the pcs which have |bit| to the end.
+  int mid = hi;
+  for (int i = lo; i < mid;) {
+    if (pcs[i] & bit) {
+      int t = pcs[i];
+      pcs[i] = pcs[--mid];
+      pcs[mid] = t;
     } else {
-      i_emit_line("(%d) NEXT", pc);
+      i++;
     }
-    return;
   }
 
   i_emit_line(":8 <- :11 ~ #%d", bit);
@@ -387,13 +404,13 @@ static void i_emit_reg_jmp_table(uint pc, uint bit, uint max_pc, int* label) {
   int l2 = ++*label;
   i_emit_line("(%d) NEXT", l1);
 
-  i_emit_reg_jmp_table(pc + bit, bit * 2, max_pc, label);
+  i_emit_reg_jmp_table(pcs, mid, hi, pc + bit, bit * 2, label);
 
   emit_line("(%d) DO RESUME :8", l2);
   emit_line("(%d) DO (%d) NEXT", l1, l2);
   i_emit_line("FORGET #1");
 
-  i_emit_reg_jmp_table(pc, bit * 2, max_pc, label);
+  i_emit_reg_jmp_table(pcs, lo, mid, pc, bit * 2, label);
 }
 
 void target_i(Module* module) {
@@ -430,6 +447,8 @@ void target_i(Module* module) {
 
   emit_line("");
   i_emit_line("NOTe reg jmp");
+  int num_taken;
+  int* taken = get_addr_taken_pcs(module, &num_taken);
   emit_line("(%d) DO FORGET #1", reg_jmp);
-  i_emit_reg_jmp_table(0, 1, reg_jmp, &label);
+  i_emit_reg_jmp_table(taken, 0, num_taken, 0, 1, &label);
 }
@@ -1,48 +1,97 @@
+#include <ir/func.h>
 #include <ir/ir.h>
 #include <target/util.h>
 
+#include <stdlib.h>
+
+// Each chunk of CHUNKED_FUNC_SIZE pcs becomes a function which keeps
+// registers in `let` locals and runs the basic blocks of the chunk as
+// structured code, following "Beyond Relooper" by Norman Ramsey: a
+// loop header becomes a labeled `while (true)`, and a block with more
+// than one forward predecessor is placed after a labeled block which
+// its predecessors break out of. Jumps which leave the chunk set pc and
+// break out of the function to the dispatch loop in main.
+//
+// A chunk may be entered at several pcs, which a virtual node switching
+// on pc dispatches to. An irreducible loop, e.g., one containing the
+// return site of a call, gets a dispatch node of its own, which becomes
+// the only way into the loop. A chunk which needs too many of them is
+// emitted as a single loop over a switch.
+
+#define JS_EXIT -1
+#define JS_MAX_DISPATCHES 64
+
+typedef struct {
+  // -1 for dispatch nodes, which switch on pc.
+  int pc;
+  // Outgoing edges are js_edges[first_edge, first_edge + num_edges).
+  int first_edge;
+  int num_edges;
+  // -1 if unreachable from the entry node.
+  int rpo;
+  int idom;
+  bool is_loop;
+  bool is_merge;
+  // Dominator tree children which are merge nodes, in descending
+  // reverse postorder, linked through next_merge.
+  int merge_children;
+  int next_merge;
+} JsNode;
+
+typedef struct {
+  int from;
+  // A node, or JS_EXIT to leave the chunk.
+  int to;
+  // The pc the edge goes to, or -1 for register jumps.
+  int pc;
+  Inst* jmp;
+} JsEdge;
+
+static Inst** js_first;
+static bool* js_entries;
+static int js_num_pcs;
+
+// The chunk being emitted covers pcs in [js_base_pc, js_end_pc).
+// Node 0 is the entry and node i + 1 is pc js_base_pc + i.
+static int js_base_pc;
+static int js_end_pc;
+
+static JsNode* js_nodes;
+static int js_num_nodes;
+static int js_max_nodes;
+static JsEdge* js_edges;
+static int js_num_edges;
+static int js_max_edges;
+
+// Scratch arrays for the analyses.
+static int* js_order;
+static int js_num_order;
+static int* js_stack;
+static int* js_cursor;
+static int* js_pred_start;
+static int* js_preds;
+static bool* js_fwd;
+static bool* js_bwd;
+static bool* js_is_entry;
+static bool* js_seen;
+static int* js_ys;
+static int js_num_ys;
+
 static void init_state_js(Data* data) {
   emit_line("var main = function(getchar, putchar) {");
 
-  for (int i = 0; i < 7; i++) {
-    emit_line("var %s = 0;", reg_names[i]);
-  }
+  emit_line("var regs = new Int32Array(6);");
+  emit_line("var pc = 0;");
   emit_line("var mem = new Int32Array(1 << 24);");
-  for (int mp = 0; data; data = data->next, mp++) {
-    if (data->v) {
-      emit_line("mem[%d] = %d;", mp, data->v);
-    }
-  }
-}
-
-static void js_emit_func_prologue(int func_id) {
-  emit_line("");
-  emit_line("var func%d = function() {", func_id);
-  inc_indent();
-  emit_line("while (%d <= pc && pc < %d && running) {",
-            func_id * CHUNKED_FUNC_SIZE, (func_id + 1) * CHUNKED_FUNC_SIZE);
-  inc_indent();
-  emit_line("switch (pc) {");
-  emit_line("case -1:  // dummy");
-  inc_indent();
+  emit_js_data_init(data, "mem");
 }
 
-static void js_emit_func_epilogue(void) {
-  dec_indent();
-  emit_line("}");
-  emit_line("pc++;");
-  dec_indent();
-  emit_line("}");
-  dec_indent();
-  emit_line("};");
+static bool js_is_cond_jump(Inst* inst) {
+  return inst->op >= JEQ && inst->op <= JGE;
 }
 
-static void js_emit_pc_change(int pc) {
-  emit_line("break;");
-  emit_line("");
-  dec_indent();
-  emit_line("case %d:", pc);
-  inc_indent();
+static bool js_is_jump(Inst* inst) {
+  return inst->op >= JEQ && inst->op <= JMP;
 }
 
 static void js_emit_inst(Inst* inst) {
@@ -52,13 +101,15 @@ static void js_emit_inst(Inst* inst) {
     break;
 
   case ADD:
-    emit_line("%s = (%s + %s) & " UINT_MAX_STR ";",
+    emit_line(inst->no_wrap ? "%s = %s + %s;" :
+              "%s = (%s + %s) & " UINT_MAX_STR ";",
               reg_names[inst->dst.reg],
               reg_names[inst->dst.reg], src_str(inst));
     break;
 
   case SUB:
-    emit_line("%s = (%s - %s) & " UINT_MAX_STR ";",
+    emit_line(inst->no_wrap ? "%s = %s - %s;" :
+              "%s = (%s - %s) & " UINT_MAX_STR ";",
               reg_names[inst->dst.reg],
               reg_names[inst->dst.reg], src_str(inst));
     break;
@@ -81,7 +132,7 @@ static void js_emit_inst(Inst* inst) {
     break;
 
   case EXIT:
-    emit_line("running = false; break;");
+    emit_line("running = false; return;");
     break;
 
   case DUMP:
@@ -97,15 +148,35 @@ static void js_emit_inst(Inst* inst) {
               reg_names[inst->dst.reg], cmp_str(inst, "true"));
     break;
 
-  case JEQ:
-  case JNE:
-  case JLT:
-  case JGT:
-  case JLE:
-  case JGE:
-  case JMP:
-    emit_line("if (%s) pc = %s - 1;",
-              cmp_str(inst, "true"), value_str(&inst->jmp));
+  case MUL:
+  case DIV:
+  case MOD:
+  case AND:
+  case OR:
+  case XOR:
+    emit_line("%s = (%s %s %s) & " UINT_MAX_STR ";",
+              reg_names[inst->dst.reg], reg_names[inst->dst.reg],
+              arith_op_str(inst->op), src_str(inst));
+    break;
+
+  case SHL:
+  case SHR:
+    emit_line("%s = %s < 24 ? (%s %s %s) & " UINT_MAX_STR " : 0;",
+              reg_names[inst->dst.reg], src_str(inst),
+              reg_names[inst->dst.reg], arith_op_str(inst->op),
+              src_str(inst));
+    break;
+
+  case MEMCPY:
+    emit_line("mem.copyWithin(%s, %s, %s + %s);",
+              reg_names[inst->dst.reg], src_str(inst),
+              src_str(inst), value_str(&inst->jmp));
+    break;
+
+  case MEMSET:
+    emit_line("mem.fill(%s, %s, %s + %s);",
+              src_str(inst), reg_names[inst->dst.reg],
+              reg_names[inst->dst.reg], value_str(&inst->jmp));
     break;
 
   default:
@@ -113,16 +184,457 @@ static void js_emit_inst(Inst* inst) {
   }
 }
 
+// Marks the pcs at which a chunk can be entered from the dispatch loop:
+// the first pc of each chunk, targets of jumps from other chunks, and
+// pcs whose addresses are taken.
+static void js_init_entries(Module* module) {
+  js_num_pcs = 0;
+  for (Inst* inst = module->text; inst; inst = inst->next)
+    js_num_pcs = inst->pc + 1;
+  js_first = calloc(js_num_pcs + 1, sizeof(Inst*));
+  js_entries = calloc(js_num_pcs + 1, sizeof(bool));
+  for (Inst* inst = module->text; inst; inst = inst->next) {
+    if (!js_first[inst->pc])
+      js_first[inst->pc] = inst;
+    if (!js_is_jump(inst) || inst->jmp.type != IMM)
+      continue;
+    int target = inst->jmp.imm;
+    if (target >= 0 && target < js_num_pcs &&
+        target / CHUNKED_FUNC_SIZE != inst->pc / CHUNKED_FUNC_SIZE)
+      js_entries[target] = true;
+  }
+  for (int pc = 0; pc < js_num_pcs; pc += CHUNKED_FUNC_SIZE)
+    js_entries[pc] = true;
+  int num_taken;
+  int* taken = get_addr_taken_pcs(module, &num_taken);
+  for (int i = 0; i < num_taken; i++)
+    js_entries[taken[i]] = true;
+
+  int n = CHUNKED_FUNC_SIZE;
+  js_max_nodes = n + 1 + JS_MAX_DISPATCHES;
+  js_max_edges = 3 * n + 1 + JS_MAX_DISPATCHES * n;
+  js_nodes = calloc(js_max_nodes, sizeof(JsNode));
+  js_edges = calloc(js_max_edges, sizeof(JsEdge));
+  js_order = calloc(js_max_nodes, sizeof(int));
+  js_stack = calloc(js_max_nodes, sizeof(int));
+  js_cursor = calloc(js_max_nodes, sizeof(int));
+  js_pred_start = calloc(js_max_nodes + 1, sizeof(int));
+  js_preds = calloc(js_max_edges, sizeof(int));
+  js_fwd = calloc(js_max_nodes, sizeof(bool));
+  js_bwd = calloc(js_max_nodes, sizeof(bool));
+  js_is_entry = calloc(js_max_nodes, sizeof(bool));
+  js_seen = calloc(n, sizeof(bool));
+  js_ys = calloc(js_max_nodes, sizeof(int));
+}
+
+static int js_new_node(int pc) {
+  JsNode* node = &js_nodes[js_num_nodes];
+  node->pc = pc;
+  node->first_edge = js_num_edges;
+  node->num_edges = 0;
+  return js_num_nodes++;
+}
+
+static void js_add_edge(int from, int to, int pc, Inst* jmp) {
+  JsEdge* edge = &js_edges[js_num_edges++];
+  edge->from = from;
+  edge->to = to;
+  edge->pc = pc;
+  edge->jmp = jmp;
+  js_nodes[from].num_edges++;
+}
+
+// Adds an edge from the node of a pc. All edges inside the chunk go
+// back to the entry node if |flat|.
+static void js_add_pc_edge(int from, int pc, Inst* jmp, bool flat) {
+  int to = JS_EXIT;
+  if (pc >= js_base_pc && pc < js_end_pc)
+    to = flat ? 0 : pc - js_base_pc + 1;
+  js_add_edge(from, to, pc, jmp);
+}
+
+static void js_build_graph(bool flat) {
+  js_num_nodes = 0;
+  js_num_edges = 0;
+  js_new_node(-1);
+  for (int pc = js_base_pc; pc < js_end_pc; pc++) {
+    if (flat || js_entries[pc])
+      js_add_edge(0, pc - js_base_pc + 1, pc, NULL);
+  }
+
+  for (int pc = js_base_pc; pc < js_end_pc; pc++) {
+    int x = js_new_node(pc);
+    Inst* last = NULL;
+    for (Inst* inst = js_first[pc]; inst && inst->pc == pc; inst = inst->next)
+      last = inst;
+    if (last && last->op == EXIT)
+      continue;
+    if (last && js_is_jump(last)) {
+      js_add_pc_edge(x, last->jmp.type == IMM ? last->jmp.imm : -1,
+                     last, flat);
+      if (last->op == JMP)
+        continue;
+    }
+    js_add_pc_edge(x, pc + 1, NULL, flat);
+  }
+}
+
+static bool js_dominates(int a, int b) {
+  while (js_nodes[b].rpo > js_nodes[a].rpo)
+    b = js_nodes[b].idom;
+  return a == b;
+}
+
+static int js_common_dominator(int a, int b) {
+  while (a != b) {
+    while (js_nodes[a].rpo > js_nodes[b].rpo)
+      a = js_nodes[a].idom;
+    while (js_nodes[b].rpo > js_nodes[a].rpo)
+      b = js_nodes[b].idom;
+  }
+  return a;
+}
+
+// Computes the reverse postorder, predecessors, dominators, loop
+// headers, and merge nodes.
+static void js_analyze(void) {
+  int n = js_num_nodes;
+  for (int x = 0; x < n; x++) {
+    JsNode* node = &js_nodes[x];
+    node->rpo = -1;
+    node->idom = -1;
+    node->is_loop = false;
+    node->is_merge = false;
+    node->merge_children = -1;
+    js_cursor[x] = node->first_edge;
+  }
+
+  // Depth first search from the entry. Postorder goes to the end of
+  // js_order first.
+  int sp = 0;
+  int num_post = 0;
+  js_stack[sp++] = 0;
+  js_nodes[0].rpo = 0;
+  while (sp) {
+    int x = js_stack[sp - 1];
+    JsNode* node = &js_nodes[x];
+    if (js_cursor[x] < node->first_edge + node->num_edges) {
+      int to = js_edges[js_cursor[x]++].to;
+      if (to != JS_EXIT && js_nodes[to].rpo < 0) {
+        js_nodes[to].rpo = 0;
+        js_stack[sp++] = to;
+      }
+      continue;
+    }
+    js_stack[n - 1 - num_post++] = x;
+    sp--;
+  }
+  js_num_order = num_post;
+  for (int i = 0; i < num_post; i++) {
+    js_order[i] = js_stack[n - num_post + i];
+    js_nodes[js_order[i]].rpo = i;
+  }
+
+  for (int x = 0; x <= n; x++)
+    js_pred_start[x] = 0;
+  for (int i = 0; i < js_num_edges; i++) {
+    JsEdge* edge = &js_edges[i];
+    if (edge->to != JS_EXIT && js_nodes[edge->from].rpo >= 0)
+      js_pred_start[edge->to + 1]++;
+  }
+  for (int x = 0; x < n; x++)
+    js_pred_start[x + 1] += js_pred_start[x];
+  for (int x = 0; x < n; x++)
+    js_cursor[x] = js_pred_start[x];
+  for (int i = 0; i < js_num_edges; i++) {
+    JsEdge* edge = &js_edges[i];
+    if (edge->to != JS_EXIT && js_nodes[edge->from].rpo >= 0)
+      js_preds[js_cursor[edge->to]++] = edge->from;
+  }
+
+  // "A Simple, Fast Dominance Algorithm" by Cooper, Harvey, and Kennedy.
+  js_nodes[0].idom = 0;
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (int i = 1; i < js_num_order; i++) {
+      int x = js_order[i];
+      int idom = -1;
+      for (int j = js_pred_start[x]; j < js_pred_start[x + 1]; j++) {
+        int p = js_preds[j];
+        if (js_nodes[p].idom < 0)
+          continue;
+        idom = idom < 0 ? p : js_common_dominator(p, idom);
+      }
+      if (js_nodes[x].idom != idom) {
+        js_nodes[x].idom = idom;
+        changed = true;
+      }
+    }
+  }
+
+  for (int i = 0; i < js_num_order; i++) {
+    int x = js_order[i];
+    JsNode* node = &js_nodes[x];
+    int num_forward = 0;
+    for (int j = js_pred_start[x]; j < js_pred_start[x + 1]; j++) {
+      if (js_nodes[js_preds[j]].rpo >= i)
+        node->is_loop = true;
+      else
+        num_forward++;
+    }
+    node->is_merge = num_forward >= 2;
+    if (i && node->is_merge) {
+      JsNode* parent = &js_nodes[node->idom];
+      node->next_merge = parent->merge_children;
+      parent->merge_children = x;
+    }
+  }
+}
+
+// Marks the nodes strictly dominated by |d| which can be reached from
+// |h| in |fwd|, or which can reach |h| in |bwd|.
+static void js_mark_region(int d, int h, bool* marks, bool forward) {
+  for (int x = 0; x < js_num_nodes; x++)
+    marks[x] = false;
+  int sp = 0;
+  js_stack[sp++] = h;
+  marks[h] = true;
+  while (sp) {
+    int x = js_stack[--sp];
+    JsNode* node = &js_nodes[x];
+    int i = forward ? node->first_edge : js_pred_start[x];
+    int end = forward ? i + node->num_edges : js_pred_start[x + 1];
+    for (; i < end; i++) {
+      int y = forward ? js_edges[i].to : js_preds[i];
+      if (y == JS_EXIT || y == d || marks[y] || js_nodes[y].rpo < 0 ||
+          !js_dominates(d, y))
+        continue;
+      marks[y] = true;
+      js_stack[sp++] = y;
+    }
+  }
+}
+
+// Finds the loop containing the retreating edge u -> h which has more
+// than one way in, and routes all edges into it through a new dispatch
+// node. Returns false if there is no room for the node.
+static bool js_add_dispatch(int h, int u) {
+  int d = js_common_dominator(h, u);
+  for (;;) {
+    js_mark_region(d, h, js_fwd, true);
+    js_mark_region(d, h, js_bwd, false);
+    int num_entries = 0;
+    int entry = -1;
+    for (int i = 0; i < js_num_order; i++) {
+      int x = js_order[i];
+      js_is_entry[x] = false;
+      if (!js_fwd[x] || !js_bwd[x])
+        continue;
+      for (int j = js_pred_start[x]; j < js_pred_start[x + 1]; j++) {
+        int p = js_preds[j];
+        if (!js_fwd[p] || !js_bwd[p]) {
+          js_is_entry[x] = true;
+          num_entries++;
+          entry = x;
+          break;
+        }
+      }
+    }
+    if (num_entries >= 2)
+      break;
+    if (num_entries == 0 || entry == d)
+      return false;
+    // The only entry dominates the region, so the loop which is not
+    // reducible is nested in it.
+    d = entry;
+  }
+
+  if (js_num_nodes == js_max_nodes ||
+      js_num_edges + js_end_pc - js_base_pc > js_max_edges)
+    return false;
+  int num_edges = js_num_edges;
+  int dispatch = js_new_node(-1);
+  for (int i = 0; i < js_end_pc - js_base_pc; i++)
+    js_seen[i] = false;
+  for (int i = 0; i < num_edges; i++) {
+    JsEdge* edge = &js_edges[i];
+    if (edge->to == JS_EXIT || !js_is_entry[edge->to])
+      continue;
+    if (!js_seen[edge->pc - js_base_pc]) {
+      js_seen[edge->pc - js_base_pc] = true;
+      js_add_edge(dispatch, edge->to, edge->pc, NULL);
+    }
+    edge->to = dispatch;
+  }
+  return true;
+}
+
+static void js_build_chunk(void) {
+  js_build_graph(false);
+  js_analyze();
+  for (int i = 0; i < js_num_order; i++) {
+    int u = js_order[i];
+    JsNode* node = &js_nodes[u];
+    for (int j = node->first_edge; j < node->first_edge + node->num_edges;
+         j++) {
+      int h = js_edges[j].to;
+      if (h == JS_EXIT || js_nodes[h].rpo > i || js_dominates(h, u))
+        continue;
+      if (!js_add_dispatch(h, u)) {
+        js_build_graph(true);
+        js_analyze();
+        return;
+      }
+      js_analyze();
+      // Start over as the order has changed.
+      i = -1;
+      break;
+    }
+  }
+}
+
+static const char* js_node_name(int x) {
+  if (js_nodes[x].pc < 0)
+    return format("d%d", x);
+  return format("%d", js_nodes[x].pc);
+}
+
+static void js_emit_tree(int x);
+
+static void js_emit_branch(int from, JsEdge* edge) {
+  if (edge->to == JS_EXIT) {
+    if (edge->pc < 0)
+      emit_line("pc = %s;", value_str(&edge->jmp->jmp));
+    else
+      emit_line("pc = %d;", edge->pc);
+    emit_line("break out;");
+    return;
+  }
+
+  JsNode* node = &js_nodes[edge->to];
+  // Dispatch nodes switch on the pc which was set by their sources.
+  if (node->pc < 0 && js_nodes[from].pc >= 0)
+    emit_line("pc = %d;", edge->pc);
+  if (node->rpo <= js_nodes[from].rpo)
+    emit_line("continue L%s;", js_node_name(edge->to));
+  else if (node->is_merge)
+    emit_line("break B%s;", js_node_name(edge->to));
+  else
+    js_emit_tree(edge->to);
+}
+
+static void js_emit_node(int x) {
+  JsNode* node = &js_nodes[x];
+  JsEdge* edge = &js_edges[node->first_edge];
+  if (node->pc < 0) {
+    if (node->num_edges == 1) {
+      js_emit_branch(x, edge);
+      return;
+    }
+    emit_line("switch (pc) {");
+    for (int i = 0; i < node->num_edges; i++, edge++) {
+      emit_line("case %d:", edge->pc);
+      inc_indent();
+      js_emit_branch(x, edge);
+      dec_indent();
+    }
+    emit_line("}");
+    return;
+  }
+
+  int pc = node->pc;
+  for (Inst* inst = js_first[pc]; inst && inst->pc == pc; inst = inst->next) {
+    if (js_is_cond_jump(inst)) {
+      emit_line("if (%s) {", cmp_str(inst, "true"));
+      inc_indent();
+      js_emit_branch(x, edge++);
+      dec_indent();
+      emit_line("}");
+    } else if (!js_is_jump(inst)) {
+      js_emit_inst(inst);
+    }
+  }
+  if (edge < &js_edges[node->first_edge + node->num_edges])
+    js_emit_branch(x, edge);
+}
+
+static void js_emit_tree(int x) {
+  JsNode* node = &js_nodes[x];
+  if (node->is_loop) {
+    emit_line("L%s: while (true) {", js_node_name(x));
+    inc_indent();
+  }
+
+  int num_ys = js_num_ys;
+  for (int y = node->merge_children; y >= 0; y = js_nodes[y].next_merge)
+    js_ys[js_num_ys++] = y;
+  for (int i = num_ys; i < js_num_ys; i++) {
+    emit_line("B%s: {", js_node_name(js_ys[i]));
+    inc_indent();
+  }
+  js_emit_node(x);
+  for (int i = js_num_ys - 1; i >= num_ys; i--) {
+    dec_indent();
+    emit_line("}");
+    js_emit_tree(js_ys[i]);
+  }
+  js_num_ys = num_ys;
+
+  if (node->is_loop) {
+    dec_indent();
+    emit_line("}");
+  }
+}
+
+static void js_emit_chunk(int func_id) {
+  js_base_pc = func_id * CHUNKED_FUNC_SIZE;
+  js_end_pc = js_base_pc + CHUNKED_FUNC_SIZE;
+  if (js_end_pc > js_num_pcs)
+    js_end_pc = js_num_pcs;
+  js_build_chunk();
+
+  bool used[6] = {};
+  for (int pc = js_base_pc; pc < js_end_pc; pc++) {
+    for (Inst* inst = js_first[pc]; inst && inst->pc == pc;
+         inst = inst->next) {
+      if (inst->dst.type == REG)
+        used[inst->dst.reg] = true;
+      if (inst->src.type == REG)
+        used[inst->src.reg] = true;
+      if (inst->jmp.type == REG)
+        used[inst->jmp.reg] = true;
+    }
+  }
+
+  emit_line("");
+  emit_line("var func%d = function() {", func_id);
+  inc_indent();
+  for (int i = 0; i < 6; i++) {
+    if (used[i])
+      emit_line("let %s = regs[%d];", reg_names[i], i);
+  }
+  emit_line("out: {");
+  inc_indent();
+  js_emit_tree(0);
+  dec_indent();
+  emit_line("}");
+  for (int i = 0; i < 6; i++) {
+    if (used[i])
+      emit_line("regs[%d] = %s;", i, reg_names[i]);
+  }
+  dec_indent();
+  emit_line("};");
+}
+
 void target_js(Module* module) {
   init_state_js(module->data);
 
   emit_line("var running = true;");
 
-  int num_funcs = emit_chunked_main_loop(module->text,
-                                         js_emit_func_prologue,
-                                         js_emit_func_epilogue,
-                                         js_emit_pc_change,
-                                         js_emit_inst);
+  js_init_entries(module);
+  int num_funcs = (js_num_pcs + CHUNKED_FUNC_SIZE - 1) / CHUNKED_FUNC_SIZE;
+  for (int i = 0; i < num_funcs; i++)
+    js_emit_chunk(i);
 
   emit_line("");
   emit_line("while (running) {");
@@ -141,7 +653,6 @@ void target_js(Module* module) {
 
   // For nodejs
   emit_line("if (typeof require != 'undefined') {");
-  emit_line(" var sys = require('sys');");
   emit_line(" var input = null;");
   emit_line(" var ip = 0;");
   emit_line(" var getchar = function() {");
@@ -149,9 +660,17 @@ void target_js(Module* module) {
   emit_line("   input = require('fs').readFileSync('/dev/stdin');");
   emit_line("  return input[ip++] | 0;");
   emit_line(" };");
+  emit_line(" var output = [];");
+  emit_line(" var flush = function() {");
+  emit_line("  process.stdout.write(Buffer.from(output));");
+  emit_line("  output = [];");
+  emit_line(" };");
   emit_line(" var putchar = function(c) {");
-  emit_line("  sys.print(String.fromCharCode(c & 255));");
+  emit_line("  output.push(c & 255);");
+  emit_line("  if (output.length >= 65536)");
+  emit_line("   flush();");
   emit_line(" };");
   emit_line(" main(getchar, putchar);");
+  emit_line(" flush();");
   emit_line("}");
 }
@@ -1,96 +1,45 @@
+#include <ir/func.h>
 #include <ir/ir.h>
 #include <target/util.h>
 
-static int func_idx;
-static int case_idx;
-static int case_pc[512];
-static int case_label[512];
-static int putc_idx;
+// Everything runs in @main. Each pc is a basic block named %pcN and
+// the registers are allocas, which mem2reg turns into SSA values.
+// Jumps to immediates are direct branches. Jumps to registers go
+// through %dispatch, which looks the target up in a table of block
+// addresses and takes an indirectbr to one of the address-taken pcs.
 
-static void ll_init_state(void) {
-  func_idx = 1;
-  case_idx = 0;
-  putc_idx = 0;
-  for (int i = 0; i < 7; i++) {
-    emit_line("@%s = common global i32 0, align 4", reg_names[i]);
-  }
-  emit_line("@mem = common global [16777216 x i32] zeroinitializer, align 16");
-}
-
-static void ll_emit_func_prologue(int func_id) {
-  emit_line("");
-  emit_line("define void @func%d() {", func_id);
-  inc_indent();
-
-  emit_line("br label %%1");
-
-  emit_line("");
-  emit_line("; <label>:1");
-  emit_line("%%2 = load i32, i32* @pc, align 4");
-  emit_line("%%3 = icmp ule i32 %d, %%2", func_id * CHUNKED_FUNC_SIZE);
-  emit_line("br i1 %%3, label %%4, label %%7");
-
-  emit_line("");
-  emit_line("; <label>:4");
-  emit_line("%%5 = load i32, i32* @pc, align 4");
-  emit_line("%%6 = icmp ult i32 %%5, %d", (func_id + 1) * CHUNKED_FUNC_SIZE);
-  emit_line("br label %%7");
-
-  emit_line("");
-  emit_line("; <label>:7");
-  emit_line("%%8 = phi i1 [ false, %%1 ], [ %%6, %%4 ]");
-  emit_line("br i1 %%8, label %%switch_top, label %%func_bottom");
+// The next number for temporaries, named %tN.
+static int ll_tmp;
+// Set after a terminator, until the next block starts.
+static bool ll_terminated;
+static int ll_cur_pc;
 
-  emit_line("");
-  emit_line("; <label>:9");
-  /* set func_idx */
-  func_idx = 10;
+static const char* ll_new_tmp(void) {
+  return format("%%t%d", ll_tmp++);
 }
 
-static void ll_emit_func_epilogue(void) {
-  emit_line("br label %%case_bottom");
-  emit_line("");
-  emit_line("switch_top:");
-  emit_line("%%%d = load i32, i32* @pc, align 4", func_idx);
-  emit_line("switch i32 %%%d, label %%case_bottom [", func_idx);
-  inc_indent();
-  emit_line("i32 -1, label %%9");
-  for (int i=0; i<case_idx; i++) {
-    emit_line("i32 %d, label %%%d", case_pc[i], case_label[i]);
-  }
-  dec_indent();
-  emit_line("]");
-
-  emit_line("");
-  emit_line("case_bottom:");
-  emit_line("%%%d = load i32, i32* @pc, align 4", func_idx+1);
-  emit_line("%%%d = add i32 %%%d, 1", func_idx+2, func_idx+1);
-  emit_line("store i32 %%%d, i32* @pc, align 4", func_idx+2);
-  emit_line("br label %%1");
-
-  emit_line("");
-  emit_line("func_bottom:");
-  emit_line("ret void");
-  dec_indent();
-  emit_line("}");
-  /* reset func_idx */
-  func_idx = 1;
-  case_idx = 0;
-  putc_idx = 0;
+static void ll_init_state(void) {
+  ll_tmp = 0;
+  ll_terminated = false;
+  ll_cur_pc = 0;
+  emit_line("@mem = common global [16777216 x i32] zeroinitializer, align 16");
 }
 
+// Starts the blocks up to |pc|. Blocks of pcs without instructions
+// fall through.
 static void ll_emit_pc_change(int pc) {
-  emit_line("br label %%case_bottom");
-
-  emit_line("");
-  emit_line("; <label>:%d", func_idx);
-  case_pc[case_idx] = pc;
-  case_label[case_idx] = func_idx;
-  case_idx += 1;
-  func_idx += 1;
+  for (; ll_cur_pc < pc; ll_cur_pc++) {
+    if (!ll_terminated)
+      emit_line("br label %%pc%d", ll_cur_pc + 1);
+    dec_indent();
+    emit_line("");
+    emit_line("pc%d:", ll_cur_pc + 1);
+    inc_indent();
+    ll_terminated = false;
+  }
 }
 
-const char* ll_cmp_str(Inst* inst) {
+static const char* ll_cmp_str(Inst* inst) {
   int op = normalize_cond(inst->op, 0);
   switch (op) {
     case JEQ:
@@ -110,161 +59,170 @@ const char* ll_cmp_str(Inst* inst) {
   }
 }
 
-static void ll_emit_cmp(Inst* inst) {
-  if (inst->src.type == REG) {
-    emit_line("%%%d = load i32, i32* @%s, align 4", func_idx, reg_names[inst->dst.reg]);
-    emit_line("%%%d = load i32, i32* @%s, align 4", func_idx+1, src_str(inst));
-    emit_line("%%%d = icmp %s i32 %%%d, %%%d",
-              func_idx+2, ll_cmp_str(inst), func_idx, func_idx+1);
-    func_idx += 3;
-  } else if (inst->src.type == IMM) {
-    emit_line("%%%d = load i32, i32* @%s, align 4", func_idx, reg_names[inst->dst.reg]);
-    emit_line("%%%d = icmp %s i32 %%%d, %s",
-              func_idx+1, ll_cmp_str(inst), func_idx, src_str(inst));
-    func_idx += 2;
+static const char* ll_arith_op_str(Op op) {
+  switch (op) {
+    case MUL:
+      return "mul";
+    case DIV:
+      return "udiv";
+    case MOD:
+      return "urem";
+    case AND:
+      return "and";
+    case OR:
+      return "or";
+    case XOR:
+      return "xor";
+    case SHL:
+      return "shl";
+    case SHR:
+      return "lshr";
+    default:
+      error("oops");
+  }
+}
+
+// Returns an operand for |v|, loading it first if it is a register.
+static const char* ll_value_str(Value* v) {
+  if (v->type == REG) {
+    const char* t = ll_new_tmp();
+    emit_line("%s = load i32, i32* %%%s, align 4", t, reg_names[v->reg]);
+    return t;
+  } else if (v->type == IMM) {
+    return format("%d", v->imm);
   } else {
     error("invalid value");
   }
 }
 
-const char* ll_emit_load(Inst* inst) {
-  if (inst->src.type == REG) {
-    emit_line("%%%d = load i32, i32* @%s, align 4", func_idx, reg_names[inst->dst.reg]);
-    emit_line("%%%d = load i32, i32* @%s, align 4", func_idx+1, src_str(inst));
-    func_idx += 2;
-    return format("%d", func_idx);
-  } else if (inst->src.type == IMM) {
-    emit_line("%%%d = load i32, i32* @%s, align 4", func_idx, reg_names[inst->dst.reg]);
-    func_idx += 1;
-    return format("@%s", reg_names[inst->dst.reg]);
+static void ll_emit_store_reg(Reg r, const char* v) {
+  emit_line("store i32 %s, i32* %%%s, align 4", v, reg_names[r]);
+}
+
+static const char* ll_emit_cmp(Inst* inst) {
+  const char* lhs = ll_value_str(&inst->dst);
+  const char* rhs = ll_value_str(&inst->src);
+  const char* t = ll_new_tmp();
+  emit_line("%s = icmp %s i32 %s, %s", t, ll_cmp_str(inst), lhs, rhs);
+  return t;
+}
+
+// Returns a pointer to the word at |addr| of @mem.
+static const char* ll_emit_mem_ptr(const char* addr) {
+  const char* idx = ll_new_tmp();
+  emit_line("%s = zext i32 %s to i64", idx, addr);
+  const char* p = ll_new_tmp();
+  emit_line("%s = getelementptr inbounds [16777216 x i32], [16777216 x i32]* @mem, i64 0, i64 %s", p, idx);
+  return p;
+}
+
+// Branches to |target|, or to %pc{cur+1} unless |cond| holds.
+static void ll_emit_jmp(const char* cond, Value* target) {
+  const char* label;
+  if (target->type == IMM) {
+    label = format("pc%d", target->imm);
   } else {
-    error("invalid value");
+    label = format("jmp%d", ll_tmp++);
+  }
+  if (cond) {
+    emit_line("br i1 %s, label %%%s, label %%pc%d", cond, label, ll_cur_pc + 1);
+  } else if (target->type == IMM) {
+    emit_line("br label %%%s", label);
+  }
+  if (target->type == REG) {
+    if (cond) {
+      dec_indent();
+      emit_line("%s:", label);
+      inc_indent();
+    }
+    emit_line("store i32 %s, i32* %%target, align 4", ll_value_str(target));
+    emit_line("br label %%dispatch");
   }
+  ll_terminated = true;
 }
 
 static void ll_emit_inst(Inst* inst) {
+  Reg dst = inst->dst.reg;
   switch (inst->op) {
   case MOV:
-    if (inst->src.type == REG) {
-      emit_line("%%%d = load i32, i32* @%s, align 4", func_idx, src_str(inst));
-      emit_line("store i32 %%%d, i32* @%s, align 4", func_idx, reg_names[inst->dst.reg]);
-      func_idx += 1;
-    } else if (inst->src.type == IMM) {
-      emit_line("store i32 %s, i32* @%s, align 4", src_str(inst), reg_names[inst->dst.reg]);
-    }
+    ll_emit_store_reg(dst, ll_value_str(&inst->src));
     break;
 
   case ADD:
-    if (inst->src.type == REG) {
-      emit_line("%%%d = load i32, i32* @%s, align 4", func_idx, reg_names[inst->dst.reg]);
-      emit_line("%%%d = load i32, i32* @%s, align 4", func_idx+1, src_str(inst));
-      emit_line("%%%d = add i32 %%%d, %%%d", func_idx+2, func_idx, func_idx+1);
-      func_idx += 3;
-    } else if (inst->src.type == IMM) {
-      emit_line("%%%d = load i32, i32* @%s, align 4", func_idx, reg_names[inst->dst.reg]);
-      emit_line("%%%d = add i32 %%%d, %s", func_idx+1, func_idx, src_str(inst));
-      func_idx += 2;
-    } else {
-      error("invalid value");
+  case SUB:
+  case MUL:
+  case DIV:
+  case MOD:
+  case AND:
+  case OR:
+  case XOR:
+  case SHL:
+  case SHR: {
+    const char* lhs = ll_value_str(&inst->dst);
+    const char* rhs = ll_value_str(&inst->src);
+    const char* t = ll_new_tmp();
+    const char* op = (inst->op == ADD ? "add" :
+                      inst->op == SUB ? "sub" : ll_arith_op_str(inst->op));
+    emit_line("%s = %s i32 %s, %s", t, op, lhs, rhs);
+    if (inst->op == SHL || inst->op == SHR) {
+      const char* c = ll_new_tmp();
+      emit_line("%s = icmp ult i32 %s, 24", c, rhs);
+      const char* sel = ll_new_tmp();
+      emit_line("%s = select i1 %s, i32 %s, i32 0", sel, c, t);
+      t = sel;
+    }
+    if (!inst->no_wrap) {
+      const char* m = ll_new_tmp();
+      emit_line("%s = and i32 %s, 16777215", m, t);
+      t = m;
     }
-    emit_line("%%%d = and i32 %%%d, 16777215", func_idx, func_idx-1);
-    emit_line("store i32 %%%d, i32* @%s, align 4", func_idx, reg_names[inst->dst.reg]);
-    func_idx += 1;
+    ll_emit_store_reg(dst, t);
     break;
+  }
 
-  case SUB:
-    if (inst->src.type == REG) {
-      emit_line("%%%d = load i32, i32* @%s, align 4", func_idx, reg_names[inst->dst.reg]);
-      emit_line("%%%d = load i32, i32* @%s, align 4", func_idx+1, src_str(inst));
-      emit_line("%%%d = sub i32 %%%d, %%%d", func_idx+2, func_idx, func_idx+1);
-      func_idx += 3;
-    } else if (inst->src.type == IMM) {
-      emit_line("%%%d = load i32, i32* @%s, align 4", func_idx, reg_names[inst->dst.reg]);
-      emit_line("%%%d = sub i32 %%%d, %s", func_idx+1, func_idx, src_str(inst));
-      func_idx += 2;
-    } else {
-      error("invalid value");
-    }
-    emit_line("%%%d = and i32 %%%d, 16777215", func_idx, func_idx-1);
-    emit_line("store i32 %%%d, i32* @%s, align 4", func_idx, reg_names[inst->dst.reg]);
-    func_idx += 1;
+  case MEMCPY:
+  case MEMSET: {
+    const char* d = ll_value_str(&inst->dst);
+    const char* src = ll_value_str(&inst->src);
+    const char* cnt = ll_value_str(&inst->jmp);
+    emit_line("call void @elvm_%s(i32 %s, i32 %s, i32 %s)",
+              inst->op == MEMCPY ? "memcpy" : "memset", d, src, cnt);
     break;
+  }
 
-  case LOAD:
-    if (inst->src.type == REG) {
-      emit_line("%%%d = load i32, i32* @%s, align 4", func_idx, src_str(inst));
-      emit_line("%%%d = zext i32 %%%d to i64", func_idx+1, func_idx);
-      emit_line("%%%d = getelementptr inbounds [16777216 x i32], [16777216 x i32]* @mem, i32 0, i64 %%%d", func_idx+2, func_idx+1);
-      emit_line("%%%d = load i32, i32* %%%d, align 4", func_idx+3, func_idx+2);
-      emit_line("store i32 %%%d, i32* @%s, align 4", func_idx+3, reg_names[inst->dst.reg]);
-      func_idx += 4;
-    } else if (inst->src.type == IMM) {
-      emit_line("%%%d = load i32, i32* getelementptr inbounds ([16777216 x i32], [16777216 x i32]* @mem, i32 0, i64 %s)", func_idx, src_str(inst));
-      emit_line("store i32 %%%d, i32* @%s, align 4", func_idx, reg_names[inst->dst.reg]);
-      func_idx += 1;
-    } else {
-      error("invalid value");
-    }
+  case LOAD: {
+    const char* p = ll_emit_mem_ptr(ll_value_str(&inst->src));
+    const char* t = ll_new_tmp();
+    emit_line("%s = load i32, i32* %s, align 4", t, p);
+    ll_emit_store_reg(dst, t);
     break;
+  }
 
-  case STORE:
-    if (inst->src.type == REG) {
-      emit_line("%%%d = load i32, i32* @%s, align 4", func_idx, reg_names[inst->dst.reg]);
-      emit_line("%%%d = load i32, i32* @%s, align 4", func_idx+1, src_str(inst));
-      emit_line("%%%d = zext i32 %%%d to i64", func_idx+2, func_idx+1);
-      emit_line("%%%d = getelementptr inbounds [16777216 x i32], [16777216 x i32]* @mem, i32 0, i64 %%%d", func_idx+3, func_idx+2);
-      emit_line("store i32 %%%d, i32* %%%d, align 4", func_idx, func_idx+3);
-      func_idx += 4;
-    } else if (inst->src.type == IMM) {
-      emit_line("%%%d = load i32, i32* @%s, align 4", func_idx, reg_names[inst->dst.reg]);
-      emit_line("store i32 %%%d, i32* getelementptr inbounds ([16777216 x i32], [16777216 x i32]* @mem, i32 0, i64 %s)", func_idx, src_str(inst));
-      func_idx += 1;
-    } else {
-      error("invalid value");
-    }
+  case STORE: {
+    const char* p = ll_emit_mem_ptr(ll_value_str(&inst->src));
+    emit_line("store i32 %s, i32* %s, align 4", ll_value_str(&inst->dst), p);
     break;
+  }
 
   case PUTC:
-    if (inst->src.type == REG) {
-      emit_line("%%%d = load i32, i32* @%s, align 4", func_idx, src_str(inst));
-      emit_line("%%%d = call i32 @putchar(i32 %%%d)", func_idx+1, func_idx);
-      func_idx += 2;
-    } else if (inst->src.type == IMM) {
-      emit_line("%%%d = call i32 @putchar(i32 %s)", func_idx, src_str(inst));
-      func_idx += 1;
-    } else {
-      error("invalid value");
-    }
+    emit_line("call i32 @putchar(i32 %s)", ll_value_str(&inst->src));
     break;
 
-  case GETC:
-    emit_line("%%_%d = alloca i32, align 4", putc_idx);
-    emit_line("%%%d = call i32 @getchar()", func_idx);
-    emit_line("store i32 %%%d, i32* %%_%d, align 4", func_idx, putc_idx);
-    emit_line("%%%d = load i32, i32* %%_%d, align 4", func_idx+1, putc_idx);
-    emit_line("%%%d = icmp ne i32 %%%d, -1", func_idx+2, func_idx+1);
-    emit_line("br i1 %%%d, label %%%d, label %%%d", func_idx+2, func_idx+3, func_idx+5);
-
-    emit_line("");
-    emit_line("; <label>:%%%d", func_idx+3);
-    emit_line("%%%d = load i32, i32* %%_%d, align 4", func_idx+4, putc_idx);
-    emit_line("br label %%%d", func_idx+6);
-
-    emit_line("");
-    emit_line("; <label>:%%%d", func_idx+5);
-    emit_line("br label %%%d", func_idx+6);
-
-    emit_line("");
-    emit_line("; <label>:%%%d", func_idx+6);
-    emit_line("%%%d = phi i32 [ %%%d, %%%d ], [0, %%%d]",
-                func_idx+7, func_idx+4, func_idx+3, func_idx+5);
-    emit_line("store i32 %%%d, i32* @%s, align 4", func_idx+7, reg_names[inst->dst.reg]);
-    func_idx += 8;
-    putc_idx += 1;
+  case GETC: {
+    const char* c = ll_new_tmp();
+    emit_line("%s = call i32 @getchar()", c);
+    const char* eof = ll_new_tmp();
+    emit_line("%s = icmp eq i32 %s, -1", eof, c);
+    const char* t = ll_new_tmp();
+    emit_line("%s = select i1 %s, i32 0, i32 %s", t, eof, c);
+    ll_emit_store_reg(dst, t);
     break;
+  }
 
   case EXIT:
     emit_line("call void @exit(i32 0)");
+    emit_line("unreachable");
+    ll_terminated = true;
     break;
 
   case DUMP:
@@ -275,12 +233,13 @@ static void ll_emit_inst(Inst* inst) {
   case LT:
   case GT:
   case LE:
-  case GE:
-    ll_emit_cmp(inst);
-    emit_line("%%%d = zext i1 %%%d to i32", func_idx, func_idx-1);
-    emit_line("store i32 %%%d, i32* @%s, align 4", func_idx, reg_names[inst->dst.reg]);
-    func_idx += 1;
+  case GE: {
+    const char* c = ll_emit_cmp(inst);
+    const char* t = ll_new_tmp();
+    emit_line("%s = zext i1 %s to i32", t, c);
+    ll_emit_store_reg(dst, t);
     break;
+  }
 
   case JEQ:
   case JNE:
@@ -288,43 +247,11 @@ static void ll_emit_inst(Inst* inst) {
   case JGT:
   case JLE:
   case JGE:
-    emit_line("; cmp jmp %s", ll_cmp_str(inst));
-    ll_emit_cmp(inst);
-    if (inst->jmp.type == REG) {
-      emit_line("br i1 %%%d, label %%%d, label %%%d",
-                func_idx-1, func_idx, func_idx+3);
-      emit_line("");
-      emit_line("; <label>:%%%d", func_idx);
-      emit_line("%%%d = load i32, i32* @%s, align 4", func_idx+1, value_str(&inst->jmp));
-      emit_line("%%%d = sub i32 %%%d, 1", func_idx+2, func_idx+1);
-      emit_line("store i32 %d, i32* @pc, align 4", func_idx+2);
-      func_idx += 3;
-    } else if (inst->jmp.type == IMM) {
-      emit_line("br i1 %%%d, label %%%d, label %%%d",
-                func_idx-1, func_idx, func_idx+1);
-      emit_line("");
-      emit_line("; <label>:%%%d", func_idx);
-      emit_line("store i32 %d, i32* @pc, align 4", inst->jmp.imm-1);
-      func_idx += 1;
-    } else {
-      error("invalid value");
-    }
-    emit_line("br label %%%d", func_idx);
-    emit_line("");
-    emit_line("; <label>:%%%d", func_idx);
-    func_idx += 1;
+    ll_emit_jmp(ll_emit_cmp(inst), &inst->jmp);
     break;
 
   case JMP:
-    emit_line("; jmp");
-    if (inst->jmp.type == REG) {
-      emit_line("%%%d = load i32, i32* @%s, align 4", func_idx, value_str(&inst->jmp));
-      emit_line("%%%d = sub i32 %%%d, 1", func_idx+1, func_idx);
-      emit_line("store i32 %%%d, i32* @pc, align 4", func_idx+1);
-      func_idx += 2;
-    } else if (inst->jmp.type == IMM) {
-      emit_line("store i32 %d, i32* @pc, align 4", inst->jmp.imm-1);
-    }
+    ll_emit_jmp(NULL, &inst->jmp);
     break;
 
   default:
@@ -333,63 +260,140 @@ static void ll_emit_inst(Inst* inst) {
 }
 
 void target_ll(Module* module) {
+  init_vreg_names(module);
   ll_init_state();
 
-  int num_funcs = emit_chunked_main_loop(module->text,
-                                         ll_emit_func_prologue,
-                                         ll_emit_func_epilogue,
-                                         ll_emit_pc_change,
-                                         ll_emit_inst);
+  int num_pcs = 0;
+  for (Inst* inst = module->text; inst; inst = inst->next)
+    num_pcs = inst->pc + 1;
+  int num_taken;
+  int* taken = get_addr_taken_pcs(module, &num_taken);
 
   emit_line("");
   emit_line("declare i32 @getchar()");
   emit_line("declare i32 @putchar(i32)");
   emit_line("declare void @exit(i32)");
+  emit_line("declare void @llvm.memmove.p0i8.p0i8.i64(i8*, i8*, i64, i1)");
 
   emit_line("");
-  emit_line("define i32 @main() {");
+  emit_line("define internal void @elvm_memcpy(i32 %%d, i32 %%s, i32 %%n) {");
   inc_indent();
+  emit_line("%%1 = zext i32 %%d to i64");
+  emit_line("%%2 = getelementptr inbounds [16777216 x i32], [16777216 x i32]* @mem, i32 0, i64 %%1");
+  emit_line("%%3 = bitcast i32* %%2 to i8*");
+  emit_line("%%4 = zext i32 %%s to i64");
+  emit_line("%%5 = getelementptr inbounds [16777216 x i32], [16777216 x i32]* @mem, i32 0, i64 %%4");
+  emit_line("%%6 = bitcast i32* %%5 to i8*");
+  emit_line("%%7 = zext i32 %%n to i64");
+  emit_line("%%8 = mul i64 %%7, 4");
+  emit_line("call void @llvm.memmove.p0i8.p0i8.i64(i8* align 4 %%3, i8* align 4 %%6, i64 %%8, i1 false)");
+  emit_line("ret void");
+  dec_indent();
+  emit_line("}");
 
-  emit_line("%%1 = alloca i32, align 4");
-  emit_line("store i32 0, i32* %%1");
+  emit_line("");
+  emit_line("define internal void @elvm_memset(i32 %%d, i32 %%v, i32 %%n) {");
+  emit_line("entry:");
+  inc_indent();
+  emit_line("br label %%loop");
+  dec_indent();
+  emit_line("loop:");
+  inc_indent();
+  emit_line("%%i = phi i32 [ 0, %%entry ], [ %%i1, %%body ]");
+  emit_line("%%c = icmp ult i32 %%i, %%n");
+  emit_line("br i1 %%c, label %%body, label %%done");
+  dec_indent();
+  emit_line("body:");
+  inc_indent();
+  emit_line("%%a = add i32 %%d, %%i");
+  emit_line("%%a64 = zext i32 %%a to i64");
+  emit_line("%%p = getelementptr inbounds [16777216 x i32], [16777216 x i32]* @mem, i32 0, i64 %%a64");
+  emit_line("store i32 %%v, i32* %%p, align 4");
+  emit_line("%%i1 = add i32 %%i, 1");
+  emit_line("br label %%loop");
+  dec_indent();
+  emit_line("done:");
+  inc_indent();
+  emit_line("ret void");
+  dec_indent();
+  emit_line("}");
+
+  emit_line("");
+  emit_line("define i32 @main() {");
+  emit_line("entry:");
+  inc_indent();
+  for (int i = 0; i < num_reg_names; i++) {
+    if (i == SP + 1)
+      continue;  // pc
+    emit_line("%%%s = alloca i32, align 4", reg_names[i]);
+    emit_line("store i32 0, i32* %%%s, align 4", reg_names[i]);
+  }
+  emit_line("%%target = alloca i32, align 4");
   Data* data = module->data;
   for (int mp = 0; data; data = data->next, mp++) {
     if (data->v) {
-      emit_line("store i32 %d, i32* getelementptr inbounds ([16777216 x i32], [16777216 x i32]* @mem, i32 0, i64 %d), align 4", data->v, mp);
+      emit_line("store i32 %d, i32* getelementptr inbounds ([16777216 x i32], [16777216 x i32]* @mem, i64 0, i64 %d), align 4", data->v, mp);
     }
   }
-  emit_line("br label %%2");
-
+  emit_line("br label %%pc0");
+  dec_indent();
   emit_line("");
-  emit_line("; <label>:2");
-  emit_line("%%3 = load i32, i32* @pc, align 4");
-  emit_line("%%4 = udiv i32 %%3, %d", CHUNKED_FUNC_SIZE);
-
-  int label_offset = 5;
-  int while_bottom = label_offset + num_funcs;
+  emit_line("pc0:");
+  inc_indent();
 
-  emit_line("switch i32 %%4, label %%%d [", while_bottom);
-  for (int i = 0; i < num_funcs; i++) {
-    emit_line("i32 %d, label %%%d", i, label_offset+i);
+  for (Inst* inst = module->text; inst; inst = inst->next) {
+    ll_emit_pc_change(inst->pc);
+    ll_emit_inst(inst);
   }
-  emit_line("]");
+  // Running off the end exits.
+  ll_emit_pc_change(num_pcs);
+  emit_line("ret i32 0");
 
+  dec_indent();
   emit_line("");
-  for (int i = 0; i < num_funcs; i++) {
-    emit_line("; <label>:%d", label_offset+i);
+  emit_line("dispatch:");
+  inc_indent();
+  if (num_taken) {
+    int table_start = taken[0];
+    int table_size = taken[num_taken - 1] + 1 - table_start;
+    emit_line("%%dispatch_pc = load i32, i32* %%target, align 4");
+    emit_line("%%dispatch_idx0 = sub i32 %%dispatch_pc, %d", table_start);
+    emit_line("%%dispatch_idx = zext i32 %%dispatch_idx0 to i64");
+    emit_line("%%dispatch_ptr = getelementptr inbounds [%d x i8*], [%d x i8*]* @labels, i64 0, i64 %%dispatch_idx",
+              table_size, table_size);
+    emit_line("%%dispatch_addr = load i8*, i8** %%dispatch_ptr, align 8");
+    emit_line("indirectbr i8* %%dispatch_addr, [");
     inc_indent();
-    emit_line("call void @func%d()", i);
-    emit_line("br label %%%d", while_bottom);
+    for (int i = 0; i < num_taken; i++) {
+      emit_line("label %%pc%d%s", taken[i], i + 1 < num_taken ? "," : "");
+    }
     dec_indent();
+    emit_line("]");
+  } else {
+    emit_line("unreachable");
   }
-
-  emit_line("");
-  emit_line("; <label>:%d", while_bottom);
-  emit_line("br label %%2");
-
-  emit_line("");
-  emit_line("%%%d = load i32, i32* %%1, align 4", while_bottom+2);
-  emit_line("ret i32 %%%d", while_bottom+2);
   dec_indent();
   emit_line("}");
+
+  if (num_taken) {
+    // Only the entries of address-taken pcs are used. The others point
+    // to the first of them, as indirectbr must list every destination.
+    int table_start = taken[0];
+    int table_size = taken[num_taken - 1] + 1 - table_start;
+    emit_line("");
+    emit_line("@labels = internal constant [%d x i8*] [", table_size);
+    inc_indent();
+    int ti = 0;
+    for (int pc = table_start; pc < table_start + table_size; pc++) {
+      int dest = taken[0];
+      if (taken[ti] == pc) {
+        dest = pc;
+        ti++;
+      }
+      emit_line("i8* blockaddress(@main, %%pc%d)%s", dest,
+                pc + 1 < table_start + table_size ? "," : "");
+    }
+    dec_indent();
+    emit_line("]");
+  }
 }
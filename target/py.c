@@ -53,13 +53,15 @@ static void py_emit_inst(Inst* inst) {
     break;
 
   case ADD:
-    emit_line("%s = (%s + %s) & " UINT_MAX_STR,
+    emit_line(inst->no_wrap ? "%s = %s + %s" :
+              "%s = (%s + %s) & " UINT_MAX_STR,
               reg_names[inst->dst.reg],
               reg_names[inst->dst.reg], src_str(inst));
     break;
 
   case SUB:
-    emit_line("%s = (%s - %s) & " UINT_MAX_STR,
+    emit_line(inst->no_wrap ? "%s = %s - %s" :
+              "%s = (%s - %s) & " UINT_MAX_STR,
               reg_names[inst->dst.reg],
               reg_names[inst->dst.reg], src_str(inst));
     break;
@@ -98,6 +100,25 @@ static void py_emit_inst(Inst* inst) {
               reg_names[inst->dst.reg], cmp_str(inst, "True"));
     break;
 
+  case MUL:
+  case DIV:
+  case MOD:
+  case AND:
+  case OR:
+  case XOR:
+    emit_line("%s = (%s %s %s) & " UINT_MAX_STR,
+              reg_names[inst->dst.reg], reg_names[inst->dst.reg],
+              inst->op == DIV ? "//" : arith_op_str(inst->op),
+              src_str(inst));
+    break;
+
+  case SHL:
+  case SHR:
+    emit_line("%s = (%s %s %s) & " UINT_MAX_STR " if %s < 24 else 0",
+              reg_names[inst->dst.reg], reg_names[inst->dst.reg],
+              arith_op_str(inst->op), src_str(inst), src_str(inst));
+    break;
+
   case JEQ:
   case JNE:
   case JLT:
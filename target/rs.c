@@ -9,7 +9,7 @@ static void rs_init_state(void) {
   emit_line("#[allow(dead_code)]");
   emit_line("struct State {");
   inc_indent();
-  for (int i = 0; i < 7; i++) {
+  for (int i = 0; i < num_reg_names; i++) {
     emit_line("%s: i32,", reg_names[i]);
   }
   emit_line("mem: Vec<i32>,");
@@ -129,13 +129,15 @@ static void rs_emit_inst(Inst* inst) {
     break;
 
   case ADD:
-    emit_line("%s = (%s + %s) & " UINT_MAX_STR ";",
+    emit_line(inst->no_wrap ? "%s = %s + %s;" :
+              "%s = (%s + %s) & " UINT_MAX_STR ";",
               rs_reg(inst->dst.reg),
               rs_reg(inst->dst.reg), rs_src_str(inst));
     break;
 
   case SUB:
-    emit_line("%s = (%s - %s) & " UINT_MAX_STR ";",
+    emit_line(inst->no_wrap ? "%s = %s - %s;" :
+              "%s = (%s - %s) & " UINT_MAX_STR ";",
               rs_reg(inst->dst.reg),
               rs_reg(inst->dst.reg), rs_src_str(inst));
     break;
@@ -175,6 +177,30 @@ static void rs_emit_inst(Inst* inst) {
               rs_reg(inst->dst.reg), rs_cmp_str(inst, "1"));
     break;
 
+  case MUL:
+    emit_line("%s = %s.wrapping_mul(%s) & " UINT_MAX_STR ";",
+              rs_reg(inst->dst.reg),
+              rs_reg(inst->dst.reg), rs_src_str(inst));
+    break;
+
+  case DIV:
+  case MOD:
+  case AND:
+  case OR:
+  case XOR:
+    emit_line("%s = %s %s %s;",
+              rs_reg(inst->dst.reg), rs_reg(inst->dst.reg),
+              arith_op_str(inst->op), rs_src_str(inst));
+    break;
+
+  case SHL:
+  case SHR:
+    emit_line("%s = if %s < 24 { (%s %s %s) & " UINT_MAX_STR " } else { 0 };",
+              rs_reg(inst->dst.reg), rs_src_str(inst),
+              rs_reg(inst->dst.reg), arith_op_str(inst->op),
+              rs_src_str(inst));
+    break;
+
   case JEQ:
   case JNE:
   case JLT:
@@ -195,6 +221,7 @@ static void rs_emit_inst(Inst* inst) {
 }
 
 void target_rs(Module* module) {
+  init_vreg_names(module);
   rs_init_state();
 
   int num_funcs = emit_chunked_main_loop(module->text,
@@ -210,7 +237,7 @@ void target_rs(Module* module) {
 
   emit_line("let mut state = State {");
   inc_indent();
-  for (int i = 0; i < 7; i++) {
+  for (int i = 0; i < num_reg_names; i++) {
     emit_line("%s: 0,", reg_names[i]);
   }
   emit_line("mem: vec![0; 1<<24],");
@@ -57,12 +57,24 @@ static const char* DEFAULT_REG_NAMES[7] = {
 };
 
 const char** reg_names = DEFAULT_REG_NAMES;
+int num_reg_names = 7;
+
+void init_vreg_names(Module* module) {
+  const char** names = calloc(VREG0 + module->num_vregs, sizeof(char*));
+  for (int i = 0; i < VREG0; i++)
+    names[i] = reg_names[i];
+  for (int i = 0; i < module->num_vregs; i++)
+    names[VREG0 + i] = format("v%d", i);
+  reg_names = names;
+  num_reg_names = VREG0 + module->num_vregs;
+}
 
 const char* value_str(Value* v) {
   if (v->type == REG) {
     return reg_names[v->reg];
   } else if (v->type == IMM) {
-    return format("%d", v->imm);
+    // Words of 2^31 or more are negative in Value.imm.
+    return format("%u", (unsigned int)v->imm);
   } else {
     error("invalid value");
   }
@@ -108,6 +120,29 @@ const char* cmp_str(Inst* inst, const char* true_str) {
   return format("%s %s %s", reg_names[inst->dst.reg], op_str, src_str(inst));
 }
 
+const char* arith_op_str(Op op) {
+  switch (op) {
+    case MUL:
+      return "*";
+    case DIV:
+      return "/";
+    case MOD:
+      return "%";
+    case AND:
+      return "&";
+    case OR:
+      return "|";
+    case XOR:
+      return "^";
+    case SHL:
+      return "<<";
+    case SHR:
+      return ">>";
+    default:
+      error("oops");
+  }
+}
+
 static int g_emit_cnt;
 static bool g_emit_started;
 
@@ -250,3 +285,92 @@ void emit_elf_header(uint16_t machine, uint32_t filesz) {
   fwrite(ehdr, 52, 1, stdout);
   fwrite(phdr, 32, 1, stdout);
 }
+
+void emit_elf64_header(uint16_t machine, uint32_t filesz) {
+  const char ehdr[64] = {
+    // e_ident
+    0x7f, 0x45, 0x4c, 0x46, 0x02, 0x01, 0x01, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    PACK2(2),  // e_type
+    PACK2(machine),  // e_machine
+    PACK4(1),  // e_version
+    PACK4(ELF_TEXT_START + ELF64_HEADER_SIZE), PACK4(0),  // e_entry
+    PACK4(64), PACK4(0),  // e_phoff
+    PACK4(0), PACK4(0),  // e_shoff
+    PACK4(0),  // e_flags
+    PACK2(64),  // e_ehsize
+    PACK2(56),  // e_phentsize
+    PACK2(1),  // e_phnum
+    PACK2(64),  // e_shentsize
+    PACK2(0),  // e_shnum
+    PACK2(0),  // e_shstrndx
+  };
+  const char phdr[56] = {
+    PACK4(1),  // p_type
+    PACK4(5),  // p_flags
+    PACK4(0), PACK4(0),  // p_offset
+    PACK4(ELF_TEXT_START), PACK4(0),  // p_vaddr
+    PACK4(ELF_TEXT_START), PACK4(0),  // p_paddr
+    PACK4(filesz + ELF64_HEADER_SIZE), PACK4(0),  // p_filesz
+    PACK4(filesz + ELF64_HEADER_SIZE), PACK4(0),  // p_memsz
+    PACK4(0x1000), PACK4(0),  // p_align
+  };
+  fwrite(ehdr, 64, 1, stdout);
+  fwrite(phdr, 56, 1, stdout);
+}
+
+static const char BASE64_DIGITS[] =
+  "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static void emit_base64_group(int* b, int n) {
+  putchar(BASE64_DIGITS[b[0] / 4]);
+  putchar(BASE64_DIGITS[b[0] % 4 * 16 + b[1] / 16]);
+  putchar(n > 1 ? BASE64_DIGITS[b[1] % 16 * 4 + b[2] / 64] : '=');
+  putchar(n > 2 ? BASE64_DIGITS[b[2] % 64] : '=');
+}
+
+void emit_js_data_init(Data* data, const char* mem) {
+  int size = 0;
+  int n = 0;
+  for (Data* d = data; d; d = d->next) {
+    n++;
+    if (d->v)
+      size = n;
+  }
+  if (!size)
+    return;
+
+  // Node has Buffer, and browsers and Node 16 or later have atob.
+  emit_line("(function(s) {");
+  emit_line(" var u;");
+  emit_line(" if (typeof Buffer != 'undefined') {");
+  emit_line("  u = new Uint8Array(Buffer.from(s, 'base64'));");
+  emit_line(" } else {");
+  emit_line("  var d = atob(s);");
+  emit_line("  u = new Uint8Array(d.length);");
+  emit_line("  for (var i = 0; i < d.length; i++) u[i] = d.charCodeAt(i);");
+  emit_line(" }");
+  emit_line(" %s.set(new Int32Array(u.buffer));", mem);
+  for (int i = 0; i < g_indent; i++)
+    putchar(' ');
+  printf("})(\"");
+  int b[3];
+  int nb = 0;
+  for (int i = 0; i < size; i++, data = data->next) {
+    uint v = data->v;
+    for (int j = 0; j < 4; j++) {
+      b[nb++] = v % 256;
+      v /= 256;
+      if (nb == 3) {
+        emit_base64_group(b, 3);
+        nb = 0;
+      }
+    }
+  }
+  if (nb) {
+    for (int j = nb; j < 3; j++)
+      b[j] = 0;
+    emit_base64_group(b, nb);
+  }
+  printf("\");\n");
+}
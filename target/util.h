@@ -12,6 +12,7 @@ typedef uint8_t byte;
 
 static const int ELF_TEXT_START = 0x100000;
 static const int ELF_HEADER_SIZE = 84;
+static const int ELF64_HEADER_SIZE = 120;
 
 char* vformat(const char* fmt, va_list ap);
 char* format(const char* fmt, ...);
@@ -27,9 +28,15 @@ void emit_line(const char* fmt, ...);
 
 Op normalize_cond(Op op, bool flip);
 extern const char** reg_names;
+// The number of entries in reg_names, i.e., 7 plus the number of
+// virtual registers named by init_vreg_names().
+extern int num_reg_names;
+
+void init_vreg_names(Module* module);
 const char* value_str(Value* v);
 const char* src_str(Inst* inst);
 const char* cmp_str(Inst* inst, const char* true_str);
+const char* arith_op_str(Op op);
 
 int emit_cnt();
 void emit_reset();
@@ -51,6 +58,12 @@ int emit_chunked_main_loop(Inst* inst,
                            void (*emit_pc_change)(int pc),
                            void (*emit_inst)(Inst* inst));
 
+// Emits a statement which copies the nonzero prefix of |data| into the
+// Int32Array |mem|. The words are in a base64 string of their little
+// endian bytes, which parses much faster than a statement per word.
+void emit_js_data_init(Data* data, const char* mem);
+
 void emit_elf_header(uint16_t machine, uint32_t filesz);
+void emit_elf64_header(uint16_t machine, uint32_t filesz);
 
 #endif  // ELVM_UTIL_H_
@@ -1,3 +1,6 @@
+#include <stdlib.h>
+#include <string.h>
+
 #include <ir/ir.h>
 #include <target/util.h>
 
@@ -10,71 +13,140 @@ static void wasm_init_state(void) {
   emit_line("(import \"env\" \"getchar\" (func $getchar (result i32)))");
   emit_line("(import \"env\" \"putchar\" (func $putchar (param i32)))");
   emit_line("(import \"env\" \"exit\" (func $exit))");
-  for (int i = 0; i < 7; i++) {
+  for (int i = 0; i < num_reg_names; i++) {
     emit_line("(global $%s (mut i32) (i32.const 0))", reg_names[i]);
   }
   emit_line("(memory %d)", WASM_MEM_SIZE_IN_PAGES);
-}
 
-static void wasm_emit_func_prologue(int func_id) {
+  // memory.fill only works on bytes, so words are filled by a loop.
   emit_line("");
-  emit_line("(func $func%d", func_id);
+  emit_line("(func $memset (param $d i32) (param $v i32) (param $n i32)");
   inc_indent();
-  emit_line("(loop $while0");
+  emit_line("(block $done");
   inc_indent();
-  emit_line("(if (i32.and (i32.le_s (i32.const %d) (get_global $pc))",
-            func_id * CHUNKED_FUNC_SIZE);
-  emit_line("             (i32.lt_s (get_global $pc) (i32.const %d)))",
-            (func_id + 1) * CHUNKED_FUNC_SIZE);
+  emit_line("(loop $fill");
   inc_indent();
-  emit_line("(then");
+  emit_line("(br_if $done (i32.eqz (get_local $n)))");
+  emit_line("(i32.store (i32.shl (get_local $d) (i32.const 2)) (get_local $v))");
+  emit_line("(set_local $d (i32.add (get_local $d) (i32.const 1)))");
+  emit_line("(set_local $n (i32.sub (get_local $n) (i32.const 1)))");
+  emit_line("(br $fill)");
+  dec_indent();
+  emit_line(")"); // loop $fill
+  dec_indent();
+  emit_line(")"); // block $done
+  dec_indent();
+  emit_line(")"); // func $memset
+}
+
+static const char* wasm_get_value(Value *v);
+
+// Each chunk of pcs is a function which keeps the registers in locals.
+// Its body is a loop around blocks nested once per pc, and a br_table
+// on pc - base enters the block of the current pc. The code of a pc
+// follows the end of its block, so a jump forward within the chunk is
+// a br to the block of its target, and other jumps re-dispatch or
+// leave the chunk with the pc set.
+
+// The number of pcs in the module.
+static int wasm_num_pcs;
+// The first and the last pc of the current chunk, and the pc whose
+// code is being emitted.
+static int wasm_base_pc;
+static int wasm_last_pc;
+static int wasm_cur_pc;
+
+static void wasm_enter_chunk(int func_id) {
+  wasm_base_pc = func_id * CHUNKED_FUNC_SIZE;
+  wasm_last_pc = wasm_base_pc + CHUNKED_FUNC_SIZE - 1;
+  if (wasm_last_pc >= wasm_num_pcs)
+    wasm_last_pc = wasm_num_pcs - 1;
+  wasm_cur_pc = wasm_base_pc;
+}
+
+static void wasm_emit_func_prologue(int func_id) {
+  wasm_enter_chunk(func_id);
+
+  emit_line("");
+  emit_line("(func $func%d", func_id);
   inc_indent();
-  emit_line("(block $while0body");
+  for (int i = 0; i < num_reg_names; i++) {
+    emit_line("(local $%s i32)", reg_names[i]);
+  }
+  for (int i = 0; i < num_reg_names; i++) {
+    emit_line("(set_local $%s (get_global $%s))", reg_names[i], reg_names[i]);
+  }
+  emit_line("(loop $dispatch");
   inc_indent();
-  // dummy first case
-  emit_line("(if (i32.eq (get_global $pc) (i32.const -1))");
+  emit_line("(block $out");
+  for (int pc = wasm_last_pc; pc >= wasm_base_pc; pc--) {
+    emit_line("(block $L%d", pc);
+  }
   inc_indent();
-  emit_line("(then");
+  emit_line("(br_table");
   inc_indent();
+  for (int pc = wasm_base_pc; pc <= wasm_last_pc; pc++) {
+    emit_line("$L%d", pc);
+  }
+  emit_line("$out");
+  emit_line("(i32.sub (get_local $pc) (i32.const %d)))", wasm_base_pc);
+  dec_indent();
+  dec_indent();
+  emit_line(")"); // block $L{base}
 }
 
 static void wasm_emit_func_epilogue(void) {
-  emit_line("(br $while0body)");
-  dec_indent();
-  emit_line(")"); // then
-  dec_indent();
-  emit_line(")"); // if
-  emit_line("");
-  dec_indent();
-  emit_line(")"); // block $while0body
-  emit_line("(set_global $pc (i32.add (get_global $pc) (i32.const 1)))");
-  emit_line("(br $while0)");
-  dec_indent();
-  emit_line(")"); // then
-  dec_indent();
-  emit_line(")"); // if
+  while (wasm_cur_pc < wasm_last_pc) {
+    emit_line(")"); // block $L{pc}
+    wasm_cur_pc++;
+  }
+  emit_line("(set_local $pc (i32.const %d))", wasm_last_pc + 1);
+  emit_line(")"); // block $out
+  for (int i = 0; i < num_reg_names; i++) {
+    emit_line("(set_global $%s (get_local $%s))", reg_names[i], reg_names[i]);
+  }
   dec_indent();
-  emit_line(")"); // loop $while0
+  emit_line(")"); // loop $dispatch
   dec_indent();
   emit_line(")"); // func
 }
 
 static void wasm_emit_pc_change(int pc) {
-  emit_line("(br $while0body)");
-  dec_indent();
-  emit_line(")"); // then
-  dec_indent();
-  emit_line(")"); // if
-  emit_line("");
-  emit_line("(if (i32.eq (get_global $pc) (i32.const %d))", pc);
-  inc_indent();
-  emit_line("(then");
-  inc_indent();
+  while (wasm_cur_pc < pc) {
+    emit_line(")"); // block $L{pc}
+    wasm_cur_pc++;
+  }
+  emit_line(";; pc %d", pc);
+}
+
+// Emits a jump to |target|, or a conditional one if |cond| is not NULL.
+static void wasm_emit_jmp(const char* cond, Value* target) {
+  if (target->type == IMM && target->imm > wasm_cur_pc &&
+      target->imm <= wasm_last_pc) {
+    if (cond) {
+      emit_line("(br_if $L%d %s)", target->imm, cond);
+    } else {
+      emit_line("(br $L%d)", target->imm);
+    }
+    return;
+  }
+
+  const char* label = "$dispatch";
+  if (target->type == IMM &&
+      (target->imm < wasm_base_pc || target->imm > wasm_last_pc))
+    label = "$out";
+  const char* jmp = format("(set_local $pc %s) (br %s)",
+                           wasm_get_value(target), label);
+  if (cond) {
+    emit_line("(if %s (then %s))", cond, jmp);
+  } else {
+    emit_line("%s", jmp);
+  }
 }
 
 static const char* wasm_get_value(Value *v) {
   if (v->type == REG) {
-    return format("(get_global $%s)", reg_names[v->reg]);
+    return format("(get_local $%s)", reg_names[v->reg]);
   } else if (v->type == IMM) {
     return format("(i32.const %d)", v->imm);
   } else {
@@ -101,33 +173,58 @@ static const char* wasm_cmp_expr(Inst* inst) {
     default:
       error("oops");
   }
-  return format("(%s (get_global $%s) %s)",
+  return format("(%s (get_local $%s) %s)",
                 op_str, reg_names[inst->dst.reg], wasm_get_value(&inst->src));
 }
 
+static const char* wasm_arith_op_str(Op op) {
+  switch (op) {
+    case MUL:
+      return "i32.mul";
+    case DIV:
+      return "i32.div_u";
+    case MOD:
+      return "i32.rem_u";
+    case AND:
+      return "i32.and";
+    case OR:
+      return "i32.or";
+    case XOR:
+      return "i32.xor";
+    case SHL:
+      return "i32.shl";
+    case SHR:
+      return "i32.shr_u";
+    default:
+      error("oops");
+  }
+}
+
 static void wasm_emit_inst(Inst* inst) {
   switch (inst->op) {
   case MOV:
-    emit_line("(set_global $%s %s)", reg_names[inst->dst.reg], wasm_get_value(&inst->src));
+    emit_line("(set_local $%s %s)", reg_names[inst->dst.reg], wasm_get_value(&inst->src));
     break;
 
   case ADD:
-    emit_line("(set_global $%s (i32.and (i32.add (get_global $%s) %s) (i32.const " UINT_MAX_STR ")))",
+    emit_line(inst->no_wrap ? "(set_local $%s (i32.add (get_local $%s) %s))" :
+              "(set_local $%s (i32.and (i32.add (get_local $%s) %s) (i32.const " UINT_MAX_STR ")))",
               reg_names[inst->dst.reg], reg_names[inst->dst.reg], wasm_get_value(&inst->src));
     break;
 
   case SUB:
-    emit_line("(set_global $%s (i32.and (i32.sub (get_global $%s) %s) (i32.const " UINT_MAX_STR ")))",
+    emit_line(inst->no_wrap ? "(set_local $%s (i32.sub (get_local $%s) %s))" :
+              "(set_local $%s (i32.and (i32.sub (get_local $%s) %s) (i32.const " UINT_MAX_STR ")))",
               reg_names[inst->dst.reg], reg_names[inst->dst.reg], wasm_get_value(&inst->src));
     break;
 
   case LOAD:
-    emit_line("(set_global $%s (i32.load (i32.shl %s (i32.const 2))))",
+    emit_line("(set_local $%s (i32.load (i32.shl %s (i32.const 2))))",
               reg_names[inst->dst.reg], wasm_get_value(&inst->src));
     break;
 
   case STORE:
-    emit_line("(i32.store (i32.shl %s (i32.const 2)) (get_global $%s))",
+    emit_line("(i32.store (i32.shl %s (i32.const 2)) (get_local $%s))",
               wasm_get_value(&inst->src), reg_names[inst->dst.reg]);
     break;
 
@@ -136,7 +233,7 @@ static void wasm_emit_inst(Inst* inst) {
     break;
 
   case GETC:
-    emit_line("(set_global $%s (call $getchar))", reg_names[inst->dst.reg]);
+    emit_line("(set_local $%s (call $getchar))", reg_names[inst->dst.reg]);
     break;
 
   case EXIT:
@@ -152,7 +249,44 @@ static void wasm_emit_inst(Inst* inst) {
   case GT:
   case LE:
   case GE:
-    emit_line("(set_global $%s %s)", reg_names[inst->dst.reg], wasm_cmp_expr(inst));
+    emit_line("(set_local $%s %s)", reg_names[inst->dst.reg], wasm_cmp_expr(inst));
+    break;
+
+  case MUL:
+  case DIV:
+  case MOD:
+  case AND:
+  case OR:
+  case XOR:
+    emit_line("(set_local $%s (i32.and (%s (get_local $%s) %s) (i32.const " UINT_MAX_STR ")))",
+              reg_names[inst->dst.reg], wasm_arith_op_str(inst->op),
+              reg_names[inst->dst.reg], wasm_get_value(&inst->src));
+    break;
+
+  case SHL:
+  case SHR:
+    emit_line("(set_local $%s (select (i32.and (%s (get_local $%s) %s) (i32.const " UINT_MAX_STR ")) (i32.const 0) (i32.lt_u %s (i32.const 24))))",
+              reg_names[inst->dst.reg], wasm_arith_op_str(inst->op),
+              reg_names[inst->dst.reg], wasm_get_value(&inst->src),
+              wasm_get_value(&inst->src));
+    break;
+
+  case MEMCPY:
+    emit_line("(memory.copy (i32.shl (get_local $%s) (i32.const 2)) (i32.shl %s (i32.const 2)) (i32.shl %s (i32.const 2)))",
+              reg_names[inst->dst.reg], wasm_get_value(&inst->src),
+              wasm_get_value(&inst->jmp));
+    break;
+
+  case MEMSET:
+    // memory.fill works on bytes, so it can only fill words with zero.
+    if (inst->src.type == IMM && inst->src.imm == 0) {
+      emit_line("(memory.fill (i32.shl (get_local $%s) (i32.const 2)) (i32.const 0) (i32.shl %s (i32.const 2)))",
+                reg_names[inst->dst.reg], wasm_get_value(&inst->jmp));
+      break;
+    }
+    emit_line("(call $memset (get_local $%s) %s %s)",
+              reg_names[inst->dst.reg], wasm_get_value(&inst->src),
+              wasm_get_value(&inst->jmp));
     break;
 
   case JEQ:
@@ -161,13 +295,11 @@ static void wasm_emit_inst(Inst* inst) {
   case JGT:
   case JLE:
   case JGE:
-    emit_line("(if %s (then (set_global $pc %s) (br $while0)))",
-              wasm_cmp_expr(inst), wasm_get_value(&inst->jmp));
+    wasm_emit_jmp(wasm_cmp_expr(inst), &inst->jmp);
     break;
 
   case JMP:
-    emit_line("(set_global $pc %s)", wasm_get_value(&inst->jmp));
-    emit_line("(br $while0)");
+    wasm_emit_jmp(NULL, &inst->jmp);
     break;
 
   default:
@@ -175,7 +307,46 @@ static void wasm_emit_inst(Inst* inst) {
   }
 }
 
+// The initial memory image up to its last nonzero word, as a data
+// segment of little-endian words.
+static void wasm_emit_data(Data* data) {
+  int size = 0;
+  int mp = 0;
+  for (Data* d = data; d; d = d->next, mp++) {
+    if (d->v)
+      size = mp + 1;
+  }
+  if (!size)
+    return;
+
+  emit_line("");
+  emit_line("(data (i32.const 0)");
+  inc_indent();
+  for (mp = 0; mp < size;) {
+    char buf[16 * 12 + 3];
+    char* p = buf;
+    *p++ = '"';
+    for (int i = 0; i < 16 && mp < size; i++, mp++, data = data->next) {
+      int v = data->v;
+      for (int j = 0; j < 4; j++) {
+        *p++ = '\\';
+        *p++ = "0123456789abcdef"[v / 16 % 16];
+        *p++ = "0123456789abcdef"[v % 16];
+        v /= 256;
+      }
+    }
+    *p++ = '"';
+    *p = 0;
+    emit_line("%s", buf);
+  }
+  dec_indent();
+  emit_line(")"); // data
+}
+
 void target_wasm(Module* module) {
+  init_vreg_names(module);
+  for (Inst* inst = module->text; inst; inst = inst->next)
+    wasm_num_pcs = inst->pc + 1;
   wasm_init_state();
 
   int num_funcs = emit_chunked_main_loop(module->text,
@@ -200,16 +371,6 @@ void target_wasm(Module* module) {
   emit_line("");
   emit_line("(func (export \"wasmmain\")");
   inc_indent();
-  emit_line("(local $chunk i32)");
-
-  Data* data = module->data;
-  for (int mp = 0; data; data = data->next, mp++) {
-    if (data->v) {
-      emit_line("(i32.store (i32.shl (i32.const %d) (i32.const 2)) (i32.const %d))", mp, data->v);
-    }
-  }
-
-  emit_line("");
   emit_line("(loop $mainloop");
   inc_indent();
   emit_line("(call_indirect (i32.div_u (get_global $pc) (i32.const %d)))", CHUNKED_FUNC_SIZE);
@@ -219,6 +380,505 @@ void target_wasm(Module* module) {
 
   dec_indent();
   emit_line(")"); // func wasmmain
+
+  wasm_emit_data(module->data);
   dec_indent();
   emit_line(")"); // module
 }
+
+// -wasmbin emits the same module as the above in the binary format.
+// Sections and function bodies are built in WasmBuf as their sizes
+// precede them.
+
+typedef struct {
+  char* buf;
+  int len;
+  int cap;
+} WasmBuf;
+
+// The index of "pc" in reg_names.
+#define WASM_PC 6
+
+// Function indices. The chunks follow these.
+#define WASM_FUNC_GETCHAR 0
+#define WASM_FUNC_PUTCHAR 1
+#define WASM_FUNC_EXIT 2
+#define WASM_FUNC_MEMSET 3
+#define WASM_FUNC_CHUNK0 4
+
+// Type indices.
+#define WASM_TYPE_VOID 0
+#define WASM_TYPE_GETCHAR 1
+#define WASM_TYPE_PUTCHAR 2
+#define WASM_TYPE_MEMSET 3
+
+static WasmBuf wasmbin_code;
+static WasmBuf wasmbin_func;
+
+static void wb_byte(WasmBuf* b, int c) {
+  if (b->len == b->cap) {
+    b->cap = b->cap ? b->cap * 2 : 256;
+    char* buf = malloc(b->cap);
+    memcpy(buf, b->buf, b->len);
+    free(b->buf);
+    b->buf = buf;
+  }
+  b->buf[b->len++] = c;
+}
+
+static void wb_bytes(WasmBuf* b, const char* s, int n) {
+  for (int i = 0; i < n; i++)
+    wb_byte(b, s[i]);
+}
+
+static void wb_uleb(WasmBuf* b, unsigned int v) {
+  while (v >= 128) {
+    wb_byte(b, v % 128 + 128);
+    v /= 128;
+  }
+  wb_byte(b, v);
+}
+
+// Signed LEB128 of a word, which is never negative.
+static void wb_sleb_word(WasmBuf* b, unsigned int v) {
+  while (v >= 64) {
+    wb_byte(b, v % 128 + 128);
+    v /= 128;
+  }
+  wb_byte(b, v);
+}
+
+// Appends |src| with its size.
+static void wb_sized(WasmBuf* b, WasmBuf* src) {
+  wb_uleb(b, src->len);
+  wb_bytes(b, src->buf, src->len);
+}
+
+static void wb_name(WasmBuf* b, const char* s) {
+  wb_uleb(b, strlen(s));
+  wb_bytes(b, s, strlen(s));
+}
+
+static void wb_const(WasmBuf* b, int v) {
+  wb_byte(b, 0x41);
+  wb_sleb_word(b, v);
+}
+
+static void wb_local(WasmBuf* b, int op, int reg) {
+  wb_byte(b, op);
+  wb_uleb(b, reg);
+}
+
+static void wb_value(WasmBuf* b, Value* v) {
+  if (v->type == REG) {
+    wb_local(b, 0x20, v->reg);
+  } else {
+    wb_const(b, v->imm);
+  }
+}
+
+// Pushes the byte address of the word at |v|.
+static void wb_addr(WasmBuf* b, Value* v) {
+  wb_value(b, v);
+  wb_const(b, 2);
+  wb_byte(b, 0x74);  // i32.shl
+}
+
+static void wb_mask(WasmBuf* b) {
+  wb_const(b, 0xffffff);
+  wb_byte(b, 0x71);  // i32.and
+}
+
+static void wasmbin_emit_func_prologue(int func_id) {
+  wasm_enter_chunk(func_id);
+  WasmBuf* b = &wasmbin_func;
+  b->len = 0;
+  // All registers in one run of i32 locals.
+  wb_uleb(b, 1);
+  wb_uleb(b, num_reg_names);
+  wb_byte(b, 0x7f);
+  for (int i = 0; i < num_reg_names; i++) {
+    wb_local(b, 0x23, i);  // global.get
+    wb_local(b, 0x21, i);  // local.set
+  }
+  wb_bytes(b, "\x03\x40", 2);  // loop $dispatch
+  wb_bytes(b, "\x02\x40", 2);  // block $out
+  for (int pc = wasm_last_pc; pc >= wasm_base_pc; pc--)
+    wb_bytes(b, "\x02\x40", 2);  // block $L{pc}
+  wb_local(b, 0x20, WASM_PC);
+  wb_const(b, wasm_base_pc);
+  wb_byte(b, 0x6b);  // i32.sub
+  int n = wasm_last_pc - wasm_base_pc + 1;
+  wb_byte(b, 0x0e);  // br_table
+  wb_uleb(b, n);
+  for (int i = 0; i <= n; i++)
+    wb_uleb(b, i);
+  wb_byte(b, 0x0b);  // end $L{base}
+}
+
+static void wasmbin_emit_func_epilogue(void) {
+  WasmBuf* b = &wasmbin_func;
+  for (; wasm_cur_pc < wasm_last_pc; wasm_cur_pc++)
+    wb_byte(b, 0x0b);  // end $L{pc}
+  wb_const(b, wasm_last_pc + 1);
+  wb_local(b, 0x21, WASM_PC);
+  wb_byte(b, 0x0b);  // end $out
+  for (int i = 0; i < num_reg_names; i++) {
+    wb_local(b, 0x20, i);  // local.get
+    wb_local(b, 0x24, i);  // global.set
+  }
+  wb_byte(b, 0x0b);  // end $dispatch
+  wb_byte(b, 0x0b);  // end func
+  wb_sized(&wasmbin_code, b);
+}
+
+static void wasmbin_emit_pc_change(int pc) {
+  for (; wasm_cur_pc < pc; wasm_cur_pc++)
+    wb_byte(&wasmbin_func, 0x0b);  // end $L{pc}
+}
+
+// The condition, if any, is already on the stack.
+static void wasmbin_emit_jmp(bool cond, Value* target) {
+  WasmBuf* b = &wasmbin_func;
+  if (target->type == IMM && target->imm > wasm_cur_pc &&
+      target->imm <= wasm_last_pc) {
+    wb_byte(b, cond ? 0x0d : 0x0c);  // br_if or br
+    wb_uleb(b, target->imm - wasm_cur_pc - 1);
+    return;
+  }
+
+  // The depth of $out.
+  int depth = wasm_last_pc - wasm_cur_pc;
+  if (target->type == REG ||
+      (target->imm >= wasm_base_pc && target->imm <= wasm_last_pc))
+    depth++;  // $dispatch
+  if (cond) {
+    wb_bytes(b, "\x04\x40", 2);  // if
+    depth++;
+  }
+  wb_value(b, target);
+  wb_local(b, 0x21, WASM_PC);
+  wb_byte(b, 0x0c);  // br
+  wb_uleb(b, depth);
+  if (cond)
+    wb_byte(b, 0x0b);  // end
+}
+
+static int wasmbin_cmp_op(Op op) {
+  switch (normalize_cond(op, 0)) {
+    case JEQ: return 0x46;  // i32.eq
+    case JNE: return 0x47;  // i32.ne
+    case JLT: return 0x48;  // i32.lt_s
+    case JGT: return 0x4a;  // i32.gt_s
+    case JLE: return 0x4c;  // i32.le_s
+    case JGE: return 0x4e;  // i32.ge_s
+    default: error("oops");
+  }
+}
+
+static int wasmbin_arith_op(Op op) {
+  switch (op) {
+    case ADD: return 0x6a;  // i32.add
+    case SUB: return 0x6b;  // i32.sub
+    case MUL: return 0x6c;  // i32.mul
+    case DIV: return 0x6e;  // i32.div_u
+    case MOD: return 0x70;  // i32.rem_u
+    case AND: return 0x71;  // i32.and
+    case OR: return 0x72;  // i32.or
+    case XOR: return 0x73;  // i32.xor
+    case SHL: return 0x74;  // i32.shl
+    case SHR: return 0x76;  // i32.shr_u
+    default: error("oops");
+  }
+}
+
+static void wasmbin_emit_inst(Inst* inst) {
+  WasmBuf* b = &wasmbin_func;
+  int dst = inst->dst.reg;
+  switch (inst->op) {
+  case MOV:
+    wb_value(b, &inst->src);
+    wb_local(b, 0x21, dst);
+    break;
+
+  case ADD:
+  case SUB:
+  case MUL:
+  case DIV:
+  case MOD:
+  case AND:
+  case OR:
+  case XOR:
+    wb_local(b, 0x20, dst);
+    wb_value(b, &inst->src);
+    wb_byte(b, wasmbin_arith_op(inst->op));
+    if (!inst->no_wrap)
+      wb_mask(b);
+    wb_local(b, 0x21, dst);
+    break;
+
+  case SHL:
+  case SHR:
+    wb_local(b, 0x20, dst);
+    wb_value(b, &inst->src);
+    wb_byte(b, wasmbin_arith_op(inst->op));
+    wb_mask(b);
+    wb_const(b, 0);
+    wb_value(b, &inst->src);
+    wb_const(b, 24);
+    wb_byte(b, 0x49);  // i32.lt_u
+    wb_byte(b, 0x1b);  // select
+    wb_local(b, 0x21, dst);
+    break;
+
+  case LOAD:
+    wb_addr(b, &inst->src);
+    wb_bytes(b, "\x28\x02\x00", 3);  // i32.load
+    wb_local(b, 0x21, dst);
+    break;
+
+  case STORE:
+    wb_addr(b, &inst->src);
+    wb_local(b, 0x20, dst);
+    wb_bytes(b, "\x36\x02\x00", 3);  // i32.store
+    break;
+
+  case PUTC:
+    wb_value(b, &inst->src);
+    wb_byte(b, 0x10);
+    wb_uleb(b, WASM_FUNC_PUTCHAR);
+    break;
+
+  case GETC:
+    wb_byte(b, 0x10);
+    wb_uleb(b, WASM_FUNC_GETCHAR);
+    wb_local(b, 0x21, dst);
+    break;
+
+  case EXIT:
+    wb_byte(b, 0x10);
+    wb_uleb(b, WASM_FUNC_EXIT);
+    break;
+
+  case DUMP:
+    break;
+
+  case EQ:
+  case NE:
+  case LT:
+  case GT:
+  case LE:
+  case GE:
+    wb_local(b, 0x20, dst);
+    wb_value(b, &inst->src);
+    wb_byte(b, wasmbin_cmp_op(inst->op));
+    wb_local(b, 0x21, dst);
+    break;
+
+  case MEMCPY:
+    wb_addr(b, &inst->dst);
+    wb_addr(b, &inst->src);
+    wb_addr(b, &inst->jmp);
+    wb_bytes(b, "\xfc\x0a\x00\x00", 4);  // memory.copy
+    break;
+
+  case MEMSET:
+    if (inst->src.type == IMM && inst->src.imm == 0) {
+      wb_addr(b, &inst->dst);
+      wb_const(b, 0);
+      wb_addr(b, &inst->jmp);
+      wb_bytes(b, "\xfc\x0b\x00", 3);  // memory.fill
+      break;
+    }
+    wb_value(b, &inst->dst);
+    wb_value(b, &inst->src);
+    wb_value(b, &inst->jmp);
+    wb_byte(b, 0x10);
+    wb_uleb(b, WASM_FUNC_MEMSET);
+    break;
+
+  case JEQ:
+  case JNE:
+  case JLT:
+  case JGT:
+  case JLE:
+  case JGE:
+    wb_local(b, 0x20, dst);
+    wb_value(b, &inst->src);
+    wb_byte(b, wasmbin_cmp_op(inst->op));
+    wasmbin_emit_jmp(true, &inst->jmp);
+    break;
+
+  case JMP:
+    wasmbin_emit_jmp(false, &inst->jmp);
+    break;
+
+  default:
+    error("oops");
+  }
+}
+
+static void wasmbin_emit_memset(void) {
+  WasmBuf b = {};
+  wb_uleb(&b, 0);  // no locals
+  wb_bytes(&b, "\x02\x40\x03\x40", 4);  // block, loop
+  // br_if 1 (i32.eqz n)
+  wb_local(&b, 0x20, 2);
+  wb_byte(&b, 0x45);
+  wb_bytes(&b, "\x0d\x01", 2);
+  // i32.store (d << 2) v
+  wb_local(&b, 0x20, 0);
+  wb_const(&b, 2);
+  wb_byte(&b, 0x74);
+  wb_local(&b, 0x20, 1);
+  wb_bytes(&b, "\x36\x02\x00", 3);
+  // d++, n--
+  wb_local(&b, 0x20, 0);
+  wb_const(&b, 1);
+  wb_byte(&b, 0x6a);
+  wb_local(&b, 0x21, 0);
+  wb_local(&b, 0x20, 2);
+  wb_const(&b, 1);
+  wb_byte(&b, 0x6b);
+  wb_local(&b, 0x21, 2);
+  wb_bytes(&b, "\x0c\x00\x0b\x0b\x0b", 5);  // br 0, end, end, end
+  wb_sized(&wasmbin_code, &b);
+}
+
+static void wasmbin_emit_main(void) {
+  WasmBuf b = {};
+  wb_uleb(&b, 0);  // no locals
+  wb_bytes(&b, "\x03\x40", 2);  // loop
+  wb_local(&b, 0x23, WASM_PC);
+  wb_const(&b, CHUNKED_FUNC_SIZE);
+  wb_byte(&b, 0x6e);  // i32.div_u
+  wb_byte(&b, 0x11);  // call_indirect
+  wb_uleb(&b, WASM_TYPE_VOID);
+  wb_byte(&b, 0);
+  wb_bytes(&b, "\x0c\x00\x0b\x0b", 4);  // br 0, end, end
+  wb_sized(&wasmbin_code, &b);
+}
+
+static void wasmbin_emit_section(int id, WasmBuf* b) {
+  emit_1(id);
+  WasmBuf size = {};
+  wb_uleb(&size, b->len);
+  for (int i = 0; i < size.len; i++)
+    emit_1(size.buf[i] & 255);
+  for (int i = 0; i < b->len; i++)
+    emit_1(b->buf[i] & 255);
+  b->len = 0;
+}
+
+void target_wasmbin(Module* module) {
+  init_vreg_names(module);
+  for (Inst* inst = module->text; inst; inst = inst->next)
+    wasm_num_pcs = inst->pc + 1;
+
+  // The code section holds memset, the chunks, and wasmmain.
+  wasmbin_code.len = 0;
+  wasmbin_emit_memset();
+  int num_funcs = emit_chunked_main_loop(module->text,
+                                         wasmbin_emit_func_prologue,
+                                         wasmbin_emit_func_epilogue,
+                                         wasmbin_emit_pc_change,
+                                         wasmbin_emit_inst);
+  wasmbin_emit_main();
+  WasmBuf code = wasmbin_code;
+
+  emit_reset();
+  emit_start();
+  emit_4(0, 'a', 's', 'm');
+  emit_4(1, 0, 0, 0);
+
+  WasmBuf b = {};
+  wb_uleb(&b, 4);
+  wb_bytes(&b, "\x60\x00\x00", 3);  // () -> ()
+  wb_bytes(&b, "\x60\x00\x01\x7f", 4);  // () -> i32
+  wb_bytes(&b, "\x60\x01\x7f\x00", 4);  // (i32) -> ()
+  wb_bytes(&b, "\x60\x03\x7f\x7f\x7f\x00", 6);  // (i32 i32 i32) -> ()
+  wasmbin_emit_section(1, &b);
+
+  wb_uleb(&b, 3);
+  wb_name(&b, "env");
+  wb_name(&b, "getchar");
+  wb_byte(&b, 0);
+  wb_uleb(&b, WASM_TYPE_GETCHAR);
+  wb_name(&b, "env");
+  wb_name(&b, "putchar");
+  wb_byte(&b, 0);
+  wb_uleb(&b, WASM_TYPE_PUTCHAR);
+  wb_name(&b, "env");
+  wb_name(&b, "exit");
+  wb_byte(&b, 0);
+  wb_uleb(&b, WASM_TYPE_VOID);
+  wasmbin_emit_section(2, &b);
+
+  wb_uleb(&b, num_funcs + 2);
+  wb_uleb(&b, WASM_TYPE_MEMSET);
+  for (int i = 0; i < num_funcs + 1; i++)
+    wb_uleb(&b, WASM_TYPE_VOID);
+  wasmbin_emit_section(3, &b);
+
+  // One funcref table for the chunks.
+  wb_uleb(&b, 1);
+  wb_bytes(&b, "\x70\x00", 2);
+  wb_uleb(&b, num_funcs);
+  wasmbin_emit_section(4, &b);
+
+  wb_uleb(&b, 1);
+  wb_byte(&b, 0);
+  wb_uleb(&b, WASM_MEM_SIZE_IN_PAGES);
+  wasmbin_emit_section(5, &b);
+
+  wb_uleb(&b, num_reg_names);
+  for (int i = 0; i < num_reg_names; i++) {
+    wb_bytes(&b, "\x7f\x01", 2);  // mut i32
+    wb_const(&b, 0);
+    wb_byte(&b, 0x0b);
+  }
+  wasmbin_emit_section(6, &b);
+
+  wb_uleb(&b, 1);
+  wb_name(&b, "wasmmain");
+  wb_byte(&b, 0);
+  wb_uleb(&b, WASM_FUNC_CHUNK0 + num_funcs);
+  wasmbin_emit_section(7, &b);
+
+  wb_uleb(&b, 1);
+  wb_byte(&b, 0);
+  wb_const(&b, 0);
+  wb_byte(&b, 0x0b);
+  wb_uleb(&b, num_funcs);
+  for (int i = 0; i < num_funcs; i++)
+    wb_uleb(&b, WASM_FUNC_CHUNK0 + i);
+  wasmbin_emit_section(9, &b);
+
+  wb_uleb(&b, num_funcs + 2);
+  wb_bytes(&b, code.buf, code.len);
+  wasmbin_emit_section(10, &b);
+
+  // The initial memory image up to its last nonzero word.
+  int size = 0;
+  int mp = 0;
+  for (Data* d = module->data; d; d = d->next, mp++) {
+    if (d->v)
+      size = mp + 1;
+  }
+  if (size) {
+    wb_uleb(&b, 1);
+    wb_byte(&b, 0);
+    wb_const(&b, 0);
+    wb_byte(&b, 0x0b);
+    wb_uleb(&b, size * 4);
+    Data* data = module->data;
+    for (mp = 0; mp < size; mp++, data = data->next) {
+      int v = data->v;
+      for (int i = 0; i < 4; i++) {
+        wb_byte(&b, v % 256);
+        v /= 256;
+      }
+    }
+    wasmbin_emit_section(11, &b);
+  }
+}
@@ -2,6 +2,7 @@
 
 #include <stdbool.h>
 
+#include <ir/func.h>
 #include <ir/ir.h>
 #include <target/util.h>
 
@@ -210,21 +211,23 @@ static void ws_emit_jmp(Inst* inst, WsOp op, int reg_jmp) {
   }
 }
 
-static void ws_emit_reg_jmp_table(int min_pc, int max_pc, int last_label) {
-  if (min_pc + 1 == max_pc) {
+// Binary search over the address-taken pcs in pcs[lo, hi).
+static void ws_emit_reg_jmp_table(int* pcs, int lo, int hi, int last_label) {
+  if (lo + 1 >= hi) {
     ws_emit(WS_DISCARD);
-    ws_emit_op(WS_JMP, min_pc);
+    if (lo < hi)
+      ws_emit_op(WS_JMP, pcs[lo]);
     return;
   }
 
-  int mid_pc = (min_pc + max_pc) / 2;
+  int mid = (lo + hi) / 2;
   ws_emit(WS_DUP);
-  ws_emit_op(WS_PUSH, mid_pc);
+  ws_emit_op(WS_PUSH, pcs[mid]);
   ws_emit(WS_SUB);
-  ws_emit_op(WS_JN, last_label + mid_pc);
-  ws_emit_reg_jmp_table(mid_pc, max_pc, last_label);
-  ws_emit_op(WS_MARK, last_label + mid_pc);
-  ws_emit_reg_jmp_table(min_pc, mid_pc, last_label);
+  ws_emit_op(WS_JN, last_label + mid);
+  ws_emit_reg_jmp_table(pcs, mid, hi, last_label);
+  ws_emit_op(WS_MARK, last_label + mid);
+  ws_emit_reg_jmp_table(pcs, lo, mid, last_label);
 }
 
 static void init_state_ws(Data* data) {
@@ -327,6 +330,8 @@ void target_ws(Module* module) {
     }
   }
 
+  int num_taken;
+  int* taken = get_addr_taken_pcs(module, &num_taken);
   ws_emit_op(WS_MARK, reg_jmp);
-  ws_emit_reg_jmp_table(0, reg_jmp, label);
+  ws_emit_reg_jmp_table(taken, 0, num_taken, label);
 }
@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include <ir/func.h>
 #include <ir/ir.h>
 #include <target/util.h>
 
@@ -48,6 +49,8 @@ static void emit_mov_imm(Reg dst, int src) {
 static void emit_mov(Reg dst, Value* src) {
   if (src->type == REG) {
     emit_mov_reg(dst, src->reg);
+  } else if (src->imm == 0) {
+    emit_zero_reg(dst);
   } else {
     emit_mov_imm(dst, src->imm);
   }
@@ -62,31 +65,389 @@ static void emit_cmp_x86(Inst* inst) {
   }
 }
 
-static void emit_setcc(Inst* inst, int op) {
+// The condition codes of comparisons and conditional jumps.
+static int x86_cc(Op op) {
+  switch (op) {
+    case EQ: case JEQ: return 0x4;
+    case NE: case JNE: return 0x5;
+    case LT: case JLT: return 0xc;
+    case GT: case JGT: return 0xf;
+    case LE: case JLE: return 0xe;
+    case GE: case JGE: return 0xd;
+    default: error("oops");
+  }
+}
+
+static void emit_setcc(Inst* inst) {
   emit_cmp_x86(inst);
+  // mov, not xor, to keep the flags.
   emit_mov_imm(inst->dst.reg, 0);
-  emit_3(0x0f, op, 0xc0 + REGNO[inst->dst.reg]);
+  emit_3(0x0f, 0x90 + x86_cc(inst->op), 0xc0 + REGNO[inst->dst.reg]);
+}
+
+// Jumps are laid out three times. The first layout uses rel32 for all
+// jumps to immediate pcs. Then the jumps whose displacements fit in
+// rel8 in that layout get the short encoding, which only brings code
+// closer together, and the last two layouts use the same choices.
+// These are indexed by the position of the jump in the text.
+static int* x86_jmp_addrs;
+static bool* x86_short_jmps;
+
+// A JEQ or JNE which tests the result of the comparison just before it
+// against zero can use the flags of that comparison. Returns the
+// condition code of such a jump, or -1.
+static int x86_fused_cc(Inst* prev, Inst* inst) {
+  if (!prev || prev->pc != inst->pc || prev->op < EQ || prev->op > GE)
+    return -1;
+  if ((inst->op != JEQ && inst->op != JNE) || inst->dst.reg != prev->dst.reg ||
+      inst->src.type != IMM || inst->src.imm != 0)
+    return -1;
+  int cc = x86_cc(prev->op);
+  return inst->op == JNE ? cc : cc ^ 1;
 }
 
-static void emit_jcc(Inst* inst, int op, int* pc2addr, int rodata_addr) {
-  if (op) {
-    emit_cmp_x86(inst);
-    emit_2(op, inst->jmp.type == REG ? 7 : 5);
+// The jump table covers only the range of address-taken pcs, so
+// rodata_addr is the address of the entry for pc 0 even though it may
+// lie outside the table.
+static void emit_jcc(Inst* inst, int idx, int fused_cc,
+                     int* pc2addr, int rodata_addr) {
+  int cc = -1;
+  if (inst->op != JMP) {
+    if (fused_cc >= 0) {
+      cc = fused_cc;
+    } else {
+      emit_cmp_x86(inst);
+      cc = x86_cc(inst->op);
+    }
   }
 
   if (inst->jmp.type == REG) {
+    if (cc >= 0)
+      emit_2(0x70 + (cc ^ 1), 7);
     emit_3(0xff, 0x24, 0x85 + (REGNO[inst->jmp.reg] * 8));
     emit_le(rodata_addr);
+    return;
+  }
+
+  x86_jmp_addrs[idx] = emit_cnt();
+  int target = pc2addr[inst->jmp.imm];
+  if (x86_short_jmps[idx]) {
+    emit_2(cc >= 0 ? 0x70 + cc : 0xeb, (target - emit_cnt() - 2) & 255);
+  } else if (cc >= 0) {
+    emit_2(0x0f, 0x80 + cc);
+    emit_diff(target, emit_cnt() + 4);
   } else {
     emit_1(0xe9);
-    emit_diff(pc2addr[inst->jmp.imm], emit_cnt() + 4);
+    emit_diff(target, emit_cnt() + 4);
+  }
+}
+
+static void emit_mask_x86(Reg r) {
+  emit_2(0x81, 0xe0 + REGNO[r]);
+  emit_le(0xffffff);
+}
+
+static void emit_bitop_x86(Inst* inst, int op, int ext) {
+  if (inst->src.type == REG) {
+    emit_1(op);
+    emit_reg2(inst->dst.reg, inst->src.reg);
+  } else {
+    emit_2(0x81, 0xc0 + ext * 8 + REGNO[inst->dst.reg]);
+    emit_le(inst->src.imm);
+  }
+}
+
+static void emit_divmod_x86(Inst* inst) {
+  Reg dst = inst->dst.reg;
+  if (inst->src.type == REG) {
+    // push src
+    emit_1(0x50 + REGNO[inst->src.reg]);
+  } else {
+    // push imm32
+    emit_1(0x68);
+    emit_le(inst->src.imm);
   }
+  // push EAX, EDX
+  emit_2(0x50, 0x52);
+  emit_mov_reg(A, dst);
+  emit_zero_reg(D);
+  // div dword [ESP+8]
+  emit_4(0xf7, 0x74, 0x24, 0x08);
+  // mov [ESP+8], EAX or EDX
+  emit_4(0x89, inst->op == DIV ? 0x44 : 0x54, 0x24, 0x08);
+  // pop EDX, EAX
+  emit_2(0x5a, 0x58);
+  // pop dst
+  emit_1(0x58 + REGNO[dst]);
 }
 
-static void init_state_x86(Data* data) {
+static void emit_shift_x86(Inst* inst) {
+  Reg dst = inst->dst.reg;
+  int ext = inst->op == SHL ? 4 : 5;
+  if (inst->src.type == IMM) {
+    if (inst->src.imm >= 24) {
+      emit_zero_reg(dst);
+    } else {
+      emit_3(0xc1, 0xc0 + ext * 8 + REGNO[dst], inst->src.imm);
+    }
+  } else {
+    // push ECX, dst
+    emit_2(0x51, 0x50 + REGNO[dst]);
+    emit_mov_reg(C, inst->src.reg);
+    // shl/shr dword [ESP], CL
+    emit_3(0xd3, 0x04 + ext * 8, 0x24);
+    // cmp ECX, 24
+    emit_3(0x83, 0xf9, 0x18);
+    // jb +7
+    emit_2(0x72, 0x07);
+    // mov dword [ESP], 0
+    emit_3(0xc7, 0x04, 0x24);
+    emit_le(0);
+    // pop dst
+    emit_1(0x58 + REGNO[dst]);
+    if (dst == C) {
+      // add ESP, 4
+      emit_3(0x83, 0xc4, 0x04);
+    } else {
+      // pop ECX
+      emit_1(0x59);
+    }
+  }
+  if (inst->op == SHL)
+    emit_mask_x86(dst);
+}
+
+static void emit_push_x86(Value* v) {
+  if (v->type == REG) {
+    emit_1(0x50 + REGNO[v->reg]);
+  } else {
+    // push imm32
+    emit_1(0x68);
+    emit_le(v->imm);
+  }
+}
+
+// Uses REP MOVSD or REP STOSD. The operands go through the stack as
+// they may live in the registers the string instructions use.
+static void emit_mem_x86(Inst* inst) {
+  if (inst->op == MEMCPY) {
+    // push ESI, EDI, ECX
+    emit_3(0x56, 0x57, 0x51);
+  } else {
+    // push EAX, EDI, ECX
+    emit_3(0x50, 0x57, 0x51);
+  }
+  emit_push_x86(&inst->jmp);
+  emit_push_x86(&inst->src);
+  emit_push_x86(&inst->dst);
+  // pop EDI
+  emit_1(0x5f);
+  // lea EDI, [ESI+EDI*4]
+  emit_3(0x8d, 0x3c, 0xbe);
+  if (inst->op == MEMCPY) {
+    // pop ECX
+    emit_1(0x59);
+    // lea ESI, [ESI+ECX*4]
+    emit_3(0x8d, 0x34, 0x8e);
+    // pop ECX
+    emit_1(0x59);
+    // rep movsd
+    emit_2(0xf3, 0xa5);
+    // pop ECX, EDI, ESI
+    emit_3(0x59, 0x5f, 0x5e);
+  } else {
+    // pop EAX, ECX
+    emit_2(0x58, 0x59);
+    // rep stosd
+    emit_2(0xf3, 0xab);
+    // pop ECX, EDI, EAX
+    emit_3(0x59, 0x5f, 0x58);
+  }
+}
+
+// I/O goes through buffers placed after the 2^24 words of memory, at
+// these offsets from ESI + (1<<26). PUTC, GETC, and EXIT call the
+// routines emitted by emit_runtime_x86.
+#define X86_IO_BUF_SIZE 4096
+#define X86_OUT_LEN 0
+#define X86_IN_POS 4
+#define X86_IN_LEN 8
+#define X86_OUT_BUF 16
+#define X86_IN_BUF (X86_OUT_BUF + X86_IO_BUF_SIZE)
+#define X86_IO_SIZE (X86_IN_BUF + X86_IO_BUF_SIZE)
+
+enum {
+  X86_RT_FLUSH, X86_RT_FLUSH_LOOP, X86_RT_FLUSH_END,
+  X86_RT_PUTC, X86_RT_PUTC_DONE,
+  X86_RT_GETC, X86_RT_GETC_HAVE, X86_RT_GETC_EOF,
+  X86_RT_END, X86_RT_NUM_LABELS
+};
+
+// Addresses of the labels in the routines. As with pc2addr, the
+// first pass records them and the second pass jumps forward to them.
+static int x86_rt_addrs[X86_RT_NUM_LABELS];
+
+static void x86_rt_label(int label) {
+  x86_rt_addrs[label] = emit_cnt();
+}
+
+static void x86_rt_jcc8(int op, int label) {
+  emit_2(op, (x86_rt_addrs[label] - emit_cnt() - 2) & 255);
+}
+
+static void x86_rt_call(int label) {
+  emit_1(0xe8);
+  emit_diff(x86_rt_addrs[label], emit_cnt() + 4);
+}
+
+// The disp32 of [ESI+(1<<26)+off], spelled out in bytes as it does
+// not fit in 24 bits.
+static void emit_io_disp(int off) {
+  emit_4(off % 256, off / 256, 0, 4);
+}
+
+static void emit_runtime_x86(void) {
+  // jmp over the routines
+  emit_1(0xe9);
+  emit_diff(x86_rt_addrs[X86_RT_END], emit_cnt() + 4);
+
+  // flush: writes out the output buffer. Keeps all registers.
+  x86_rt_label(X86_RT_FLUSH);
+  // pushad
+  emit_1(0x60);
+  // mov EDX, [OUT_LEN]
+  emit_2(0x8b, 0x96);
+  emit_io_disp(X86_OUT_LEN);
+  // lea ECX, [OUT_BUF]
+  emit_2(0x8d, 0x8e);
+  emit_io_disp(X86_OUT_BUF);
+  x86_rt_label(X86_RT_FLUSH_LOOP);
+  // test EDX, EDX
+  emit_2(0x85, 0xd2);
+  // jle end
+  x86_rt_jcc8(0x7e, X86_RT_FLUSH_END);
+  emit_mov_imm(B, 1);  // stdout
+  emit_mov_imm(A, 4);  // write
+  emit_int80();
+  // test EAX, EAX
+  emit_2(0x85, 0xc0);
+  // jle end
+  x86_rt_jcc8(0x7e, X86_RT_FLUSH_END);
+  // add ECX, EAX
+  emit_2(0x01, 0xc1);
+  // sub EDX, EAX
+  emit_2(0x29, 0xc2);
+  // jmp loop
+  x86_rt_jcc8(0xeb, X86_RT_FLUSH_LOOP);
+  x86_rt_label(X86_RT_FLUSH_END);
+  // mov dword [OUT_LEN], 0
+  emit_2(0xc7, 0x86);
+  emit_io_disp(X86_OUT_LEN);
+  emit_le(0);
+  // popad; ret
+  emit_2(0x61, 0xc3);
+
+  // putc: appends the byte pushed by the caller to the output buffer.
+  x86_rt_label(X86_RT_PUTC);
+  // push EAX, ECX
+  emit_2(0x50, 0x51);
+  // mov EAX, [ESP+12]
+  emit_4(0x8b, 0x44, 0x24, 0x0c);
+  // mov ECX, [OUT_LEN]
+  emit_2(0x8b, 0x8e);
+  emit_io_disp(X86_OUT_LEN);
+  // mov [OUT_BUF+ECX], AL
+  emit_3(0x88, 0x84, 0x0e);
+  emit_io_disp(X86_OUT_BUF);
+  // inc ECX
+  emit_1(0x41);
+  // mov [OUT_LEN], ECX
+  emit_2(0x89, 0x8e);
+  emit_io_disp(X86_OUT_LEN);
+  // cmp ECX, X86_IO_BUF_SIZE
+  emit_2(0x81, 0xf9);
+  emit_le(X86_IO_BUF_SIZE);
+  // jb done
+  x86_rt_jcc8(0x72, X86_RT_PUTC_DONE);
+  x86_rt_call(X86_RT_FLUSH);
+  x86_rt_label(X86_RT_PUTC_DONE);
+  // pop ECX, EAX
+  emit_2(0x59, 0x58);
+  // ret 4
+  emit_3(0xc2, 0x04, 0x00);
+
+  // getc: stores the next input byte into the slot the caller pushed,
+  // which is left as zero at EOF.
+  x86_rt_label(X86_RT_GETC);
+  // pushad
+  emit_1(0x60);
+  // mov ECX, [IN_POS]
+  emit_2(0x8b, 0x8e);
+  emit_io_disp(X86_IN_POS);
+  // cmp ECX, [IN_LEN]
+  emit_2(0x3b, 0x8e);
+  emit_io_disp(X86_IN_LEN);
+  // jb have
+  x86_rt_jcc8(0x72, X86_RT_GETC_HAVE);
+  // Show the output before a read which may block.
+  x86_rt_call(X86_RT_FLUSH);
+  emit_mov_imm(B, 0);  // stdin
+  // lea ECX, [IN_BUF]
+  emit_2(0x8d, 0x8e);
+  emit_io_disp(X86_IN_BUF);
+  emit_mov_imm(D, X86_IO_BUF_SIZE);
+  emit_mov_imm(A, 3);  // read
+  emit_int80();
+  // xor ECX, ECX
+  emit_2(0x31, 0xc9);
+  // mov [IN_POS], ECX
+  emit_2(0x89, 0x8e);
+  emit_io_disp(X86_IN_POS);
+  // mov [IN_LEN], ECX
+  emit_2(0x89, 0x8e);
+  emit_io_disp(X86_IN_LEN);
+  // test EAX, EAX
+  emit_2(0x85, 0xc0);
+  // jle eof
+  x86_rt_jcc8(0x7e, X86_RT_GETC_EOF);
+  // mov [IN_LEN], EAX
+  emit_2(0x89, 0x86);
+  emit_io_disp(X86_IN_LEN);
+  x86_rt_label(X86_RT_GETC_HAVE);
+  // movzx EAX, byte [IN_BUF+ECX]
+  emit_4(0x0f, 0xb6, 0x84, 0x0e);
+  emit_io_disp(X86_IN_BUF);
+  // inc ECX
+  emit_1(0x41);
+  // mov [IN_POS], ECX
+  emit_2(0x89, 0x8e);
+  emit_io_disp(X86_IN_POS);
+  // mov [ESP+36], EAX
+  emit_4(0x89, 0x44, 0x24, 0x24);
+  x86_rt_label(X86_RT_GETC_EOF);
+  // popad; ret
+  emit_2(0x61, 0xc3);
+
+  x86_rt_label(X86_RT_END);
+}
+
+// The number of words in the initial memory image, up to the last
+// nonzero one.
+static int x86_data_size(Data* data) {
+  int size = 0;
+  for (int mp = 0; data; data = data->next, mp++) {
+    if (data->v)
+      size = mp + 1;
+  }
+  return size;
+}
+
+// The initial memory image is appended to the file after the jump
+// table and copied from |data_addr| to the mmap'd memory.
+static void init_state_x86(int data_addr, int data_size) {
   emit_mov_imm(B, 0);
-  // mov ECX, 1<<26
-  emit_5(0xb8 + REGNO[C], 0, 0, 0, 4);
+  // mov ECX, (1<<26) + X86_IO_SIZE
+  emit_5(0xb8 + REGNO[C], X86_IO_SIZE % 256, X86_IO_SIZE / 256, 0, 4);
   emit_mov_imm(D, 3);  // PROT_READ | PROT_WRITE
   emit_mov_imm(ESI, 0x22);  // MAP_PRIVATE | MAP_ANONYMOUS
   // mov EDI, 0xffffffff
@@ -95,27 +456,25 @@ static void init_state_x86(Data* data) {
   emit_mov_imm(A, 192);  // mmap2
   emit_int80();
 
+  emit_mov_reg(EDI, A);
+  emit_mov_imm(ESI, data_addr);
+  emit_mov_imm(C, data_size);
+  // rep movsd
+  emit_2(0xf3, 0xa5);
   emit_mov_reg(ESI, A);
 
-  for (int mp = 0; data; data = data->next, mp++) {
-    if (data->v) {
-      // mov dword [EAX+mp*4], data->v
-      emit_2(0xc7, 0x80);
-      emit_le(mp * 4);
-      emit_le(data->v);
-    }
-  }
-
-  // mov ESP, 1<<24
-  emit_5(0xb8 + REGNO[SP], 0, 0, 0, 1);
+  emit_zero_reg(SP);
   emit_zero_reg(A);
   emit_zero_reg(B);
   emit_zero_reg(C);
   emit_zero_reg(D);
   emit_zero_reg(BP);
+
+  emit_runtime_x86();
 }
 
-static void x86_emit_inst(Inst* inst, int* pc2addr, int rodata_addr) {
+static void x86_emit_inst(Inst* inst, int idx, int fused_cc,
+                          int* pc2addr, int rodata_addr) {
   switch (inst->op) {
     case MOV:
       emit_mov(inst->dst.reg, &inst->src);
@@ -129,8 +488,10 @@ static void x86_emit_inst(Inst* inst, int* pc2addr, int rodata_addr) {
         emit_2(0x81, 0xc0 + REGNO[inst->dst.reg]);
         emit_le(inst->src.imm);
       }
-      emit_2(0x81, 0xe0 + REGNO[inst->dst.reg]);
-      emit_le(0xffffff);
+      if (!inst->no_wrap) {
+        emit_2(0x81, 0xe0 + REGNO[inst->dst.reg]);
+        emit_le(0xffffff);
+      }
       break;
 
     case SUB:
@@ -141,8 +502,10 @@ static void x86_emit_inst(Inst* inst, int* pc2addr, int rodata_addr) {
         emit_2(0x81, 0xe8 + REGNO[inst->dst.reg]);
         emit_le(inst->src.imm);
       }
-      emit_2(0x81, 0xe0 + REGNO[inst->dst.reg]);
-      emit_le(0xffffff);
+      if (!inst->no_wrap) {
+        emit_2(0x81, 0xe0 + REGNO[inst->dst.reg]);
+        emit_le(0xffffff);
+      }
       break;
 
     case LOAD:
@@ -162,51 +525,20 @@ static void x86_emit_inst(Inst* inst, int* pc2addr, int rodata_addr) {
       break;
 
     case PUTC:
-      // push EDI
-      emit_1(0x57);
-      emit_mov(EDI, &inst->src);
-      // push EAX, ECX, EDX, EBX, EDI
-      emit_5(0x50, 0x51, 0x52, 0x53, 0x57);
-      emit_mov_imm(B, 1);  // stdout
-      emit_mov_reg(C, ESP);
-      emit_mov_imm(D, 1);
-      emit_mov_imm(A, 4);  // write
-      emit_int80();
-      // pop EDI, EBX, EDX, ECX, EAX
-      emit_5(0x5f, 0x5b, 0x5a, 0x59, 0x58);
-      // pop EDI
-      emit_1(0x5f);
+      emit_push_x86(&inst->src);
+      x86_rt_call(X86_RT_PUTC);
       break;
 
     case GETC:
-      // push EDI
-      emit_1(0x57);
-      // push EAX, ECX, EDX, EBX
-      emit_4(0x50, 0x51, 0x52, 0x53);
       // push 0
       emit_2(0x6a, 0x00);
-      emit_mov_imm(B, 0);  // stdin
-      emit_mov_reg(C, ESP);
-      emit_mov_imm(D, 1);
-      emit_mov_imm(A, 3);  // read
-      emit_int80();
-
-      // pop EDI
-      emit_1(0x5f);
-      emit_mov_imm(B, 0);
-      // cmp EAX, 1
-      emit_3(0x83, 0xf8, 0x01);
-      // cmovnz EDI, EBX
-      emit_3(0x0f, 0x45, 0xfb);
-
-      // pop EBX, EDX, ECX, EAX
-      emit_4(0x5b, 0x5a, 0x59, 0x58);
-      emit_mov_reg(inst->dst.reg, EDI);
-      // pop EDI
-      emit_1(0x5f);
+      x86_rt_call(X86_RT_GETC);
+      // pop dst
+      emit_1(0x58 + REGNO[inst->dst.reg]);
       break;
 
     case EXIT:
+      x86_rt_call(X86_RT_FLUSH);
       emit_mov_imm(B, 0);
       emit_mov_imm(A, 1);  // exit
       emit_int80();
@@ -215,56 +547,62 @@ static void x86_emit_inst(Inst* inst, int* pc2addr, int rodata_addr) {
     case DUMP:
       break;
 
-    case EQ:
-      emit_setcc(inst, 0x94);
+    case MUL:
+      if (inst->src.type == REG) {
+        // imul dst, src
+        emit_3(0x0f, 0xaf, modr(inst->src.reg, inst->dst.reg));
+      } else {
+        // imul dst, dst, imm32
+        emit_2(0x69, modr(inst->dst.reg, inst->dst.reg));
+        emit_le(inst->src.imm);
+      }
+      emit_mask_x86(inst->dst.reg);
       break;
 
-    case NE:
-      emit_setcc(inst, 0x95);
+    case DIV:
+    case MOD:
+      emit_divmod_x86(inst);
       break;
 
-    case LT:
-      emit_setcc(inst, 0x9c);
+    case AND:
+      emit_bitop_x86(inst, 0x21, 4);
       break;
 
-    case GT:
-      emit_setcc(inst, 0x9f);
+    case OR:
+      emit_bitop_x86(inst, 0x09, 1);
       break;
 
-    case LE:
-      emit_setcc(inst, 0x9e);
+    case XOR:
+      emit_bitop_x86(inst, 0x31, 6);
       break;
 
-    case GE:
-      emit_setcc(inst, 0x9d);
+    case SHL:
+    case SHR:
+      emit_shift_x86(inst);
       break;
 
-    case JEQ:
-      emit_jcc(inst, 0x75, pc2addr, rodata_addr);
+    case MEMCPY:
+    case MEMSET:
+      emit_mem_x86(inst);
       break;
 
-    case JNE:
-      emit_jcc(inst, 0x74, pc2addr, rodata_addr);
+    case EQ:
+    case NE:
+    case LT:
+    case GT:
+    case LE:
+    case GE:
+      emit_setcc(inst);
       break;
 
+    case JEQ:
+    case JNE:
     case JLT:
-      emit_jcc(inst, 0x7d, pc2addr, rodata_addr);
-      break;
-
     case JGT:
-      emit_jcc(inst, 0x7e, pc2addr, rodata_addr);
-      break;
-
     case JLE:
-      emit_jcc(inst, 0x7f, pc2addr, rodata_addr);
-      break;
-
     case JGE:
-      emit_jcc(inst, 0x7c, pc2addr, rodata_addr);
-      break;
-
     case JMP:
-      emit_jcc(inst, 0, pc2addr, rodata_addr);
+      emit_jcc(inst, idx, fused_cc, pc2addr, rodata_addr);
       break;
 
     default:
@@ -272,9 +610,31 @@ static void x86_emit_inst(Inst* inst, int* pc2addr, int rodata_addr) {
   }
 }
 
+// Lays out or emits the text, recording the address of each pc.
+static void x86_emit_text(Module* module, int* pc2addr, int rodata_addr) {
+  Inst* prev = NULL;
+  int idx = 0;
+  for (Inst* inst = module->text; inst; inst = inst->next, idx++) {
+    if (!prev || prev->pc != inst->pc) {
+      pc2addr[inst->pc] = emit_cnt();
+    }
+    x86_emit_inst(inst, idx, x86_fused_cc(prev, inst), pc2addr, rodata_addr);
+    prev = inst;
+  }
+}
+
+static void x86_choose_short_jmps(Module* module, int* pc2addr) {
+  int idx = 0;
+  for (Inst* inst = module->text; inst; inst = inst->next, idx++) {
+    if (inst->op < JEQ || inst->op > JMP || inst->jmp.type != IMM)
+      continue;
+    int disp = pc2addr[inst->jmp.imm] - (x86_jmp_addrs[idx] + 2);
+    x86_short_jmps[idx] = disp >= -128 && disp < 128;
+  }
+}
+
 void target_x86(Module* module) {
-  emit_reset();
-  init_state_x86(module->data);
+  int data_size = x86_data_size(module->data);
 
   int pc_cnt = 0;
   for (Inst* inst = module->text; inst; inst = inst->next) {
@@ -282,28 +642,40 @@ void target_x86(Module* module) {
   }
 
   int* pc2addr = calloc(pc_cnt, sizeof(int));
-  int prev_pc = -1;
-  for (Inst* inst = module->text; inst; inst = inst->next) {
-    if (prev_pc != inst->pc) {
-      pc2addr[inst->pc] = emit_cnt();
-    }
-    prev_pc = inst->pc;
-    x86_emit_inst(inst, pc2addr, 0);
-  }
+  x86_jmp_addrs = calloc(pc_cnt, sizeof(int));
+  x86_short_jmps = calloc(pc_cnt, sizeof(bool));
+
+  emit_reset();
+  init_state_x86(0, data_size);
+  x86_emit_text(module, pc2addr, 0);
+  x86_choose_short_jmps(module, pc2addr);
+
+  emit_reset();
+  init_state_x86(0, data_size);
+  x86_emit_text(module, pc2addr, 0);
+
+  int num_taken;
+  int* taken = get_addr_taken_pcs(module, &num_taken);
+  int table_start = num_taken ? taken[0] : 0;
+  int table_end = num_taken ? taken[num_taken - 1] + 1 : 0;
+  int rodata_addr = (ELF_TEXT_START + emit_cnt() + ELF_HEADER_SIZE -
+                     table_start * 4);
 
-  int rodata_addr = ELF_TEXT_START + emit_cnt() + ELF_HEADER_SIZE;
+  int data_addr = rodata_addr + table_end * 4;
 
-  emit_elf_header(3, emit_cnt() + pc_cnt * 4);
+  emit_elf_header(3, emit_cnt() + (table_end - table_start + data_size) * 4);
 
   emit_reset();
   emit_start();
-  init_state_x86(module->data);
+  init_state_x86(data_addr, data_size);
+  x86_emit_text(module, pc2addr, rodata_addr);
 
-  for (Inst* inst = module->text; inst; inst = inst->next) {
-    x86_emit_inst(inst, pc2addr, rodata_addr);
+  for (int i = table_start; i < table_end; i++) {
+    emit_le(ELF_TEXT_START + pc2addr[i] + ELF_HEADER_SIZE);
   }
 
-  for (int i = 0; i < pc_cnt; i++) {
-    emit_le(ELF_TEXT_START + pc2addr[i] + ELF_HEADER_SIZE);
+  Data* data = module->data;
+  for (int mp = 0; mp < data_size; data = data->next, mp++) {
+    emit_le(data->v);
   }
 }
@@ -0,0 +1,589 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <ir/func.h>
+#include <ir/ir.h>
+#include <target/util.h>
+
+// A static x86-64 Linux ELF which talks to the kernel with syscall.
+//
+// The six registers stay in registers which syscall and the scratch
+// code leave alone. R15 holds the address of the mmap'd memory, and
+// RAX, RCX, RDX, RSI, and RDI are scratch.
+
+static int X64_REGNO[] = {
+  3,   // A - RBX
+  5,   // B - RBP
+  12,  // C - R12
+  13,  // D - R13
+  14,  // BP - R14
+  8,   // SP - R8
+};
+
+#define X64_RAX 0
+#define X64_RCX 1
+#define X64_RDX 2
+#define X64_RSI 6
+#define X64_RDI 7
+#define X64_MEM 15
+
+// Emits a REX prefix if any of its bits are needed. |reg|, |index|,
+// and |base| are the registers encoded in ModRM.reg, SIB.index, and
+// ModRM.rm or SIB.base.
+static void emit_x64_rex(int w, int reg, int index, int base) {
+  int rex = (w ? 8 : 0) + (reg >= 8 ? 4 : 0) + (index >= 8 ? 2 : 0) +
+      (base >= 8 ? 1 : 0);
+  if (rex)
+    emit_1(0x40 + rex);
+}
+
+// op r/m32, reg32
+static void emit_x64_rr(int op, int rm, int reg) {
+  emit_x64_rex(0, reg, 0, rm);
+  emit_2(op, 0xc0 + (reg % 8) * 8 + rm % 8);
+}
+
+// Two-byte 0F opcodes with reg32, r/m32 operands.
+static void emit_x64_0f_rr(int op, int reg, int rm) {
+  emit_x64_rex(0, reg, 0, rm);
+  emit_3(0x0f, op, 0xc0 + (reg % 8) * 8 + rm % 8);
+}
+
+// op r/m32, imm32 with 0x81 /ext
+static void emit_x64_ri(int ext, int rm, int imm) {
+  emit_x64_rex(0, 0, 0, rm);
+  emit_2(0x81, 0xc0 + ext * 8 + rm % 8);
+  emit_le(imm);
+}
+
+static void emit_x64_mov_imm(int r, int imm) {
+  emit_x64_rex(0, 0, 0, r);
+  emit_1(0xb8 + r % 8);
+  emit_le(imm);
+}
+
+static void emit_x64_mov_reg(int dst, int src) {
+  emit_x64_rr(0x89, dst, src);
+}
+
+static void emit_x64_mov(int r, Value* v) {
+  if (v->type == REG) {
+    emit_x64_mov_reg(r, X64_REGNO[v->reg]);
+  } else {
+    emit_x64_mov_imm(r, v->imm);
+  }
+}
+
+static void emit_x64_zero_reg(int r) {
+  emit_x64_rr(0x31, r, r);
+}
+
+static void emit_x64_syscall(void) {
+  emit_2(0x0f, 0x05);
+}
+
+// The disp32 of word |imm|, spelled out in bytes as imm*4 may not fit
+// in 24 bits.
+static void emit_x64_word_disp(int imm) {
+  emit_4(imm % 64 * 4, imm / 64 % 256, imm / 16384 % 256, imm / 4194304);
+}
+
+// op reg, [R15+idx*4] or [R15+imm*4]
+static void emit_x64_mem(int op, int reg, Value* addr) {
+  if (addr->type == REG) {
+    int idx = X64_REGNO[addr->reg];
+    emit_x64_rex(0, reg, idx, X64_MEM);
+    emit_3(op, 0x04 + (reg % 8) * 8, 0x87 + (idx % 8) * 8);
+  } else {
+    emit_x64_rex(0, reg, 0, X64_MEM);
+    emit_2(op, 0x87 + (reg % 8) * 8);
+    emit_x64_word_disp(addr->imm);
+  }
+}
+
+static void emit_x64_arith(Inst* inst, int op, int ext) {
+  int dst = X64_REGNO[inst->dst.reg];
+  if (inst->src.type == REG) {
+    emit_x64_rr(op, dst, X64_REGNO[inst->src.reg]);
+  } else {
+    emit_x64_ri(ext, dst, inst->src.imm);
+  }
+}
+
+static void emit_x64_mask(int r) {
+  emit_x64_ri(4, r, 0xffffff);
+}
+
+static void emit_x64_cmp(Inst* inst) {
+  emit_x64_arith(inst, 0x39, 7);
+}
+
+// Condition codes of unsigned comparisons.
+static int x64_cc(Op op) {
+  switch (op) {
+    case EQ: case JEQ: return 4;
+    case NE: case JNE: return 5;
+    case LT: case JLT: return 2;
+    case GT: case JGT: return 7;
+    case LE: case JLE: return 6;
+    case GE: case JGE: return 3;
+    default: error("oops");
+  }
+}
+
+static void emit_x64_setcc(Inst* inst) {
+  int dst = X64_REGNO[inst->dst.reg];
+  emit_x64_cmp(inst);
+  // setcc AL
+  emit_3(0x0f, 0x90 + x64_cc(inst->op), 0xc0);
+  // movzx dst, AL
+  emit_x64_0f_rr(0xb6, dst, X64_RAX);
+}
+
+// The jump table holds the 32-bit addresses of address-taken pcs, from
+// table_start, and sits at |table_addr| relative to the beginning of
+// the code.
+static void emit_x64_jmp_reg(Reg r, int table_addr, int table_start) {
+  int idx = X64_REGNO[r];
+  // lea RAX, [RIP+disp32]
+  emit_3(0x48, 0x8d, 0x05);
+  emit_diff(table_addr - table_start * 4, emit_cnt() + 4);
+  // mov EAX, [RAX+idx*4]
+  emit_x64_rex(0, 0, idx, 0);
+  emit_3(0x8b, 0x04, 0x80 + (idx % 8) * 8);
+  // jmp RAX
+  emit_2(0xff, 0xe0);
+}
+
+static int x64_jmp_reg_size(Reg r) {
+  return 7 + (X64_REGNO[r] >= 8 ? 4 : 3) + 2;
+}
+
+static void emit_x64_jcc(Inst* inst, int* pc2addr,
+                         int table_addr, int table_start) {
+  if (inst->op != JMP)
+    emit_x64_cmp(inst);
+
+  if (inst->jmp.type == REG) {
+    if (inst->op != JMP) {
+      // Jumps over the indirect jump with the negated condition.
+      emit_2(0x70 + (x64_cc(inst->op) ^ 1), x64_jmp_reg_size(inst->jmp.reg));
+    }
+    emit_x64_jmp_reg(inst->jmp.reg, table_addr, table_start);
+  } else if (inst->op == JMP) {
+    emit_1(0xe9);
+    emit_diff(pc2addr[inst->jmp.imm], emit_cnt() + 4);
+  } else {
+    emit_2(0x0f, 0x80 + x64_cc(inst->op));
+    emit_diff(pc2addr[inst->jmp.imm], emit_cnt() + 4);
+  }
+}
+
+static void emit_x64_divmod(Inst* inst) {
+  int dst = X64_REGNO[inst->dst.reg];
+  emit_x64_mov_reg(X64_RAX, dst);
+  emit_x64_zero_reg(X64_RDX);
+  int src = X64_RCX;
+  if (inst->src.type == REG) {
+    src = X64_REGNO[inst->src.reg];
+  } else {
+    emit_x64_mov_imm(X64_RCX, inst->src.imm);
+  }
+  // div src
+  emit_x64_rex(0, 0, 0, src);
+  emit_2(0xf7, 0xf0 + src % 8);
+  emit_x64_mov_reg(dst, inst->op == DIV ? X64_RAX : X64_RDX);
+}
+
+static void emit_x64_shift(Inst* inst) {
+  int dst = X64_REGNO[inst->dst.reg];
+  int ext = inst->op == SHL ? 4 : 5;
+  if (inst->src.type == IMM) {
+    if (inst->src.imm >= 24) {
+      emit_x64_zero_reg(dst);
+    } else {
+      emit_x64_rex(0, 0, 0, dst);
+      emit_3(0xc1, 0xc0 + ext * 8 + dst % 8, inst->src.imm);
+    }
+  } else {
+    emit_x64_mov_reg(X64_RCX, X64_REGNO[inst->src.reg]);
+    // shl/shr dst, CL
+    emit_x64_rex(0, 0, 0, dst);
+    emit_2(0xd3, 0xc0 + ext * 8 + dst % 8);
+    emit_x64_zero_reg(X64_RAX);
+    // cmp ECX, 24
+    emit_3(0x83, 0xf9, 0x18);
+    // cmovae dst, EAX
+    emit_x64_0f_rr(0x43, dst, X64_RAX);
+  }
+  if (inst->op == SHL)
+    emit_x64_mask(dst);
+}
+
+// lea r, [R15+r*4]
+static void emit_x64_mem_addr(int r) {
+  emit_x64_rex(1, r, r, X64_MEM);
+  emit_3(0x8d, 0x04 + (r % 8) * 8, 0x87 + (r % 8) * 8);
+}
+
+static void emit_x64_memop(Inst* inst) {
+  emit_x64_mov(X64_RDI, &inst->dst);
+  emit_x64_mem_addr(X64_RDI);
+  if (inst->op == MEMCPY) {
+    emit_x64_mov(X64_RSI, &inst->src);
+    emit_x64_mem_addr(X64_RSI);
+  } else {
+    emit_x64_mov(X64_RAX, &inst->src);
+  }
+  emit_x64_mov(X64_RCX, &inst->jmp);
+  // rep movsd or rep stosd
+  emit_2(0xf3, inst->op == MEMCPY ? 0xa5 : 0xab);
+}
+
+// I/O goes through buffers placed after the 2^24 words of memory, at
+// these offsets from R15 + (1<<26).
+#define X64_IO_BUF_SIZE 4096
+#define X64_OUT_LEN 0
+#define X64_IN_POS 4
+#define X64_IN_LEN 8
+#define X64_OUT_BUF 16
+#define X64_IN_BUF (X64_OUT_BUF + X64_IO_BUF_SIZE)
+#define X64_IO_SIZE (X64_IN_BUF + X64_IO_BUF_SIZE)
+
+enum {
+  X64_RT_FLUSH, X64_RT_FLUSH_LOOP, X64_RT_FLUSH_END,
+  X64_RT_PUTC, X64_RT_PUTC_DONE,
+  X64_RT_GETC, X64_RT_GETC_HAVE, X64_RT_GETC_EOF,
+  X64_RT_END, X64_RT_NUM_LABELS
+};
+
+// Addresses of the labels in the routines, recorded in the first pass.
+static int x64_rt_addrs[X64_RT_NUM_LABELS];
+
+static void x64_rt_label(int label) {
+  x64_rt_addrs[label] = emit_cnt();
+}
+
+static void x64_rt_jcc8(int op, int label) {
+  emit_2(op, (x64_rt_addrs[label] - emit_cnt() - 2) & 255);
+}
+
+static void x64_rt_jmp(int op, int label) {
+  emit_1(op);
+  emit_diff(x64_rt_addrs[label], emit_cnt() + 4);
+}
+
+// op reg, [R15+(1<<26)+off]
+static void emit_x64_io(int w, int op, int reg, int off) {
+  emit_x64_rex(w, reg, 0, X64_MEM);
+  emit_2(op, 0x87 + (reg % 8) * 8);
+  emit_4(off % 256, off / 256, 0, 4);
+}
+
+// op reg, [R15+RCX+(1<<26)+off], where |op| may follow an 0F escape.
+static void emit_x64_io_rcx(bool escape, int op, int reg, int off) {
+  emit_x64_rex(0, reg, X64_RCX, X64_MEM);
+  if (escape)
+    emit_1(0x0f);
+  emit_3(op, 0x84 + (reg % 8) * 8, 0x0f);
+  emit_4(off % 256, off / 256, 0, 4);
+}
+
+// Routines called by PUTC, GETC, and EXIT. They may clobber the
+// scratch registers.
+static void emit_x64_runtime(void) {
+  x64_rt_jmp(0xe9, X64_RT_END);
+
+  // flush: writes out the output buffer.
+  x64_rt_label(X64_RT_FLUSH);
+  // mov EDX, [OUT_LEN]
+  emit_x64_io(0, 0x8b, X64_RDX, X64_OUT_LEN);
+  // lea RSI, [OUT_BUF]
+  emit_x64_io(1, 0x8d, X64_RSI, X64_OUT_BUF);
+  x64_rt_label(X64_RT_FLUSH_LOOP);
+  // test EDX, EDX
+  emit_2(0x85, 0xd2);
+  // jle end
+  x64_rt_jcc8(0x7e, X64_RT_FLUSH_END);
+  emit_x64_mov_imm(X64_RDI, 1);  // stdout
+  emit_x64_mov_imm(X64_RAX, 1);  // write
+  emit_x64_syscall();
+  // test RAX, RAX
+  emit_3(0x48, 0x85, 0xc0);
+  // jle end
+  x64_rt_jcc8(0x7e, X64_RT_FLUSH_END);
+  // add RSI, RAX
+  emit_3(0x48, 0x01, 0xc6);
+  // sub EDX, EAX
+  emit_2(0x29, 0xc2);
+  // jmp loop
+  x64_rt_jcc8(0xeb, X64_RT_FLUSH_LOOP);
+  x64_rt_label(X64_RT_FLUSH_END);
+  // mov dword [OUT_LEN], 0
+  emit_x64_io(0, 0xc7, 0, X64_OUT_LEN);
+  emit_le(0);
+  // ret
+  emit_1(0xc3);
+
+  // putc: appends EDI to the output buffer.
+  x64_rt_label(X64_RT_PUTC);
+  // mov ECX, [OUT_LEN]
+  emit_x64_io(0, 0x8b, X64_RCX, X64_OUT_LEN);
+  // mov [OUT_BUF+RCX], DIL
+  emit_x64_io_rcx(false, 0x88, X64_RDI, X64_OUT_BUF);
+  // inc ECX
+  emit_2(0xff, 0xc1);
+  // mov [OUT_LEN], ECX
+  emit_x64_io(0, 0x89, X64_RCX, X64_OUT_LEN);
+  // cmp ECX, X64_IO_BUF_SIZE
+  emit_2(0x81, 0xf9);
+  emit_le(X64_IO_BUF_SIZE);
+  // jb done
+  x64_rt_jcc8(0x72, X64_RT_PUTC_DONE);
+  x64_rt_jmp(0xe9, X64_RT_FLUSH);
+  x64_rt_label(X64_RT_PUTC_DONE);
+  // ret
+  emit_1(0xc3);
+
+  // getc: returns the next input byte in EAX, or zero at EOF.
+  x64_rt_label(X64_RT_GETC);
+  // mov ECX, [IN_POS]
+  emit_x64_io(0, 0x8b, X64_RCX, X64_IN_POS);
+  // cmp ECX, [IN_LEN]
+  emit_x64_io(0, 0x3b, X64_RCX, X64_IN_LEN);
+  // jb have
+  x64_rt_jcc8(0x72, X64_RT_GETC_HAVE);
+  // Show the output before a read which may block.
+  x64_rt_jmp(0xe8, X64_RT_FLUSH);
+  emit_x64_zero_reg(X64_RDI);  // stdin
+  // lea RSI, [IN_BUF]
+  emit_x64_io(1, 0x8d, X64_RSI, X64_IN_BUF);
+  emit_x64_mov_imm(X64_RDX, X64_IO_BUF_SIZE);
+  emit_x64_zero_reg(X64_RAX);  // read
+  emit_x64_syscall();
+  emit_x64_zero_reg(X64_RCX);
+  // mov [IN_POS], ECX
+  emit_x64_io(0, 0x89, X64_RCX, X64_IN_POS);
+  // mov [IN_LEN], ECX
+  emit_x64_io(0, 0x89, X64_RCX, X64_IN_LEN);
+  // test RAX, RAX
+  emit_3(0x48, 0x85, 0xc0);
+  // jle eof
+  x64_rt_jcc8(0x7e, X64_RT_GETC_EOF);
+  // mov [IN_LEN], EAX
+  emit_x64_io(0, 0x89, X64_RAX, X64_IN_LEN);
+  x64_rt_label(X64_RT_GETC_HAVE);
+  // movzx EAX, byte [IN_BUF+RCX]
+  emit_x64_io_rcx(true, 0xb6, X64_RAX, X64_IN_BUF);
+  // inc ECX
+  emit_2(0xff, 0xc1);
+  // mov [IN_POS], ECX
+  emit_x64_io(0, 0x89, X64_RCX, X64_IN_POS);
+  // ret
+  emit_1(0xc3);
+  x64_rt_label(X64_RT_GETC_EOF);
+  emit_x64_zero_reg(X64_RAX);
+  // ret
+  emit_1(0xc3);
+
+  x64_rt_label(X64_RT_END);
+}
+
+// The initial memory image is appended to the file after the jump
+// table and copied from |data_addr| to the mmap'd memory.
+static void init_state_x64(int data_addr, int data_size) {
+  emit_x64_zero_reg(X64_RDI);
+  // mov ESI, (1<<26) + X64_IO_SIZE
+  emit_5(0xbe, X64_IO_SIZE % 256, X64_IO_SIZE / 256, 0, 4);
+  emit_x64_mov_imm(X64_RDX, 3);  // PROT_READ | PROT_WRITE
+  emit_x64_mov_imm(10, 0x22);  // MAP_PRIVATE | MAP_ANONYMOUS
+  // mov R8, -1
+  emit_3(0x49, 0xc7, 0xc0);
+  emit_4(0xff, 0xff, 0xff, 0xff);
+  emit_x64_zero_reg(9);
+  emit_x64_mov_imm(X64_RAX, 9);  // mmap
+  emit_x64_syscall();
+  // mov R15, RAX
+  emit_3(0x49, 0x89, 0xc7);
+
+  // mov RDI, R15
+  emit_3(0x4c, 0x89, 0xff);
+  emit_x64_mov_imm(X64_RSI, data_addr);
+  emit_x64_mov_imm(X64_RCX, data_size);
+  // rep movsd
+  emit_2(0xf3, 0xa5);
+
+  for (int i = 0; i < 6; i++)
+    emit_x64_zero_reg(X64_REGNO[i]);
+
+  emit_x64_runtime();
+}
+
+static void x64_emit_inst(Inst* inst, int* pc2addr,
+                          int table_addr, int table_start) {
+  int dst = inst->dst.type == REG ? X64_REGNO[inst->dst.reg] : 0;
+  switch (inst->op) {
+    case MOV:
+      emit_x64_mov(dst, &inst->src);
+      break;
+
+    case ADD:
+      emit_x64_arith(inst, 0x01, 0);
+      if (!inst->no_wrap)
+        emit_x64_mask(dst);
+      break;
+
+    case SUB:
+      emit_x64_arith(inst, 0x29, 5);
+      if (!inst->no_wrap)
+        emit_x64_mask(dst);
+      break;
+
+    case LOAD:
+      emit_x64_mem(0x8b, dst, &inst->src);
+      break;
+
+    case STORE:
+      emit_x64_mem(0x89, dst, &inst->src);
+      break;
+
+    case PUTC:
+      emit_x64_mov(X64_RDI, &inst->src);
+      x64_rt_jmp(0xe8, X64_RT_PUTC);
+      break;
+
+    case GETC:
+      x64_rt_jmp(0xe8, X64_RT_GETC);
+      emit_x64_mov_reg(dst, X64_RAX);
+      break;
+
+    case EXIT:
+      x64_rt_jmp(0xe8, X64_RT_FLUSH);
+      emit_x64_zero_reg(X64_RDI);
+      emit_x64_mov_imm(X64_RAX, 60);  // exit
+      emit_x64_syscall();
+      break;
+
+    case DUMP:
+      break;
+
+    case MUL:
+      if (inst->src.type == REG) {
+        // imul dst, src
+        emit_x64_0f_rr(0xaf, dst, X64_REGNO[inst->src.reg]);
+      } else {
+        // imul dst, dst, imm32
+        emit_x64_rex(0, dst, 0, dst);
+        emit_2(0x69, 0xc0 + (dst % 8) * 9);
+        emit_le(inst->src.imm);
+      }
+      emit_x64_mask(dst);
+      break;
+
+    case DIV:
+    case MOD:
+      emit_x64_divmod(inst);
+      break;
+
+    case AND:
+      emit_x64_arith(inst, 0x21, 4);
+      break;
+
+    case OR:
+      emit_x64_arith(inst, 0x09, 1);
+      break;
+
+    case XOR:
+      emit_x64_arith(inst, 0x31, 6);
+      break;
+
+    case SHL:
+    case SHR:
+      emit_x64_shift(inst);
+      break;
+
+    case MEMCPY:
+    case MEMSET:
+      emit_x64_memop(inst);
+      break;
+
+    case EQ:
+    case NE:
+    case LT:
+    case GT:
+    case LE:
+    case GE:
+      emit_x64_setcc(inst);
+      break;
+
+    case JEQ:
+    case JNE:
+    case JLT:
+    case JGT:
+    case JLE:
+    case JGE:
+    case JMP:
+      emit_x64_jcc(inst, pc2addr, table_addr, table_start);
+      break;
+
+    default:
+      error("oops");
+  }
+}
+
+static int x64_data_size(Data* data) {
+  int size = 0;
+  for (int mp = 0; data; data = data->next, mp++) {
+    if (data->v)
+      size = mp + 1;
+  }
+  return size;
+}
+
+void target_x86_64(Module* module) {
+  int data_size = x64_data_size(module->data);
+  int num_taken;
+  int* taken = get_addr_taken_pcs(module, &num_taken);
+  int table_start = num_taken ? taken[0] : 0;
+  int table_end = num_taken ? taken[num_taken - 1] + 1 : 0;
+
+  int pc_cnt = 0;
+  for (Inst* inst = module->text; inst; inst = inst->next) {
+    pc_cnt = inst->pc + 1;
+  }
+  int* pc2addr = calloc(pc_cnt, sizeof(int));
+
+  emit_reset();
+  init_state_x64(0, data_size);
+  int prev_pc = -1;
+  for (Inst* inst = module->text; inst; inst = inst->next) {
+    if (prev_pc != inst->pc) {
+      pc2addr[inst->pc] = emit_cnt();
+    }
+    prev_pc = inst->pc;
+    x64_emit_inst(inst, pc2addr, 0, table_start);
+  }
+
+  int table_addr = emit_cnt();
+  int table_size = (table_end - table_start) * 4;
+  int data_addr = ELF_TEXT_START + ELF64_HEADER_SIZE + table_addr + table_size;
+
+  emit_elf64_header(62, table_addr + table_size + data_size * 4);
+
+  emit_reset();
+  emit_start();
+  init_state_x64(data_addr, data_size);
+
+  for (Inst* inst = module->text; inst; inst = inst->next) {
+    x64_emit_inst(inst, pc2addr, table_addr, table_start);
+  }
+
+  for (int i = table_start; i < table_end; i++) {
+    emit_le(ELF_TEXT_START + ELF64_HEADER_SIZE + pc2addr[i]);
+  }
+
+  Data* data = module->data;
+  for (int mp = 0; mp < data_size; data = data->next, mp++) {
+    emit_le(data->v);
+  }
+}
@@ -0,0 +1,67 @@
+def emit_print(m)
+  m.each_byte{|b|
+    puts "mov A, #{b}"
+    puts "putc A"
+  }
+end
+
+MASK = (1 << 24) - 1
+
+ARITH_OPS = {
+  'mul' => lambda{|a, b| a * b & MASK },
+  'div' => lambda{|a, b| a / b },
+  'mod' => lambda{|a, b| a % b },
+  'and' => lambda{|a, b| a & b },
+  'or' => lambda{|a, b| a | b },
+  'xor' => lambda{|a, b| a ^ b },
+  'shl' => lambda{|a, b| b < 24 ? a << b & MASK : 0 },
+  'shr' => lambda{|a, b| b < 24 ? a >> b : 0 },
+}
+
+REGS = %w(A B C D BP SP)
+
+VALUES = [
+  [0, 1], [1, 1], [7, 3], [123456, 789], [MASK, MASK], [0x800000, 2],
+  [0xabcdef, 0x123456], [3, 23], [5, 24], [0xfedcba, 0x876543],
+  [0x7fffff, 0x800001], [4097, 4099],
+]
+
+label = 0
+ARITH_OPS.each do |op, func|
+  emit_print("#{op}: ")
+  VALUES.each_with_index do |(lhs, rhs), i|
+    [:imm, :reg, :self].each do |mode|
+      next if mode == :self && lhs != rhs
+      dst = REGS[i % 6]
+      src_reg = mode == :self ? dst : REGS[(i + 1 + i / 6) % 6]
+      vals = {}
+      REGS.each_with_index do |r, j|
+        vals[r] = (j + 1) * 1000 + i
+        puts "mov #{r}, #{vals[r]}"
+      end
+      vals[dst] = lhs
+      puts "mov #{dst}, #{lhs}"
+      if mode == :imm
+        src = rhs.to_s
+      else
+        vals[src_reg] = rhs
+        puts "mov #{src_reg}, #{rhs}"
+        src = src_reg
+      end
+      puts "#{op} #{dst}, #{src}"
+      vals[dst] = func[lhs, rhs]
+
+      label += 1
+      REGS.each do |r|
+        puts "jne .Lng#{label}, #{r}, #{vals[r]}"
+      end
+      emit_print(".")
+      puts "jmp .Lok#{label}"
+      puts ".Lng#{label}:"
+      emit_print("X")
+      puts ".Lok#{label}:"
+    end
+  end
+  emit_print("\n")
+end
+puts "exit"
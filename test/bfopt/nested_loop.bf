@@ -0,0 +1,12 @@
+Loops which end right after a nested loop must stay loops
+The outer loop below clears cells 3 to 1 from right to left
+Its body ends with a left move after a nested loop so it is not a scan
+Cell 5 is set so stopping at cell 3 would print the wrong letter
+
+>+>+>+>>++<<
+[[-[-]]<]
+
+Prints cells 1 and 2 plus 65 then a newline
+>+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++.
+>+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++.
+>++++++++++.
@@ -0,0 +1,18 @@
+N = 256
+
+puts 'mov D, 64'
+puts '.Lloop:'
+puts 'mov A, 10000'
+puts "mov B, #{N}"
+puts 'memset A, D, B'
+puts 'mov C, 20000'
+puts 'memcpy C, A, B'
+puts 'mov A, 30000'
+puts 'memcpy A, C, B'
+puts 'sub D, 1'
+puts 'jne .Lloop, D, 0'
+puts "load A, #{30000 + N - 1}"
+puts 'add A, 64'
+puts 'putc A'
+puts 'putc 10'
+puts 'exit'
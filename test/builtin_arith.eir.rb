@@ -0,0 +1,309 @@
+# Calls __builtin_* functions defined the way 8cc emits libc/_builtin.h.
+# Backends with native arithmetic replace their bodies by a single op
+# (replace_builtin_arith in ir/ir.c), and the others run the software
+# bodies below, which only use add, sub, compares and jumps.
+
+def emit_print(m)
+  m.each_byte{|b|
+    puts "mov A, #{b}"
+    puts "putc A"
+  }
+end
+
+MASK = (1 << 24) - 1
+
+ARITH_OPS = {
+  'mul' => lambda{|a, b| a * b & MASK },
+  'div' => lambda{|a, b| a / b },
+  'mod' => lambda{|a, b| a % b },
+  'and' => lambda{|a, b| a & b },
+  'or' => lambda{|a, b| a | b },
+  'xor' => lambda{|a, b| a ^ b },
+  'not' => lambda{|a, b| a ^ MASK },
+  'shl' => lambda{|a, b| b < 24 ? a << b & MASK : 0 },
+  'shr' => lambda{|a, b| b < 24 ? a >> b : 0 },
+}
+
+VALUES = [
+  [0, 1], [1, 1], [7, 3], [123456, 789], [MASK, MASK], [0x800000, 2],
+  [0xabcdef, 0x123456], [3, 23], [5, 24], [0xfedcba, 0x876543],
+  [0x7fffff, 0x800001], [4097, 4099],
+]
+
+# Frame slots relative to BP. BP+0 holds the caller's BP and BP+1 the
+# return address.
+ARG_A = 2
+ARG_B = 3
+LOC_R = -1
+LOC_I = -2
+LOC_T = -3
+LOC_HI = -4
+
+$label = 0
+def new_label
+  $label += 1
+  ".Lb#{$label}"
+end
+
+def ld(reg, slot)
+  puts "mov D, BP"
+  puts "add D, #{slot}"
+  puts "load A, D"
+  puts "mov #{reg}, A" if reg != 'A'
+end
+
+def st(reg, slot)
+  puts "mov D, BP"
+  puts "add D, #{slot}"
+  puts "store #{reg}, D"
+end
+
+def prologue(name)
+  puts "#{name}:"
+  puts "mov D, SP"
+  puts "add D, -1"
+  puts "store BP, D"
+  puts "mov SP, D"
+  puts "mov BP, SP"
+  puts "sub SP, 4"
+end
+
+# Returns C.
+def epilogue
+  puts "mov SP, BP"
+  puts "load A, SP"
+  puts "mov BP, A"
+  puts "add SP, 1"
+  puts "load A, SP"
+  puts "mov B, A"
+  puts "mov A, C"
+  puts "jmp B"
+end
+
+# Runs the body for each bit from the top with the bit in C and the
+# counter in LOC_I.
+def each_bit
+  puts "mov A, 0"
+  st('A', LOC_R)
+  st('A', LOC_I)
+  loop = new_label
+  puts "#{loop}:"
+  ld('C', LOC_I)
+  puts "mov B, __builtin_bits_table"
+  puts "add B, C"
+  puts "load A, B"
+  puts "mov C, A"
+  yield
+  ld('A', LOC_I)
+  puts "add A, 1"
+  st('A', LOC_I)
+  puts "jlt #{loop}, A, 24"
+end
+
+# Sets reg to 1 and subtracts C from the slot if the slot is >= C.
+def to_bit(reg, slot)
+  done = new_label
+  ld('A', slot)
+  puts "mov #{reg}, 0"
+  puts "jlt #{done}, A, C"
+  puts "sub A, C"
+  st('A', slot)
+  puts "mov #{reg}, 1"
+  puts "#{done}:"
+end
+
+def add_to_r(reg)
+  ld('A', LOC_R)
+  puts "add A, #{reg}"
+  st('A', LOC_R)
+end
+
+def emit_bitwise(name)
+  prologue("__builtin_#{name}")
+  each_bit do
+    skip = new_label
+    take = new_label
+    to_bit('B', ARG_A)
+    if name == 'not'
+      puts "jne #{skip}, B, 0"
+    else
+      st('B', LOC_T)
+      to_bit('B', ARG_B)
+      ld('A', LOC_T)
+      case name
+      when 'and'
+        puts "jeq #{skip}, A, 0"
+        puts "jeq #{skip}, B, 0"
+      when 'or'
+        puts "jne #{take}, A, 0"
+        puts "jeq #{skip}, B, 0"
+      when 'xor'
+        puts "jeq #{skip}, A, B"
+      end
+    end
+    puts "#{take}:"
+    add_to_r('C')
+    puts "#{skip}:"
+  end
+  ld('C', LOC_R)
+  epilogue
+end
+
+def emit_mul
+  prologue('__builtin_mul')
+  each_bit do
+    skip = new_label
+    ld('A', LOC_R)
+    puts "add A, A"
+    st('A', LOC_R)
+    ld('A', ARG_B)
+    puts "jlt #{skip}, A, C"
+    puts "sub A, C"
+    st('A', ARG_B)
+    ld('B', ARG_A)
+    add_to_r('B')
+    puts "#{skip}:"
+  end
+  ld('C', LOC_R)
+  epilogue
+end
+
+# Restoring division. The quotient goes to LOC_R and the remainder to
+# LOC_T. LOC_HI remembers the remainder overflowed when doubled.
+def emit_divmod(name)
+  prologue("__builtin_#{name}")
+  puts "mov A, 0"
+  st('A', LOC_T)
+  each_bit do
+    lo = new_label
+    nobit = new_label
+    sub = new_label
+    skip = new_label
+    ld('A', LOC_T)
+    puts "mov B, 0"
+    puts "jlt #{lo}, A, #{1 << 23}"
+    puts "mov B, 1"
+    puts "#{lo}:"
+    puts "add A, A"
+    st('A', LOC_T)
+    st('B', LOC_HI)
+    ld('A', ARG_A)
+    puts "jlt #{nobit}, A, C"
+    puts "sub A, C"
+    st('A', ARG_A)
+    ld('A', LOC_T)
+    puts "add A, 1"
+    st('A', LOC_T)
+    puts "#{nobit}:"
+    ld('A', LOC_HI)
+    puts "jne #{sub}, A, 0"
+    ld('B', ARG_B)
+    ld('A', LOC_T)
+    puts "jlt #{skip}, A, B"
+    puts "#{sub}:"
+    ld('B', ARG_B)
+    ld('A', LOC_T)
+    puts "sub A, B"
+    st('A', LOC_T)
+    add_to_r('C')
+    puts "#{skip}:"
+  end
+  ld('C', name == 'div' ? LOC_R : LOC_T)
+  epilogue
+end
+
+def emit_shl
+  prologue('__builtin_shl')
+  loop = new_label
+  zero = new_label
+  done = new_label
+  ld('B', ARG_B)
+  ld('C', ARG_A)
+  puts "jge #{zero}, B, 24"
+  puts "#{loop}:"
+  puts "jeq #{done}, B, 0"
+  puts "add C, C"
+  puts "sub B, 1"
+  puts "jmp #{loop}"
+  puts "#{zero}:"
+  puts "mov C, 0"
+  puts "#{done}:"
+  epilogue
+end
+
+# Moves each bit of a down by b using the bits table.
+def emit_shr
+  prologue('__builtin_shr')
+  zero = new_label
+  done = new_label
+  ld('A', ARG_B)
+  puts "jge #{zero}, A, 24"
+  each_bit do
+    skip = new_label
+    ld('A', ARG_A)
+    puts "jlt #{skip}, A, C"
+    puts "sub A, C"
+    st('A', ARG_A)
+    ld('B', LOC_I)
+    ld('A', ARG_B)
+    puts "add B, A"
+    puts "jge #{skip}, B, 24"
+    puts "mov A, __builtin_bits_table"
+    puts "add B, A"
+    puts "load A, B"
+    puts "mov B, A"
+    add_to_r('B')
+    puts "#{skip}:"
+  end
+  ld('C', LOC_R)
+  puts "jmp #{done}"
+  puts "#{zero}:"
+  puts "mov C, 0"
+  puts "#{done}:"
+  epilogue
+end
+
+def push(v)
+  puts "mov A, #{v}"
+  puts "mov D, SP"
+  puts "add D, -1"
+  puts "store A, D"
+  puts "mov SP, D"
+end
+
+puts ".data"
+puts "__builtin_bits_table:"
+24.times{|i| puts ".long #{1 << (23 - i)}" }
+puts ".text"
+
+puts "main:"
+ARITH_OPS.each do |op, func|
+  emit_print("#{op}: ")
+  VALUES.each do |lhs, rhs|
+    ret = new_label
+    ng = new_label
+    ok = new_label
+    nargs = op == 'not' ? 1 : 2
+    push(rhs) if nargs == 2
+    push(lhs)
+    push(ret)
+    puts "jmp __builtin_#{op}"
+    puts "#{ret}:"
+    puts "add SP, #{nargs + 1}"
+    puts "jne #{ng}, A, #{func[lhs, rhs]}"
+    emit_print(".")
+    puts "jmp #{ok}"
+    puts "#{ng}:"
+    emit_print("X")
+    puts "#{ok}:"
+  end
+  emit_print("\n")
+end
+puts "exit"
+
+emit_mul
+emit_divmod('div')
+emit_divmod('mod')
+%w(and or xor not).each{|name| emit_bitwise(name) }
+emit_shl
+emit_shr
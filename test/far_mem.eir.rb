@@ -0,0 +1,15 @@
+# Stores and loads words spread over the whole address space.
+addrs = [0, 1, 255, 256, 4095, 4096, 65535, 65536, 131071, 1234567,
+         0x7fffff, 0x800000, 0xfedcba, 0xffff00, 0xfffffe, 0xffffff]
+addrs.each_with_index{|a, i|
+  puts %Q(mov B, #{i * 65536 + i * 256 + 65 + i}
+mov C, #{a}
+store B, C)
+}
+addrs.each_with_index{|a, i|
+  puts %Q(load A, #{a}
+sub A, #{i * 65536 + i * 256}
+putc A)
+}
+puts 'putc 10'
+puts 'exit'
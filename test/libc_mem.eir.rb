@@ -0,0 +1,151 @@
+# Calls memcpy and memset defined the way 8cc emits libc/string.h.
+# Backends with block operations replace their bodies by MEMCPY and
+# MEMSET (replace_libc_mem in ir/ir.c), and the others run the word by
+# word loops below. 8cc's char is a full word, so memset stores c as
+# is even when it does not fit in a byte.
+
+def emit_print(m)
+  m.each_byte{|b|
+    puts "mov A, #{b}"
+    puts "putc A"
+  }
+end
+
+MASK = (1 << 24) - 1
+
+# [name, dst, src, n]. dst and src of memcpy are offsets in the test
+# area, and src of memset is the value. memcpy with dst below src may
+# overlap: it must behave as the forward loop in libc.
+CASES = [
+  ['memcpy', 32, 0, 5],
+  ['memcpy', 0, 2, 6],
+  ['memcpy', 4, 5, 1],
+  ['memcpy', 3, 3, 4],
+  ['memcpy', 8, 0, 0],
+  ['memset', 2, 0x123456, 4],
+  ['memset', 0, MASK, 3],
+  ['memset', 5, 256, 2],
+  ['memset', 1, 7, 0],
+]
+
+AREA = 40
+
+$label = 0
+def new_label
+  $label += 1
+  ".Lm#{$label}"
+end
+
+def ld(reg, slot)
+  puts "mov D, BP"
+  puts "add D, #{slot}"
+  puts "load A, D"
+  puts "mov #{reg}, A" if reg != 'A'
+end
+
+def st(reg, slot)
+  puts "mov D, BP"
+  puts "add D, #{slot}"
+  puts "store #{reg}, D"
+end
+
+# d, s (or c) and n are at BP+2, BP+3 and BP+4, and i is at BP-1.
+def emit_func(name)
+  puts "#{name}:"
+  puts "mov D, SP"
+  puts "add D, -1"
+  puts "store BP, D"
+  puts "mov SP, D"
+  puts "mov BP, SP"
+  puts "sub SP, 1"
+  puts "mov A, 0"
+  st('A', -1)
+  loop = new_label
+  done = new_label
+  puts "#{loop}:"
+  ld('B', 4)
+  ld('A', -1)
+  puts "jge #{done}, A, B"
+  if name == 'memcpy'
+    ld('B', 3)
+    ld('A', -1)
+    puts "add B, A"
+    puts "load A, B"
+    puts "mov C, A"
+  else
+    ld('C', 3)
+  end
+  ld('B', 2)
+  ld('A', -1)
+  puts "add B, A"
+  puts "store C, B"
+  puts "add A, 1"
+  st('A', -1)
+  puts "jmp #{loop}"
+  puts "#{done}:"
+  ld('C', 2)
+  puts "mov SP, BP"
+  puts "load A, SP"
+  puts "mov BP, A"
+  puts "add SP, 1"
+  puts "load A, SP"
+  puts "mov B, A"
+  puts "mov A, C"
+  puts "jmp B"
+end
+
+def push(v)
+  puts "mov A, #{v}"
+  puts "mov D, SP"
+  puts "add D, -1"
+  puts "store A, D"
+  puts "mov SP, D"
+end
+
+puts ".text"
+puts "main:"
+%w(memcpy memset).each do |name|
+  emit_print("#{name}: ")
+  CASES.each_with_index do |(op, dst, src, n), i|
+    next if op != name
+    base = 1000 + i * 64
+
+    # The words just outside the area must stay as they are.
+    mem = {}
+    (-1..AREA).each do |j|
+      mem[base + j] = i * 100 + j + 2
+      puts "mov A, #{mem[base + j]}"
+      puts "store A, #{base + j}"
+    end
+
+    ret = new_label
+    ng = new_label
+    ok = new_label
+    push(n)
+    push(op == 'memcpy' ? base + src : src)
+    push(base + dst)
+    push(ret)
+    puts "jmp #{op}"
+    puts "#{ret}:"
+    puts "add SP, 4"
+    puts "jne #{ng}, A, #{base + dst}"
+
+    n.times do |j|
+      mem[base + dst + j] = op == 'memcpy' ? mem[base + src + j] : src
+    end
+    mem.each do |addr, v|
+      puts "load A, #{addr}"
+      puts "jne #{ng}, A, #{v}"
+    end
+    emit_print(".")
+    puts "jmp #{ok}"
+    puts "#{ng}:"
+    emit_print("X")
+    puts "#{ok}:"
+  end
+  emit_print("\n")
+end
+puts "exit"
+
+emit_func('memcpy')
+emit_func('memset')
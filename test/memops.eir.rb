@@ -0,0 +1,88 @@
+def emit_print(m)
+  m.each_byte{|b|
+    puts "mov A, #{b}"
+    puts "putc A"
+  }
+end
+
+MASK = (1 << 24) - 1
+
+REGS = %w(A B C D BP SP)
+
+# [op, dst, src, cnt]. A register name means the operand is passed in
+# it, and an integer means an immediate.
+CASES = [
+  ['memcpy', 'A', 'B', 'C'],
+  ['memcpy', 'B', 'C', 'A'],
+  ['memcpy', 'C', 'A', 'B'],
+  ['memcpy', 'D', 'BP', 'SP'],
+  ['memcpy', 'SP', 'D', 3],
+  ['memcpy', 'BP', :src, 'A'],
+  ['memcpy', 'A', :src, 0],
+  ['memcpy', 'C', 'D', 1],
+  ['memset', 'A', 'B', 'C'],
+  ['memset', 'B', 'C', 'A'],
+  ['memset', 'D', 'D', 2],
+  ['memset', 'SP', 0, 'BP'],
+  ['memset', 'C', MASK, 4],
+  ['memset', 'BP', 42, 0],
+]
+
+label = 0
+%w(memcpy memset).each do |name|
+  emit_print("#{name}: ")
+  CASES.each_with_index do |(op, dst, src, cnt), i|
+    next if op != name
+    base = 100000 + i * 64
+    src_addr = base
+    dst_addr = base + 32
+    n = cnt.is_a?(Integer) ? cnt : i % 5 + 1
+
+    mem = {}
+    (n + 1).times do |j|
+      mem[src_addr + j] = i * 100 + j + 1
+      mem[dst_addr + j] = 0x5555
+    end
+    mem.each do |addr, v|
+      puts "mov A, #{v}"
+      puts "store A, #{addr}"
+    end
+
+    vals = {}
+    REGS.each_with_index do |r, j|
+      vals[r] = (j + 1) * 1000 + i
+    end
+    vals[dst] = dst_addr
+    if src == :src
+      src = src_addr
+    elsif src.is_a?(String)
+      vals[src] = op == 'memcpy' ? src_addr : 77 + i if src != dst
+    end
+    vals[cnt] = n if cnt.is_a?(String)
+    REGS.each do |r|
+      puts "mov #{r}, #{vals[r]}"
+    end
+    puts "#{op} #{dst}, #{src}, #{cnt}"
+
+    v = src.is_a?(String) ? vals[src] : src
+    n.times do |j|
+      mem[dst_addr + j] = op == 'memcpy' ? mem[src_addr + j] : v
+    end
+
+    label += 1
+    REGS.each do |r|
+      puts "jne .Lng#{label}, #{r}, #{vals[r]}"
+    end
+    mem.each do |addr, v|
+      puts "load A, #{addr}"
+      puts "jne .Lng#{label}, A, #{v}"
+    end
+    emit_print(".")
+    puts "jmp .Lok#{label}"
+    puts ".Lng#{label}:"
+    emit_print("X")
+    puts ".Lok#{label}:"
+  end
+  emit_print("\n")
+end
+puts "exit"
@@ -0,0 +1,167 @@
+# Functions with frames in the style of 8cc. Some of their stack slots
+# can be promoted to virtual registers and some cannot.
+
+def push(r)
+  puts "mov D, SP"
+  puts "add D, -1"
+  puts "store #{r}, D"
+  puts "mov SP, D"
+end
+
+$label = 0
+def call(f, *args)
+  $label += 1
+  args.reverse.each do |a|
+    puts "mov A, #{a}"
+    push('A')
+  end
+  puts "mov A, .Lret#{$label}"
+  push('A')
+  puts "jmp #{f}"
+  puts ".Lret#{$label}:"
+  puts "add SP, #{args.size + 1}"
+end
+
+def func(name, frame_size)
+  puts "#{name}:"
+  push('BP')
+  puts "mov BP, SP"
+  puts "sub SP, #{frame_size}"
+  yield
+  # Only "load A, X" works everywhere, so the return value waits in C.
+  puts "mov C, A"
+  puts "mov SP, BP"
+  puts "load A, SP"
+  puts "mov BP, A"
+  puts "add SP, 1"
+  puts "load A, SP"
+  puts "mov B, A"
+  puts "mov A, C"
+  puts "jmp B"
+end
+
+def slot(off, r='B')
+  puts "mov #{r}, BP"
+  puts "add #{r}, #{off}"
+end
+
+def get(off, dst='A')
+  slot(off)
+  if dst == 'A'
+    puts "load A, B"
+  else
+    puts "mov D, A"
+    puts "load A, B"
+    puts "mov #{dst}, A"
+    puts "mov A, D"
+  end
+end
+
+def set(off, src='A')
+  slot(off)
+  puts "store #{src}, B"
+end
+
+puts ".data"
+puts "fptr:"
+puts ".long twice"
+puts ".text"
+
+# Prints 64 + the result of each case.
+puts "main:"
+call('sum', 6)
+puts "add A, 64"
+puts "putc A"
+call('tri', 5)
+puts "add A, 64"
+puts "putc A"
+call('escape', 3)
+puts "add A, 64"
+puts "putc A"
+call('cross', 0)
+puts "add A, 64"
+puts "putc A"
+puts "load A, fptr"
+puts "mov B, A"
+$label += 1
+puts "mov A, 7"
+push('A')
+puts "mov A, .Lret#{$label}"
+push('A')
+puts "jmp B"
+puts ".Lret#{$label}:"
+puts "add SP, 2"
+puts "add A, 64"
+puts "putc A"
+puts "putc 10"
+puts "exit"
+
+# 0 + 1 + ... + (n - 1) with locals i and s.
+func('sum', 2) do
+  puts "mov A, 0"
+  set(-1)
+  set(-2)
+  puts ".Lsum_loop:"
+  get(-1)
+  get(2, 'C')
+  puts "jge .Lsum_done, A, C"
+  get(-2, 'C')
+  puts "add C, A"
+  puts "store C, B"
+  get(-1)
+  puts "add A, 1"
+  puts "store A, B"
+  puts "jmp .Lsum_loop"
+  puts ".Lsum_done:"
+  get(-2)
+end
+
+# Recursive: n + tri(n - 1). Its local n - 1 must survive the call.
+func('tri', 1) do
+  get(2)
+  puts "jeq .Ltri_done, A, 0"
+  puts "sub A, 1"
+  set(-1)
+  call('tri', 'A')
+  get(-1, 'C')
+  puts "add A, C"
+  puts "add A, 1"
+  puts ".Ltri_done:"
+end
+
+# Passes the address of its local to store3.
+func('escape', 1) do
+  puts "mov A, 1"
+  set(-1)
+  slot(-1, 'A')
+  call('store3', 'A')
+  get(-1)
+  get(2, 'C')
+  puts "add A, C"
+end
+
+func('store3', 0) do
+  get(2, 'C')
+  puts "mov A, 3"
+  puts "store A, C"
+end
+
+# Keeps the address of its local in B across a jump.
+func('cross', 1) do
+  get(2, 'C')
+  puts "mov A, 7"
+  set(-1)
+  puts "jne .Lcross_skip, C, 0"
+  puts "mov A, 9"
+  puts "store A, B"
+  puts ".Lcross_skip:"
+  get(-1)
+end
+
+# Called through fptr. Its argument is written back.
+func('twice', 0) do
+  get(2)
+  puts "add A, A"
+  set(2)
+  get(2)
+end
@@ -0,0 +1,86 @@
+# ADDs and SUBs around the edges of words. Some of them can be proven
+# not to wrap around and some must still wrap.
+
+puts ".data"
+puts "top:"
+puts ".long 16777215"
+puts "five:"
+puts ".long 5"
+puts "fptr:"
+puts ".long wrap"
+puts ".text"
+
+puts "main:"
+
+# Wraps to zero.
+puts "mov A, 16777215"
+puts "add A, 1"
+puts "add A, 65"
+puts "putc A"
+
+# Wraps to UINT_MAX.
+puts "mov A, 0"
+puts "sub A, 1"
+puts "sub A, 16777149"
+puts "putc A"
+
+# A loop counter bounded by its exit condition.
+puts "mov A, 0"
+puts ".Lup:"
+puts "add A, 1"
+puts "jlt .Lup, A, 100"
+puts "sub A, 33"
+puts "putc A"
+
+# A loop counter which wraps around before the loop exits.
+puts "mov A, 16777210"
+puts "mov C, 0"
+puts ".Lwrap:"
+puts "add C, 1"
+puts "add A, 1"
+puts "jne .Lwrap, A, 0"
+puts "add C, 62"
+puts "putc C"
+
+# Counts down to zero.
+puts "mov A, 0"
+puts "mov C, 10"
+puts ".Ldown:"
+puts "add A, 7"
+puts "sub C, 1"
+puts "jne .Ldown, C, 0"
+puts "putc A"
+
+# Unknown values narrowed by comparisons.
+puts "load A, five"
+puts "jlt .Lsmall, A, 5"
+puts "sub A, 5"
+puts "add A, 70"
+puts "putc A"
+puts ".Lsmall:"
+puts "load A, top"
+puts "jgt .Lbig, A, 16777214"
+puts "putc 63"
+puts ".Lbig:"
+puts "add A, 72"
+puts "putc A"
+puts "load A, top"
+puts "jle .Lnot_top, A, 16777214"
+puts "sub A, 16777142"
+puts "putc A"
+puts ".Lnot_top:"
+
+# Nothing is known at the entry of wrap.
+puts "load A, fptr"
+puts "mov B, A"
+puts "load A, top"
+puts "mov C, .Lret"
+puts "jmp B"
+puts ".Lret:"
+puts "putc A"
+puts "putc 10"
+puts "exit"
+
+puts "wrap:"
+puts "add A, 75"
+puts "jmp C"
@@ -1,8 +1,14 @@
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
+#if defined(__x86_64__) && defined(__linux__)
+#include <sys/mman.h>
+#define BFOPT_JIT
+#endif
+
 #include <algorithm>
 #include <iterator>
 #include <map>
@@ -25,45 +31,52 @@ using namespace std;
 
 bool g_trace;
 bool g_verbose;
-
-struct Loop;
+// The path of the Chrome trace JSON written by the profiler, if any.
+const char* g_profile;
 
 enum OpType {
-  OP_MEM,
+  OP_ADD,
   OP_PTR,
-  OP_LOOP,
+  OP_MUL,
+  OP_CLEAR,
+  OP_SCAN,
   OP_COMMENT,
 };
 
-struct Op {
-  char op;
-  int arg;
-  Loop* loop;
-  string comment;
-
-  Op()
-      : op(0), arg(0) {
+// The optimized program, one entry per op in each array. OP_ADD and
+// OP_MUL work on the cell at mp + off without moving mp; OP_MUL adds
+// mp[0] * arg there. '[' and ']' keep the index of the matching bracket
+// in arg, and OP_COMMENT keeps an index into comments.
+struct Program {
+  vector<byte> op;
+  vector<int> arg;
+  vector<int> off;
+  // The profiling region each op belongs to, see Profiler.
+  vector<int> region;
+  vector<string> comments;
+  vector<string> regions;
+  // The largest offset used by OP_ADD and OP_MUL.
+  int max_off;
+
+  Program() : regions(1, "(start)"), max_off(0) {}
+
+  size_t size() const {
+    return op.size();
   }
-};
-
-struct Loop {
-  vector<Op*> code;
-  map<int, int> addsub;
-  int ptr;
-  bool has_io;
 
-  Loop() {
-    reset(NULL);
+  void push(byte o, int a, int f = 0) {
+    op.push_back(o);
+    arg.push_back(a);
+    off.push_back(f);
+    region.push_back(regions.size() - 1);
+    max_off = max(max_off, f);
   }
 
-  void reset(vector<Op*>* out) {
-    if (out)
-      copy(code.begin(), code.end(), back_inserter(*out));
-
-    code.clear();
-    addsub.clear();
-    ptr = 0;
-    has_io = false;
+  void truncate(size_t n) {
+    op.resize(n);
+    arg.resize(n);
+    off.resize(n);
+    region.resize(n);
   }
 };
 
@@ -82,103 +95,138 @@ int merge_ops(char add, char sub, const char** code) {
   return r;
 }
 
-void parse(const char* code, vector<Op*>* ops) {
-  Loop* cur_loop = new Loop();
+// Additions and a pointer move which have not been emitted yet. They
+// are flushed before anything which depends on mp or reads cells.
+struct Pending {
+  map<int, int> adds;
+  int ptr;
+
+  Pending() : ptr(0) {}
+
+  void flush(Program* prog) {
+    for (map<int, int>::const_iterator iter = adds.begin();
+         iter != adds.end();
+         ++iter) {
+      if (static_cast<byte>(iter->second))
+        prog->push(OP_ADD, iter->second, iter->first);
+    }
+    if (ptr)
+      prog->push(OP_PTR, ptr);
+    adds.clear();
+    ptr = 0;
+  }
+};
+
+// Replaces the loop body which starts right after `begin` with a
+// dedicated op if it is a scan ([>], [<<], ...) or a loop which only
+// adds at fixed offsets and steps mp[0] by one ([->+>++<<], ...).
+bool lower_loop(size_t begin, Program* prog) {
+  size_t n = prog->size() - begin - 1;
+  if (n == 1 && prog->op[begin + 1] == OP_PTR) {
+    int step = prog->arg[begin + 1];
+    prog->truncate(begin);
+    prog->push(OP_SCAN, step);
+    return true;
+  }
+
+  int dec = 0;
+  for (size_t i = begin + 1; i < prog->size(); i++) {
+    if (prog->op[i] != OP_ADD)
+      return false;
+    if (prog->off[i] == 0)
+      dec = static_cast<signed char>(prog->arg[i]);
+  }
+  if (dec != 1 && dec != -1)
+    return false;
+
+  // A loop which increments mp[0] runs 256 - mp[0] times, which is
+  // the same as running -mp[0] times.
+  vector<pair<int, int> > muls;
+  for (size_t i = begin + 1; i < prog->size(); i++) {
+    if (prog->off[i])
+      muls.push_back(make_pair(prog->off[i], prog->arg[i] * -dec));
+  }
+  prog->truncate(begin);
+  for (size_t i = 0; i < muls.size(); i++)
+    prog->push(OP_MUL, muls[i].second, muls[i].first);
+  prog->push(OP_CLEAR, 0);
+  return true;
+}
+
+void parse(const char* code, Program* prog) {
+  Pending pending;
   vector<int> loop_stack;
   for (const char* p = code; *p; p++) {
     char c = *p;
-    Op* op = new Op();
     switch (c) {
       case '+':
-      case '-': {
-        op->arg = merge_ops('+', '-', &p);
-        if (op->arg) {
-          op->op = OP_MEM;
-          cur_loop->addsub[cur_loop->ptr] += op->arg;
-        } else {
-          delete op;
-          op = NULL;
-        }
+      case '-':
+        pending.adds[pending.ptr] += merge_ops('+', '-', &p);
         break;
-      }
 
       case '>':
-      case '<': {
-        op->arg = merge_ops('>', '<', &p);
-        if (op->arg) {
-          op->op = OP_PTR;
-          cur_loop->ptr += op->arg;
-        } else {
-          delete op;
-          op = NULL;
-        }
+      case '<':
+        pending.ptr += merge_ops('>', '<', &p);
         break;
-      }
 
       case '.':
-      case ',': {
-        op->op = c;
-        cur_loop->has_io = true;
+      case ',':
+        pending.flush(prog);
+        prog->push(c, 0);
         break;
-      }
 
-      case '[': {
-        cur_loop->reset(ops);
-        op->op = c;
-        loop_stack.push_back(ops->size());
+      case '[':
+        pending.flush(prog);
+        loop_stack.push_back(prog->size());
+        prog->push(c, 0);
         break;
-      }
 
-      case ']':
+      case ']': {
         if (loop_stack.empty()) {
           fprintf(stderr, "unmatched close paren\n");
           exit(1);
         }
 
-        if (!cur_loop->has_io && cur_loop->ptr == 0 &&
-            cur_loop->addsub[0] == -1) {
-          op->op = OP_LOOP;
-          op->loop = cur_loop;
-          cur_loop = new Loop();
-          cur_loop->has_io = true;
-        } else {
-          cur_loop->reset(ops);
-          op->op = c;
-          op->arg = loop_stack.back();
-          (*ops)[op->arg]->arg = ops->size();
-        }
+        pending.flush(prog);
+        int begin = loop_stack.back();
         loop_stack.pop_back();
+        if (!lower_loop(begin, prog)) {
+          prog->arg[begin] = prog->size();
+          prog->push(c, begin);
+        }
         break;
+      }
 
       case '#':
-        if (g_trace && p[1] == '{') {
-          op->op = OP_COMMENT;
+        if (g_profile && p[1] == ' ') {
+          // A "# ..." line from elc starts a new region.
+          string name;
+          for (p += 2; *p != '\n'; p++) {
+            name += *p;
+          }
+          pending.flush(prog);
+          prog->regions.push_back(name);
+        } else if ((g_trace || g_profile) && p[1] == '{') {
+          string comment;
           for (p += 2; *p != '}'; p++) {
-            op->comment += *p;
+            comment += *p;
           }
-        } else {
-          goto nop;
+          pending.flush(prog);
+          prog->push(OP_COMMENT, prog->comments.size());
+          prog->comments.push_back(comment);
         }
         break;
 
       case '@':
         if (g_verbose) {
-          op->op = c;
-          break;
+          pending.flush(prog);
+          prog->push(c, 0);
         }
-        goto nop;
-
-      default:
-      nop:
-        delete op;
-        op = NULL;
+        break;
     }
-
-    if (op)
-      cur_loop->code.push_back(op);
   }
 
-  cur_loop->reset(ops);
+  pending.flush(prog);
 
   if (!loop_stack.empty()) {
     fprintf(stderr, "unmatched open paren\n");
@@ -199,58 +247,241 @@ void alloc_mem(size_t mp, vector<byte>* mem) {
   }
 }
 
-int read_mem(const vector<byte>& mem, int index) {
+int read_mem(const byte* mem, int index) {
   return mem[index-1] * 65536 + mem[index] * 256 + mem[index+1];
 }
 
-void dump_state(const vector<byte>& mem) {
+void dump_state(const byte* mem, size_t size) {
   static const char* kRegs[] = {
     "PC", "A", "B", "C", "D", "BP", "SP"
   };
   for (int i = 0; i < 7; i++) {
     if (i)
       printf(" ");
-    int v = read_mem(mem, 8 + 6 * i);
-    if (i == 0)
+    int v;
+    if (i == 0) {
+      // bf.c keeps the next pc in binary, one bit in every 3 cells.
+      v = 0;
+      for (int b = 0; b < 24 && 75 + b * 3 < (int)size; b++)
+        v |= mem[75 + b * 3] << b;
       v--;
+    } else {
+      v = read_mem(mem, 8 + 6 * i);
+    }
     printf("%s=%d", kRegs[i], v);
   }
   printf("\n");
   fflush(stdout);
 }
 
-void run(const vector<Op*>& ops) {
-  int mp = 0;
-  vector<byte> mem(1);
-  for (size_t pc = 0; pc < ops.size(); pc++) {
-    const Op* op = ops[pc];
-    switch (op->op) {
-      case '+':
-        mem[mp]++;
-        break;
+void trace(const char* comment, size_t pc) {
+  fprintf(stderr, "TRACE %s %f %lu\n",
+          comment,
+          static_cast<double>(clock()) / CLOCKS_PER_SEC,
+          pc);
+}
 
-      case '-':
-        mem[mp]--;
-        break;
+// Counts the ops executed in each region of the program. elc starts a
+// region at every "# ..." comment, so there is one per EIR instruction
+// ("add A 1 pc=3 @7"), one for the entry of each basic block ("pc=3")
+// and one for each routine such as "memory (load)". "#{push:X}" and
+// "#{pop:X}" magic comments delimit spans which may cross regions.
+//
+// Time is measured in executed ops, which are also used as the
+// timestamps of the Chrome trace.
+class Profiler {
+ public:
+  explicit Profiler(const Program& prog)
+      : prog_(prog), steps_(prog.regions.size()),
+        entries_(prog.regions.size()), cur_(-1), start_(0), step_(0),
+        num_events_(0) {
+    fp_ = fopen(g_profile, "wb");
+    if (!fp_) {
+      perror("open");
+      exit(1);
+    }
+    fprintf(fp_, "[");
+  }
 
-      case OP_MEM:
-        mem[mp] += op->arg;
-        break;
+  void count(int region) {
+    if (region != cur_) {
+      leave();
+      cur_ = region;
+      start_ = step_;
+      entries_[region]++;
+    }
+    steps_[region]++;
+    step_++;
+  }
 
-      case '>':
-        mp++;
-        alloc_mem(mp, &mem);
-        break;
+  void magic_comment(const string& comment) {
+    if (!comment.compare(0, 5, "push:")) {
+      spans_.push_back(make_pair(comment.substr(5), step_));
+      event(comment.substr(5), "B", step_, 2);
+    } else if (!comment.compare(0, 4, "pop:") && !spans_.empty()) {
+      pop_span();
+    }
+  }
 
-      case '<':
-        mp--;
-        check_bound(mp);
+  void finish() {
+    leave();
+    while (!spans_.empty())
+      pop_span();
+    fprintf(fp_, "\n]\n");
+    fclose(fp_);
+    if (num_events_ > kMaxEvents) {
+      fprintf(stderr, "trace truncated after %lu events\n", kMaxEvents);
+    }
+    report();
+  }
+
+ private:
+  static const size_t kMaxEvents = 1000000;
+
+  typedef map<string, pair<long, long> > Summary;
+
+  // "add A 1 pc=3 @7" => "add", "pc=3" => "(block entry)".
+  static string category(const string& name) {
+    if (!name.compare(0, 3, "pc="))
+      return "(block entry)";
+    if (name.find(" pc=") != string::npos)
+      return name.substr(0, name.find(' '));
+    return name;
+  }
+
+  void leave() {
+    if (cur_ < 0)
+      return;
+    const string& name = prog_.regions[cur_];
+    if (!name.compare(0, 3, "pc=") || name.find(" pc=") != string::npos)
+      event(name, "X", start_, 1, step_ - start_, "EIR");
+    else
+      event(name, "X", start_, 1, step_ - start_, "BF");
+  }
+
+  void pop_span() {
+    const pair<string, long>& span = spans_.back();
+    pair<long, long>& total = spans_total_[span.first];
+    total.first += step_ - span.second;
+    total.second++;
+    event(span.first, "E", step_, 2);
+    spans_.pop_back();
+  }
+
+  void event(const string& name, const char* ph, long ts, int tid,
+             long dur = 0, const char* cat = "BF") {
+    if (num_events_++ >= kMaxEvents)
+      return;
+    fprintf(fp_, "%s\n{\"cat\":\"%s\",\"name\":\"", num_events_ > 1 ? "," : "",
+            cat);
+    for (size_t i = 0; i < name.size(); i++) {
+      if (name[i] == '"' || name[i] == '\\')
+        fputc('\\', fp_);
+      fputc(name[i], fp_);
+    }
+    fprintf(fp_, "\",\"ph\":\"%s\",\"ts\":%ld,", ph, ts);
+    if (*ph == 'X')
+      fprintf(fp_, "\"dur\":%ld,", dur);
+    fprintf(fp_, "\"pid\":1,\"tid\":%d}", tid);
+  }
+
+  void print_summary(const char* title, const Summary& summary,
+                     size_t limit) {
+    vector<pair<pair<long, long>, string> > rows;
+    for (Summary::const_iterator iter = summary.begin();
+         iter != summary.end();
+         ++iter) {
+      rows.push_back(make_pair(iter->second, iter->first));
+    }
+    sort(rows.rbegin(), rows.rend());
+    fprintf(stderr, "\n%14s %6s %12s  %s\n", "steps", "%", "count", title);
+    for (size_t i = 0; i < rows.size() && i < limit; i++) {
+      fprintf(stderr, "%14ld %6.2f %12ld  %s\n",
+              rows[i].first.first,
+              100.0 * rows[i].first.first / max(step_, 1L),
+              rows[i].first.second,
+              rows[i].second.c_str());
+    }
+  }
+
+  void report() {
+    Summary ops;
+    Summary regions;
+    for (size_t i = 0; i < steps_.size(); i++) {
+      if (!steps_[i])
+        continue;
+      const string& name = prog_.regions[i];
+      pair<long, long>& op = ops[category(name)];
+      op.first += steps_[i];
+      op.second += entries_[i];
+      // Regions with the same name, e.g. the per-bit dispatch code,
+      // are reported together.
+      pair<long, long>& region = regions[name];
+      region.first += steps_[i];
+      region.second += entries_[i];
+    }
+
+    fprintf(stderr, "%ld steps\n", step_);
+    print_summary("op", ops, ops.size());
+    print_summary("region", regions, 30);
+    if (!spans_total_.empty())
+      print_summary("span", spans_total_, spans_total_.size());
+  }
+
+  const Program& prog_;
+  vector<long> steps_;
+  vector<long> entries_;
+  int cur_;
+  long start_;
+  long step_;
+  size_t num_events_;
+  vector<pair<string, long> > spans_;
+  Summary spans_total_;
+  FILE* fp_;
+};
+
+// Like [>] but uses memchr for the common unit stride.
+int scan(int mp, int step, vector<byte>* mem) {
+  if (step == 1) {
+    while (true) {
+      const void* p = memchr(&(*mem)[mp], 0, mem->size() - mp);
+      if (p)
+        return static_cast<const byte*>(p) - &(*mem)[0];
+      mp = mem->size();
+      alloc_mem(mp, mem);
+    }
+  }
+  while ((*mem)[mp]) {
+    mp += step;
+    check_bound(mp);
+    alloc_mem(mp, mem);
+  }
+  return mp;
+}
+
+// Instantiated separately for profiling so the plain interpreter does
+// not pay for it.
+template <bool kProfile>
+void run(const Program& prog, Profiler* profiler) {
+  const byte* ops = &prog.op[0];
+  const int* args = &prog.arg[0];
+  const int* offs = &prog.off[0];
+  const int max_off = prog.max_off;
+  int mp = 0;
+  vector<byte> mem(max_off + 1);
+  for (size_t pc = 0; pc < prog.size(); pc++) {
+    if (kProfile)
+      profiler->count(prog.region[pc]);
+    switch (ops[pc]) {
+      case OP_ADD:
+        check_bound(mp + offs[pc]);
+        mem[mp + offs[pc]] += args[pc];
         break;
 
       case OP_PTR:
-        mp += op->arg;
+        mp += args[pc];
         check_bound(mp);
-        alloc_mem(mp, &mem);
+        alloc_mem(mp + max_off, &mem);
         break;
 
       case '.':
@@ -263,80 +494,63 @@ void run(const vector<Op*>& ops) {
 
       case '[':
         if (mem[mp] == 0)
-          pc = op->arg;
+          pc = args[pc];
         break;
 
       case ']':
-        pc = op->arg - 1;
+        pc = args[pc] - 1;
         break;
 
-      case OP_LOOP: {
-        int v = mem[mp];
+      case OP_MUL:
+        check_bound(mp + offs[pc]);
+        mem[mp + offs[pc]] += mem[mp] * args[pc];
+        break;
+
+      case OP_CLEAR:
         mem[mp] = 0;
-        for (map<int, int>::const_iterator iter = op->loop->addsub.begin();
-             iter != op->loop->addsub.end();
-             ++iter) {
-          int p = iter->first;
-          int d = iter->second;
-          if (p != 0) {
-            alloc_mem(mp + p, &mem);
-            mem[mp + p] += v * d;
-          }
-        }
         break;
-      }
 
-      case OP_COMMENT: {
-        fprintf(stderr, "TRACE %s %f %lu\n",
-                op->comment.c_str(),
-                static_cast<double>(clock()) / CLOCKS_PER_SEC,
-                pc);
+      case OP_SCAN:
+        mp = scan(mp, args[pc], &mem);
+        alloc_mem(mp + max_off, &mem);
+        break;
+
+      case OP_COMMENT:
+        if (g_trace)
+          trace(prog.comments[args[pc]].c_str(), pc);
+        if (kProfile)
+          profiler->magic_comment(prog.comments[args[pc]]);
         break;
-      }
 
       case '@':
         if (g_verbose)
-          dump_state(mem);
+          dump_state(&mem[0], mem.size());
         break;
 
     }
   }
 }
 
-void compile(const vector<Op*>& ops, const char* fname) {
+void compile(const Program& prog, const char* fname) {
   FILE* fp = fopen(fname, "wb");
   fprintf(fp, "#include <stdio.h>\n");
+  fprintf(fp, "#include <stdlib.h>\n");
+  fprintf(fp, "#include <string.h>\n");
   fprintf(fp, "unsigned char mem[4096*4096*10];\n");
   fprintf(fp, "int main() {\n");
   fprintf(fp, "unsigned char* mp = mem;\n");
-
-  for (size_t pc = 0; pc < ops.size(); pc++) {
-    const Op* op = ops[pc];
-    switch (op->op) {
-      case '+':
-        fprintf(fp, "++*mp;\n");
-        break;
-
-      case '-':
-        fprintf(fp, "--*mp;\n");
-        break;
-
-      case OP_MEM:
-        if (op->arg)
-          fprintf(fp, "*mp += %d;\n", op->arg);
-        break;
-
-      case '>':
-        fprintf(fp, "mp++;\n");
-        break;
-
-      case '<':
-        fprintf(fp, "mp--;\n");
+  fprintf(fp, "unsigned char* zp;\n");
+
+  for (size_t pc = 0; pc < prog.size(); pc++) {
+    int arg = prog.arg[pc];
+    int off = prog.off[pc];
+    switch (prog.op[pc]) {
+      case OP_ADD:
+        fprintf(fp, "mp[%d] += %d;\n", off, arg);
         break;
 
       case OP_PTR:
-        if (op->arg)
-          fprintf(fp, "mp += %d;\n", op->arg);
+        fprintf(fp, "mp += %d;\n", arg);
         break;
 
       case '.':
@@ -355,19 +569,25 @@ void compile(const vector<Op*>& ops, const char* fname) {
         fprintf(fp, "}\n");
         break;
 
-      case OP_LOOP: {
-        for (map<int, int>::const_iterator iter = op->loop->addsub.begin();
-             iter != op->loop->addsub.end();
-             ++iter) {
-          int p = iter->first;
-          int d = iter->second;
-          if (p != 0) {
-            fprintf(fp, "mp[%d] += *mp * %d;\n", p, d);
-          }
-        }
+      case OP_MUL:
+        fprintf(fp, "mp[%d] += *mp * %d;\n", off, arg);
+        break;
+
+      case OP_CLEAR:
         fprintf(fp, "*mp = 0;\n");
         break;
-      }
+
+      case OP_SCAN:
+        if (arg == 1)
+          fprintf(fp,
+                  "if (!(zp = memchr(mp, 0, mem + sizeof(mem) - mp))) {\n"
+                  "fputs(\"memory pointer out of bound\\n\", stderr);\n"
+                  "exit(1);\n"
+                  "}\n"
+                  "mp = zp;\n");
+        else
+          fprintf(fp, "while (*mp) mp += %d;\n", arg);
+        break;
 
     }
   }
@@ -377,16 +597,234 @@ void compile(const vector<Op*>& ops, const char* fname) {
   fclose(fp);
 }
 
+#ifdef BFOPT_JIT
+
+// Emits x86-64 code with rbx as the memory pointer.
+class JIT {
+ public:
+  void emit(const Program& prog) {
+    // push rbx; mov rbx, rdi
+    emit_bytes({0x53, 0x48, 0x89, 0xfb});
+
+    vector<size_t> loop_stack;
+    for (size_t pc = 0; pc < prog.size(); pc++) {
+      int arg = prog.arg[pc];
+      int off = prog.off[pc];
+      switch (prog.op[pc]) {
+        case OP_ADD:
+          // add byte [rbx+off], imm8
+          emit_bytes({0x80});
+          emit_rbx_operand(0, off);
+          emit_bytes({static_cast<byte>(arg)});
+          break;
+
+        case OP_PTR:
+          emit_add_rbx(arg);
+          break;
+
+        case '.':
+          // movzx edi, byte [rbx]
+          emit_bytes({0x0f, 0xb6, 0x3b});
+          emit_call(reinterpret_cast<void*>(&putchar));
+          break;
+
+        case ',':
+          emit_call(reinterpret_cast<void*>(&getchar));
+          // mov [rbx], al
+          emit_bytes({0x88, 0x03});
+          break;
+
+        case '[':
+          emit_cmp_zero();
+          // je rel32
+          emit_bytes({0x0f, 0x84});
+          emit32(0);
+          loop_stack.push_back(code_.size());
+          break;
+
+        case ']': {
+          size_t body = loop_stack.back();
+          loop_stack.pop_back();
+          emit_cmp_zero();
+          // jne rel32
+          emit_bytes({0x0f, 0x85});
+          emit32(body - (code_.size() + 4));
+          patch32(body - 4, code_.size() - body);
+          break;
+        }
+
+        case OP_MUL:
+          // A run of OP_MUL never writes mp[0], so the first one loads it
+          // into ecx for all of them.
+          if (pc == 0 || prog.op[pc - 1] != OP_MUL) {
+            // movzx ecx, byte [rbx]
+            emit_bytes({0x0f, 0xb6, 0x0b});
+          }
+          if (arg == 1) {
+            // add [rbx+off], cl
+            emit_bytes({0x00});
+          } else if (arg == -1) {
+            // sub [rbx+off], cl
+            emit_bytes({0x28});
+          } else {
+            // imul eax, ecx, imm32; add [rbx+off], al
+            emit_bytes({0x69, 0xc1});
+            emit32(arg);
+            emit_bytes({0x00});
+            emit_rbx_operand(0, off);
+            break;
+          }
+          emit_rbx_operand(1, off);
+          break;
+
+        case OP_CLEAR:
+          // mov byte [rbx], 0
+          emit_bytes({0xc6, 0x03, 0x00});
+          break;
+
+        case OP_SCAN: {
+          // Test once on entry, then at the bottom so that each step
+          // takes a single branch.
+          emit_cmp_zero();
+          // je rel8 to the end
+          emit_bytes({0x74, 0});
+          size_t top = code_.size();
+          emit_add_rbx(arg);
+          emit_cmp_zero();
+          // jne rel8 to top
+          emit_bytes({0x75});
+          emit_bytes({static_cast<byte>(top - (code_.size() + 1))});
+          code_[top - 1] = code_.size() - top;
+          break;
+        }
+
+        case OP_COMMENT:
+          // mov rdi, imm64; mov rsi, imm64
+          emit_bytes({0x48, 0xbf});
+          emit64(reinterpret_cast<uint64_t>(prog.comments[arg].c_str()));
+          emit_bytes({0x48, 0xbe});
+          emit64(pc);
+          emit_call(reinterpret_cast<void*>(&trace));
+          break;
+
+        case '@':
+          // mov rdi, rbx
+          emit_bytes({0x48, 0x89, 0xdf});
+          emit_call(reinterpret_cast<void*>(&dump));
+          break;
+      }
+    }
+
+    // pop rbx; ret
+    emit_bytes({0x5b, 0xc3});
+  }
+
+  void run() {
+    void* code = mmap(NULL, code_.size(), PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    void* mem = mmap(NULL, kMemSize, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (code == MAP_FAILED || mem == MAP_FAILED) {
+      perror("mmap");
+      exit(1);
+    }
+    memcpy(code, &code_[0], code_.size());
+    if (mprotect(code, code_.size(), PROT_READ | PROT_EXEC)) {
+      perror("mprotect");
+      exit(1);
+    }
+    reinterpret_cast<void (*)(byte*)>(code)(static_cast<byte*>(mem));
+  }
+
+ private:
+  static const size_t kMemSize = 1UL << 30;
+
+  static void dump(const byte* mem) {
+    dump_state(mem, kMemSize);
+  }
+
+  void emit_bytes(std::initializer_list<byte> bytes) {
+    code_.insert(code_.end(), bytes);
+  }
+
+  void emit32(uint32_t v) {
+    for (int i = 0; i < 4; i++)
+      code_.push_back(v >> (i * 8));
+  }
+
+  void emit64(uint64_t v) {
+    for (int i = 0; i < 8; i++)
+      code_.push_back(v >> (i * 8));
+  }
+
+  void patch32(size_t at, uint32_t v) {
+    for (int i = 0; i < 4; i++)
+      code_[at + i] = v >> (i * 8);
+  }
+
+  void emit_cmp_zero() {
+    // cmp byte [rbx], 0
+    emit_bytes({0x80, 0x3b, 0x00});
+  }
+
+  void emit_add_rbx(int v) {
+    if (v == static_cast<int8_t>(v)) {
+      // add rbx, imm8
+      emit_bytes({0x48, 0x83, 0xc3, static_cast<byte>(v)});
+    } else {
+      // add rbx, imm32
+      emit_bytes({0x48, 0x81, 0xc3});
+      emit32(v);
+    }
+  }
+
+  // Emits the ModRM byte and displacement for [rbx+off] with reg in the
+  // reg field, using the shortest displacement which fits.
+  void emit_rbx_operand(int reg, int off) {
+    if (off == 0) {
+      emit_bytes({static_cast<byte>(0x03 | reg << 3)});
+    } else if (off == static_cast<int8_t>(off)) {
+      emit_bytes({static_cast<byte>(0x43 | reg << 3), static_cast<byte>(off)});
+    } else {
+      emit_bytes({static_cast<byte>(0x83 | reg << 3)});
+      emit32(off);
+    }
+  }
+
+  void emit_call(void* fn) {
+    // mov rax, imm64; call rax
+    emit_bytes({0x48, 0xb8});
+    emit64(reinterpret_cast<uint64_t>(fn));
+    emit_bytes({0xff, 0xd0});
+  }
+
+  vector<byte> code_;
+};
+
+#endif
+
 int main(int argc, char* argv[]) {
   bool should_compile = false;
+  bool should_jit = false;
   const char* arg0 = argv[0];
   while (argc >= 2 && argv[1][0] == '-') {
     if (!strcmp(argv[1], "-c")) {
       should_compile = true;
+    } else if (!strcmp(argv[1], "-jit")) {
+#ifdef BFOPT_JIT
+      should_jit = true;
+#else
+      fprintf(stderr, "-jit is only supported on x86-64 Linux\n");
+      return 1;
+#endif
     } else if (!strcmp(argv[1], "-t")) {
       g_trace = true;
     } else if (!strcmp(argv[1], "-v")) {
       g_verbose = true;
+    } else if (!strcmp(argv[1], "-p") && argc >= 3) {
+      g_profile = argv[2];
+      argc--;
+      argv++;
     } else {
       fprintf(stderr, "Unknown flag: %s\n", argv[1]);
       return 1;
@@ -396,7 +834,19 @@ int main(int argc, char* argv[]) {
   }
 
   if (argc < 2 || (argc < 3 && should_compile)) {
-    fprintf(stderr, "Usage: %s <bf>\n", arg0);
+    fprintf(stderr,
+            "Usage: %s [-jit] [-t] [-v] [-p FILE] <bf>\n"
+            "       %s -c <bf> FILE\n"
+            "  -c       write C code for <bf> to FILE instead of running it\n"
+            "  -jit     run with the x86-64 JIT\n"
+            "  -p FILE  write a per-region step profile to FILE\n"
+            "  -t       print #{...} comments as they are reached\n"
+            "  -v       dump memory at each @\n",
+            arg0, arg0);
+    return 1;
+  }
+  if (g_profile && (should_compile || should_jit)) {
+    fprintf(stderr, "-p works only with the interpreter\n");
     return 1;
   }
 
@@ -419,6 +869,13 @@ int main(int argc, char* argv[]) {
           c = fgetc(fp);
           buf += c;
         }
+      } else if (c == ' ' && g_profile) {
+        buf += "# ";
+        for (; c != '\n' && c != EOF;) {
+          c = fgetc(fp);
+          buf += c == EOF ? '\n' : c;
+        }
+        continue;
       }
     }
     if (strchr("+-<>.,[]@", c))
@@ -426,10 +883,21 @@ int main(int argc, char* argv[]) {
   }
   fclose(fp);
 
-  vector<Op*> ops;
-  parse(buf.c_str(), &ops);
-  if (should_compile)
-    compile(ops, argv[2]);
-  else
-    run(ops);
+  Program prog;
+  parse(buf.c_str(), &prog);
+  if (should_compile) {
+    compile(prog, argv[2]);
+  } else if (should_jit) {
+#ifdef BFOPT_JIT
+    JIT jit;
+    jit.emit(prog);
+    jit.run();
+#endif
+  } else if (g_profile) {
+    Profiler profiler(prog);
+    run<true>(prog, &profiler);
+    profiler.finish();
+  } else {
+    run<false>(prog, NULL);
+  }
 }
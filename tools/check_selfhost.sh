@@ -27,7 +27,7 @@ for prog in 8cc elc; do
     sed 's/ *#.*//' out/${prog}.c.eir > ${dir}/stage1/${prog}.c.eir
 done
 
-if [ ${TARGET} = x86 ]; then
+if [ ${TARGET} = x86 ] || [ ${TARGET} = x86_64 ]; then
     run_trg() {
         chmod 755 $1
         ${time} $1